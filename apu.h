@@ -0,0 +1,488 @@
+#pragma once
+
+#include "common.h"
+#include "bus.h"
+#include "scheduler.h"
+#include "blip.h"
+
+#define NR10_ADDR 0xFF10
+#define NR50_ADDR 0xFF24
+#define NR51_ADDR 0xFF25
+#define NR52_ADDR 0xFF26
+#define WAVE_RAM_ADDR 0xFF30
+#define WAVE_RAM_END 0xFF3F
+
+#define APU_CHANNELS 4
+#define APU_CLOCK_HZ 4194304
+#define APU_SAMPLE_RATE 48000
+#define APU_FRAME_SEQ_CYCLES 8192 // 512 Hz
+#define APU_VOLUME_SCALE 64.0f // 4 channels at 15 with master volume 8 stays inside int16
+#define APU_MAX_FRAME_CYCLES (APU_CLOCK_HZ / 20) // Unread audio beyond this is thrown away
+#define APU_NOISE_MIN_PERIOD 64 // Faster noise is clocked in batches, its steps are far above Nyquist anyway
+
+#define NR52_POWER 0x80
+
+// Channel registers are NRx0 - NRx4 at NR10_ADDR + channel * 5
+#define APU_NRX0 0
+#define APU_NRX1 1
+#define APU_NRX2 2
+#define APU_NRX3 3
+#define APU_NRX4 4
+
+#define NRX4_TRIGGER 0x80
+#define NRX4_LENGTH_ENABLE 0x40
+
+enum { APU_PULSE1, APU_PULSE2, APU_WAVE, APU_NOISE };
+
+// Bits that always read back as 1, indexed from NR10
+static const uint8_t apu_read_mask[NR52_ADDR - NR10_ADDR + 1] = {
+	0x80, 0x3F, 0x00, 0xFF, 0xBF,
+	0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+	0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+	0xFF, 0xFF, 0x00, 0x00, 0xBF,
+	0x00, 0x00, 0x70
+};
+
+// One bit per duty step, 12.5%, 25%, 50% and 75%
+static const uint8_t apu_duty_table[4] = { 0x80, 0x81, 0xE1, 0x7E };
+
+static const uint8_t apu_noise_divisor[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+typedef struct {
+	bool enabled;
+	bool dac;
+	bool length_enabled;
+	uint16_t length;
+	uint16_t freq;
+
+	uint8_t volume;
+	uint8_t env_timer;
+
+	uint8_t pos; // Duty step or wave sample
+	uint32_t period; // Cycles per waveform step
+	uint64_t next; // Cycle of the next waveform step
+
+	uint8_t amp; // Current level, 0 - 15
+	int16_t out_left; // Level last handed to each blip buffer, scaled by master volume
+	int16_t out_right;
+} apu_channel;
+
+typedef struct {
+	bus_ctx *bus;
+	scheduler_ctx *sched;
+	const uint64_t *clock;
+
+	apu_channel ch[APU_CHANNELS];
+	uint8_t frame_step;
+
+	bool sweep_enabled;
+	uint16_t sweep_shadow;
+	uint8_t sweep_timer;
+
+	uint16_t lfsr;
+
+	// Channels only emit level changes, the blip buffers turn them into samples
+	uint64_t frame_start;
+	blip_buffer left;
+	blip_buffer right;
+} apu_ctx;
+
+static inline uint8_t *apu_reg (apu_ctx *apu, int channel, int reg) {
+	return &apu->bus->io[NR10_ADDR - IO_ADDR + channel * 5 + reg];
+}
+
+// Sets a channel's level at a cycle, only the change in each output is added to the buffers
+static inline void apu_output (apu_ctx *apu, int channel, uint64_t time, uint8_t amp) {
+	apu_channel *ch = &apu->ch[channel];
+	uint8_t nr50 = apu->bus->io[NR50_ADDR - IO_ADDR];
+	uint8_t nr51 = apu->bus->io[NR51_ADDR - IO_ADDR];
+	int16_t left = nr51 & (0x10 << channel) ? amp * (((nr50 >> 4) & 7) + 1) : 0;
+	int16_t right = nr51 & (0x01 << channel) ? amp * ((nr50 & 7) + 1) : 0;
+
+	ch->amp = amp;
+
+	if (left != ch->out_left) {
+		blip_add_delta(&apu->left, time - apu->frame_start, (left - ch->out_left) * APU_VOLUME_SCALE);
+		ch->out_left = left;
+	}
+
+	if (right != ch->out_right) {
+		blip_add_delta(&apu->right, time - apu->frame_start, (right - ch->out_right) * APU_VOLUME_SCALE);
+		ch->out_right = right;
+	}
+}
+
+// Level of the channel at its current waveform step
+static inline uint8_t apu_level (apu_ctx *apu, int channel) {
+	apu_channel *ch = &apu->ch[channel];
+
+	switch (channel) {
+	case APU_PULSE1:
+	case APU_PULSE2:
+		return (apu_duty_table[*apu_reg(apu, channel, APU_NRX1) >> 6] >> ch->pos) & 1 ? ch->volume : 0;
+	case APU_WAVE: {
+		uint8_t shift = (*apu_reg(apu, channel, APU_NRX2) >> 5) & 3;
+		uint8_t byte = apu->bus->io[WAVE_RAM_ADDR - IO_ADDR + ch->pos / 2];
+
+		return shift ? (ch->pos & 1 ? byte & 0x0F : byte >> 4) >> (shift - 1) : 0;
+	}
+	default:
+		return apu->lfsr & 1 ? 0 : ch->volume;
+	}
+}
+
+static inline void apu_step (apu_ctx *apu, int channel) {
+	apu_channel *ch = &apu->ch[channel];
+
+	if (channel == APU_NOISE) {
+		uint16_t bit = (apu->lfsr ^ (apu->lfsr >> 1)) & 1;
+
+		apu->lfsr = (apu->lfsr >> 1) | (bit << 14);
+
+		if (*apu_reg(apu, channel, APU_NRX3) & 0x08)
+			apu->lfsr = (apu->lfsr & ~0x40) | (bit << 6);
+	} else {
+		ch->pos = (ch->pos + 1) & (channel == APU_WAVE ? 31 : 7);
+	}
+}
+
+// Catch-up for one channel, loops once per waveform step and only touches the buffers when the level changes
+static inline void apu_run_channel (apu_ctx *apu, int channel, uint64_t until) {
+	apu_channel *ch = &apu->ch[channel];
+	uint32_t batch = 1;
+	bool silent;
+
+	if (!ch->enabled || ch->next > until)
+		return;
+
+	if (channel == APU_WAVE)
+		silent = (*apu_reg(apu, channel, APU_NRX2) & 0x60) == 0;
+	else
+		silent = ch->volume == 0;
+
+	// A silent channel only has its position moved on, the noise LFSR is left where it is
+	if (silent && ch->amp == 0) {
+		uint64_t steps = (until - ch->next) / ch->period + 1;
+
+		ch->pos = (ch->pos + steps) & (channel == APU_WAVE ? 31 : 7);
+		ch->next += steps * ch->period;
+		return;
+	}
+
+	if (channel == APU_NOISE && ch->period < APU_NOISE_MIN_PERIOD)
+		batch = APU_NOISE_MIN_PERIOD / ch->period;
+
+	while (ch->next <= until) {
+		uint8_t amp;
+
+		for (uint32_t i = 0; i < batch; i++)
+			apu_step(apu, channel);
+
+		amp = apu_level(apu, channel);
+
+		if (amp != ch->amp)
+			apu_output(apu, channel, ch->next, amp);
+
+		ch->next += ch->period * batch;
+	}
+}
+
+static inline void apu_sync (apu_ctx *apu) {
+	for (int i = 0; i < APU_CHANNELS; i++)
+		apu_run_channel(apu, i, *apu->clock);
+}
+
+static inline void apu_update_period (apu_ctx *apu, int channel) {
+	apu_channel *ch = &apu->ch[channel];
+
+	if (channel == APU_NOISE) {
+		uint8_t nr43 = *apu_reg(apu, channel, APU_NRX3);
+
+		ch->period = apu_noise_divisor[nr43 & 7] << (nr43 >> 4);
+	} else {
+		ch->freq = bytes_to_u16(*apu_reg(apu, channel, APU_NRX3), *apu_reg(apu, channel, APU_NRX4) & 7);
+		ch->period = (2048 - ch->freq) * (channel == APU_WAVE ? 2 : 4);
+	}
+}
+
+static inline void apu_disable (apu_ctx *apu, int channel) {
+	apu->ch[channel].enabled = false;
+	apu_output(apu, channel, *apu->clock, 0);
+}
+
+// Frequency the next sweep step would set, overflowing past 2047 silences channel 1
+static inline uint16_t apu_sweep_next (apu_ctx *apu) {
+	uint8_t nr10 = apu->bus->io[NR10_ADDR - IO_ADDR];
+	uint16_t delta = apu->sweep_shadow >> (nr10 & 7);
+	uint16_t freq = nr10 & 0x08 ? apu->sweep_shadow - delta : apu->sweep_shadow + delta;
+
+	if (freq > 2047)
+		apu_disable(apu, APU_PULSE1);
+
+	return freq;
+}
+
+static inline void apu_trigger (apu_ctx *apu, int channel) {
+	apu_channel *ch = &apu->ch[channel];
+	uint8_t nrx2 = *apu_reg(apu, channel, APU_NRX2);
+
+	ch->enabled = ch->dac;
+
+	if (ch->length == 0)
+		ch->length = channel == APU_WAVE ? 256 : 64;
+
+	apu_update_period(apu, channel);
+	ch->next = *apu->clock + ch->period;
+
+	if (channel == APU_WAVE) {
+		ch->pos = 0;
+		ch->volume = 15;
+	} else {
+		ch->volume = nrx2 >> 4;
+		ch->env_timer = nrx2 & 7;
+	}
+
+	if (channel == APU_NOISE)
+		apu->lfsr = 0x7FFF;
+
+	if (channel == APU_PULSE1) {
+		uint8_t nr10 = apu->bus->io[NR10_ADDR - IO_ADDR];
+
+		apu->sweep_shadow = ch->freq;
+		apu->sweep_timer = (nr10 >> 4) & 7 ? (nr10 >> 4) & 7 : 8;
+		apu->sweep_enabled = nr10 & 0x77;
+
+		if (nr10 & 7)
+			apu_sweep_next(apu);
+	}
+
+	apu_output(apu, channel, *apu->clock, ch->enabled ? apu_level(apu, channel) : 0);
+}
+
+static inline void apu_clock_length (apu_ctx *apu) {
+	for (int i = 0; i < APU_CHANNELS; i++) {
+		apu_channel *ch = &apu->ch[i];
+
+		if (ch->length_enabled && ch->length && --ch->length == 0)
+			apu_disable(apu, i);
+	}
+}
+
+static inline void apu_clock_sweep (apu_ctx *apu) {
+	uint8_t nr10 = apu->bus->io[NR10_ADDR - IO_ADDR];
+	uint8_t period = (nr10 >> 4) & 7;
+
+	if (--apu->sweep_timer > 0)
+		return;
+
+	apu->sweep_timer = period ? period : 8;
+
+	if (apu->sweep_enabled && period) {
+		uint16_t freq = apu_sweep_next(apu);
+
+		if (freq <= 2047 && (nr10 & 7)) {
+			apu->sweep_shadow = freq;
+			*apu_reg(apu, APU_PULSE1, APU_NRX3) = freq & 0xFF;
+			*apu_reg(apu, APU_PULSE1, APU_NRX4) = (*apu_reg(apu, APU_PULSE1, APU_NRX4) & ~7) | (freq >> 8);
+			apu_update_period(apu, APU_PULSE1);
+			apu_sweep_next(apu);
+		}
+	}
+}
+
+static inline void apu_clock_envelope (apu_ctx *apu) {
+	for (int i = 0; i < APU_CHANNELS; i++) {
+		apu_channel *ch = &apu->ch[i];
+		uint8_t nrx2 = *apu_reg(apu, i, APU_NRX2);
+
+		if (i == APU_WAVE || (nrx2 & 7) == 0 || --ch->env_timer > 0)
+			continue;
+
+		ch->env_timer = nrx2 & 7;
+
+		if (nrx2 & 0x08 ? ch->volume < 15 : ch->volume > 0) {
+			ch->volume += nrx2 & 0x08 ? 1 : -1;
+
+			if (ch->enabled)
+				apu_output(apu, i, *apu->clock, apu_level(apu, i));
+		}
+	}
+}
+
+// Frame sequencer, 512 Hz: length on even steps, sweep on 2 and 6, envelope on 7
+static inline void apu_event (void *ctx, uint64_t when) {
+	apu_ctx *apu = ctx;
+
+	apu_sync(apu);
+
+	if (apu->bus->io[NR52_ADDR - IO_ADDR] & NR52_POWER) {
+		if ((apu->frame_step & 1) == 0)
+			apu_clock_length(apu);
+
+		if (apu->frame_step == 2 || apu->frame_step == 6)
+			apu_clock_sweep(apu);
+
+		if (apu->frame_step == 7)
+			apu_clock_envelope(apu);
+
+		apu->frame_step = (apu->frame_step + 1) & 7;
+	}
+
+	// Nobody is reading samples, headless or paused, start a fresh frame so the buffers never overflow
+	if (*apu->clock - apu->frame_start > APU_MAX_FRAME_CYCLES) {
+		blip_clear(&apu->left);
+		blip_clear(&apu->right);
+		apu->frame_start = *apu->clock;
+	}
+
+	scheduler_schedule(apu->sched, SCHED_APU, when + APU_FRAME_SEQ_CYCLES);
+}
+
+static inline uint8_t apu_read (void *ctx, uint16_t addr) {
+	apu_ctx *apu = ctx;
+	uint8_t *io = apu->bus->io;
+
+	if (addr == NR52_ADDR) {
+		uint8_t status = 0x70 | (io[NR52_ADDR - IO_ADDR] & NR52_POWER);
+
+		apu_sync(apu);
+
+		for (int i = 0; i < APU_CHANNELS; i++)
+			status |= apu->ch[i].enabled << i;
+
+		return status;
+	}
+
+	if (addr > NR52_ADDR)
+		return addr >= WAVE_RAM_ADDR ? io[addr - IO_ADDR] : 0xFF;
+
+	return io[addr - IO_ADDR] | apu_read_mask[addr - NR10_ADDR];
+}
+
+static inline void apu_write_power (apu_ctx *apu, uint8_t data) {
+	uint8_t *io = apu->bus->io;
+	bool was_on = io[NR52_ADDR - IO_ADDR] & NR52_POWER;
+
+	io[NR52_ADDR - IO_ADDR] = data & NR52_POWER;
+
+	// Powering off clears every register and silences all channels
+	if (was_on && !(data & NR52_POWER)) {
+		for (int i = 0; i < APU_CHANNELS; i++) {
+			apu_disable(apu, i);
+			apu->ch[i].dac = false;
+			apu->ch[i].length_enabled = false;
+		}
+
+		memset(io + NR10_ADDR - IO_ADDR, 0, NR52_ADDR - NR10_ADDR);
+	} else if (!was_on && (data & NR52_POWER)) {
+		apu->frame_step = 0;
+	}
+}
+
+// Every write first brings the channels up to now, so the old settings apply to everything before it
+static inline void apu_write (void *ctx, uint16_t addr, uint8_t data) {
+	apu_ctx *apu = ctx;
+	uint8_t *io = apu->bus->io;
+	int channel = (addr - NR10_ADDR) / 5;
+	int reg = (addr - NR10_ADDR) % 5;
+	apu_channel *ch;
+
+	apu_sync(apu);
+
+	if (addr >= WAVE_RAM_ADDR) {
+		io[addr - IO_ADDR] = data;
+		return;
+	}
+
+	if (addr == NR52_ADDR) {
+		apu_write_power(apu, data);
+		return;
+	}
+
+	if (!(io[NR52_ADDR - IO_ADDR] & NR52_POWER) || addr > NR52_ADDR)
+		return;
+
+	io[addr - IO_ADDR] = data;
+
+	// Master volume and panning change every channel's output at once
+	if (addr == NR50_ADDR || addr == NR51_ADDR) {
+		for (int i = 0; i < APU_CHANNELS; i++)
+			apu_output(apu, i, *apu->clock, apu->ch[i].enabled ? apu->ch[i].amp : 0);
+		return;
+	}
+
+	ch = &apu->ch[channel];
+
+	switch (reg) {
+	case APU_NRX0:
+		if (channel == APU_WAVE && !(ch->dac = data & 0x80))
+			apu_disable(apu, channel);
+		break;
+	case APU_NRX1:
+		if (channel == APU_WAVE)
+			ch->length = 256 - data;
+		else
+			ch->length = 64 - (data & 0x3F);
+		break;
+	case APU_NRX2:
+		if (channel != APU_WAVE && !(ch->dac = data & 0xF8))
+			apu_disable(apu, channel);
+		break;
+	case APU_NRX3:
+		apu_update_period(apu, channel);
+		break;
+	case APU_NRX4:
+		ch->length_enabled = data & NRX4_LENGTH_ENABLE;
+		apu_update_period(apu, channel);
+
+		if (data & NRX4_TRIGGER)
+			apu_trigger(apu, channel);
+		break;
+	}
+}
+
+// Closes the audio frame at the current cycle, the samples it produced are then ready to read
+static inline void apu_end_frame (apu_ctx *apu) {
+	uint64_t now = *apu->clock;
+
+	apu_sync(apu);
+	blip_end_frame(&apu->left, now - apu->frame_start);
+	blip_end_frame(&apu->right, now - apu->frame_start);
+	apu->frame_start = now;
+}
+
+// Interleaved stereo, returns the number of sample frames written
+static inline int apu_read_samples (apu_ctx *apu, int16_t *out, int frames) {
+	int n = blip_read_samples(&apu->left, out, frames, 2);
+
+	blip_read_samples(&apu->right, out + 1, n, 2);
+
+	return n;
+}
+
+static inline void apu_init (apu_ctx *apu, bus_ctx *bus, scheduler_ctx *sched, const uint64_t *clock) {
+	memset(apu, 0, sizeof(*apu));
+
+	apu->bus = bus;
+	apu->sched = sched;
+	apu->clock = clock;
+	apu->frame_start = *clock;
+	apu->lfsr = 0x7FFF;
+
+	blip_init(&apu->left, APU_CLOCK_HZ, APU_SAMPLE_RATE);
+	blip_init(&apu->right, APU_CLOCK_HZ, APU_SAMPLE_RATE);
+
+	for (int i = 0; i < APU_CHANNELS; i++)
+		apu->ch[i].period = 2048 * 4;
+
+	// Left behind by the boot ROM: powered, full volume, every channel on both sides
+	bus->io[NR50_ADDR - IO_ADDR] = 0x77;
+	bus->io[NR51_ADDR - IO_ADDR] = 0xF3;
+	bus->io[NR52_ADDR - IO_ADDR] = NR52_POWER;
+
+	for (uint16_t addr = NR10_ADDR; addr <= WAVE_RAM_END; addr++)
+		bus_map_io(bus, addr, apu_read, apu_write, apu);
+
+	scheduler_register(sched, SCHED_APU, apu_event, apu);
+	scheduler_schedule(sched, SCHED_APU, *clock + APU_FRAME_SEQ_CYCLES);
+}
\ No newline at end of file
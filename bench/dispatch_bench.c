@@ -0,0 +1,155 @@
+#include <time.h>
+
+#include "common.h"
+#include "sm83.h"
+
+#define BENCH_ROM_SIZE (2 * ROM_BANK_SIZE)
+#define BENCH_DEFAULT_CYCLES 400000000ULL
+
+// Fixed workload: walks WRAM with loads, ALU and CB ops, a call/ret per byte and a pair of loops
+const uint8_t bench_program[] = {
+    0x31, 0x00, 0xE0, // 0000: LD SP, 0xE000
+    0x21, 0x00, 0xC0, // 0003: LD HL, 0xC000
+    0x06, 0x00,       // 0006: LD B, 0
+    0x0E, 0x10,       // 0008: LD C, 16
+    0x7E,             // 000A: LD A, [HL]
+    0x80,             // 000B: ADD A, B
+    0x77,             // 000C: LD [HL], A
+    0x23,             // 000D: INC HL
+    0xA9,             // 000E: XOR A, C
+    0xCD, 0x30, 0x00, // 000F: CALL 0x0030
+    0x0D,             // 0012: DEC C
+    0x20, 0xF5,       // 0013: JR NZ, 0x000A
+    0x04,             // 0015: INC B
+    0x7C,             // 0016: LD A, H
+    0xFE, 0xD0,       // 0017: CP A, 0xD0
+    0x38, 0x02,       // 0019: JR C, 0x001D
+    0x26, 0xC0,       // 001B: LD H, 0xC0
+    0xC3, 0x08, 0x00  // 001D: JP 0x0008
+};
+
+const uint8_t bench_subroutine[] = {
+    0xC5,             // 0030: PUSH BC
+    0xE5,             // 0031: PUSH HL
+    0x57,             // 0032: LD D, A
+    0x1F,             // 0033: RRA
+    0xCB, 0x3A,       // 0034: SRL D
+    0x8A,             // 0036: ADC A, D
+    0xE1,             // 0037: POP HL
+    0xC1,             // 0038: POP BC
+    0xC9              // 0039: RET
+};
+
+typedef void (*run_fn) (sm83_ctx *cpu, bus_ctx *bus);
+
+typedef struct {
+    const char *name;
+    run_fn run;
+} dispatch_variant;
+
+double now_seconds (void) {
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void reset_machine (sm83_ctx *cpu, bus_ctx *bus, const uint8_t *rom, uint16_t entry) {
+    bus_init(bus, rom, BENCH_ROM_SIZE);
+    sm83_reset(cpu);
+
+    cpu->pc = entry;
+}
+
+int main (int argc, char *argv[]) {
+    uint8_t *rom = calloc(BENCH_ROM_SIZE, 1);
+    bus_ctx *bus = malloc(sizeof(bus_ctx));
+    uint64_t cycles = BENCH_DEFAULT_CYCLES;
+    uint64_t instructions = 0;
+    uint16_t entry = 0x0000;
+    sm83_ctx cpu;
+    sm83_ctx reference;
+    uint64_t reference_hash;
+    bool mismatch = false;
+
+    dispatch_variant variants[] = {
+        { "switch", sm83_run_switch },
+        { "table", sm83_run_table },
+#ifdef SM83_HAS_THREADED
+        { "threaded", sm83_run_threaded },
+#endif
+    };
+
+    if (rom == NULL || bus == NULL) {
+        perror("Unable to allocate bench memory");
+        return EXIT_FAILURE;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        FILE *file = fopen(argv[1], "rb");
+
+        if (file == NULL) {
+            perror("Unable to open ROM");
+            return EXIT_FAILURE;
+        }
+
+        // Bank 0 and 1 are enough for a throughput number
+        fread(rom, 1, BENCH_ROM_SIZE, file);
+        fclose(file);
+        entry = 0x0100;
+    } else {
+        memcpy(rom, bench_program, sizeof(bench_program));
+        memcpy(rom + 0x0030, bench_subroutine, sizeof(bench_subroutine));
+    }
+
+    if (argc > 2)
+        cycles = strtoull(argv[2], NULL, 0);
+
+    // Count instructions once by single stepping, every variant stops on the same instruction boundary
+    reset_machine(&reference, bus, rom, entry);
+
+    while (reference.is_running && reference.cycles < cycles) {
+        sm83_step_switch(&reference, bus);
+        instructions++;
+    }
+
+    reference_hash = bus_hash(bus);
+
+    printf("workload: %s, %llu cycles, %llu instructions\n",
+        argc > 1 && strcmp(argv[1], "-") != 0 ? argv[1] : "builtin",
+        (unsigned long long)reference.cycles, (unsigned long long)instructions);
+    printf("%-10s %12s %12s %10s\n", "dispatch", "MIPS", "MHz", "x DMG");
+
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+        double start, elapsed;
+
+        reset_machine(&cpu, bus, rom, entry);
+
+        start = now_seconds();
+
+        // HALT and EI end a run early, the reference steps straight over them so carry on the same way
+        while (cpu.is_running && cpu.cycles < cycles) {
+            cpu.deadline = cycles;
+            variants[i].run(&cpu, bus);
+        }
+
+        elapsed = now_seconds() - start;
+
+        if (cpu.pc != reference.pc || cpu.cycles != reference.cycles ||
+            bus_hash(bus) != reference_hash) {
+            printf("%s: final state differs from the reference run\n", variants[i].name);
+            mismatch = true;
+        }
+
+        printf("%-10s %12.2f %12.2f %10.1f%s\n", variants[i].name,
+            instructions / elapsed / 1e6,
+            cpu.cycles / elapsed / 1e6,
+            cpu.cycles / elapsed / SM83_CLOCK_HZ,
+            strcmp(variants[i].name, SM83_DISPATCH_NAME) == 0 ? "  (build default)" : "");
+    }
+
+    free(rom);
+    free(bus);
+
+    return mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
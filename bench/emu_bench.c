@@ -0,0 +1,375 @@
+#include <time.h>
+
+#include "common.h"
+#include "cartridge_header.h"
+#include "sm83.h"
+#include "mapper.h"
+#include "machine.h"
+#include "rom_image.h"
+
+#define BENCH_ROM_SIZE (2 * ROM_BANK_SIZE)
+#define BENCH_ENTRY 0x0100
+#define BENCH_DEFAULT_CYCLES 200000000ULL
+#define BENCH_DEFAULT_RUNS 3
+#define BENCH_MAX_WORKLOADS 64
+
+// Synthetic mixes, each one loops forever from 0x0100
+
+const uint8_t mix_alu[] = {
+    0x3E, 0x01,       // 0100: LD A, 1
+    0x06, 0x03,       // 0102: LD B, 3
+    0x0E, 0x05,       // 0104: LD C, 5
+    0x16, 0x07,       // 0106: LD D, 7
+    0x1E, 0x0B,       // 0108: LD E, 11
+    0x80,             // 010A: ADD A, B
+    0x89,             // 010B: ADC A, C
+    0x92,             // 010C: SUB A, D
+    0x9B,             // 010D: SBC A, E
+    0xA0,             // 010E: AND A, B
+    0xB1,             // 010F: OR A, C
+    0xAA,             // 0110: XOR A, D
+    0xBB,             // 0111: CP A, E
+    0x3C,             // 0112: INC A
+    0x05,             // 0113: DEC B
+    0x04,             // 0114: INC B
+    0xC6, 0x11,       // 0115: ADD A, 0x11
+    0xD6, 0x03,       // 0117: SUB A, 3
+    0xEE, 0x5A,       // 0119: XOR A, 0x5A
+    0x27,             // 011B: DAA
+    0x2F,             // 011C: CPL
+    0x1F,             // 011D: RRA
+    0x07,             // 011E: RLCA
+    0x09,             // 011F: ADD HL, BC
+    0x13,             // 0120: INC DE
+    0x18, 0xE7        // 0121: JR 0x010A
+};
+
+const uint8_t mix_load_store[] = {
+    0x21, 0x00, 0xC0, // 0100: LD HL, 0xC000
+    0x11, 0x00, 0xD0, // 0103: LD DE, 0xD000
+    0x31, 0x00, 0xE0, // 0106: LD SP, 0xE000
+    0x2A,             // 0109: LD A, [HL+]
+    0x12,             // 010A: LD [DE], A
+    0x1C,             // 010B: INC E
+    0x46,             // 010C: LD B, [HL]
+    0x70,             // 010D: LD [HL], B
+    0xE0, 0x80,       // 010E: LDH [0x80], A
+    0xF0, 0x80,       // 0110: LDH A, [0x80]
+    0xC5,             // 0112: PUSH BC
+    0xC1,             // 0113: POP BC
+    0x4E,             // 0114: LD C, [HL]
+    0x71,             // 0115: LD [HL], C
+    0xEA, 0x00, 0xC8, // 0116: LD [0xC800], A
+    0xFA, 0x01, 0xC8, // 0119: LD A, [0xC801]
+    0x7C,             // 011C: LD A, H
+    0xFE, 0xD0,       // 011D: CP A, 0xD0
+    0x20, 0xE8,       // 011F: JR NZ, 0x0109
+    0x26, 0xC0,       // 0121: LD H, 0xC0
+    0x18, 0xE4        // 0123: JR 0x0109
+};
+
+const uint8_t mix_branch[] = {
+    0x31, 0x00, 0xE0, // 0100: LD SP, 0xE000
+    0x06, 0x08,       // 0103: LD B, 8
+    0xCD, 0x20, 0x01, // 0105: CALL 0x0120
+    0x05,             // 0108: DEC B
+    0x20, 0xFA,       // 0109: JR NZ, 0x0105
+    0xA7,             // 010B: AND A, A
+    0x28, 0x01,       // 010C: JR Z, 0x010F
+    0x00,             // 010E: NOP
+    0xC2, 0x03, 0x01, // 010F: JP NZ, 0x0103
+    0xC3, 0x03, 0x01, // 0112: JP 0x0103
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x3C,             // 0120: INC A
+    0xC8,             // 0121: RET Z
+    0xFE, 0x80,       // 0122: CP A, 0x80
+    0xD8,             // 0124: RET C
+    0xAF,             // 0125: XOR A, A
+    0xC9              // 0126: RET
+};
+
+const uint8_t mix_cb[] = {
+    0x21, 0x00, 0xC0, // 0100: LD HL, 0xC000
+    0xCB, 0x47,       // 0103: BIT 0, A
+    0xCB, 0xC0,       // 0105: SET 0, B
+    0xCB, 0x81,       // 0107: RES 0, C
+    0xCB, 0x12,       // 0109: RL D
+    0xCB, 0x3B,       // 010B: SRL E
+    0xCB, 0x37,       // 010D: SWAP A
+    0xCB, 0x06,       // 010F: RLC [HL]
+    0xCB, 0x7E,       // 0111: BIT 7, [HL]
+    0xCB, 0xDE,       // 0113: SET 3, [HL]
+    0xCB, 0x1F,       // 0115: RR A
+    0xCB, 0x20,       // 0117: SLA B
+    0xCB, 0x29,       // 0119: SRA C
+    0x18, 0xE6        // 011B: JR 0x0103
+};
+
+typedef struct {
+    const char *name;
+    const uint8_t *program; // NULL for ROM workloads
+    size_t program_size;
+    const char *path;
+} bench_workload;
+
+typedef struct {
+    uint64_t instructions;
+    uint64_t cycles;
+    double seconds;
+    bool stopped; // CPU hit an illegal opcode before the cycle budget
+} bench_result;
+
+double now_seconds (void) {
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void print_usage (const char *program_name) {
+    printf("Usage: %s [options] [rom.gb ...]\n", program_name);
+    printf("  --cycles N     T-cycles per run (default %llu)\n", BENCH_DEFAULT_CYCLES);
+    printf("  --runs N       Runs per workload, the fastest is reported (default %d)\n", BENCH_DEFAULT_RUNS);
+    printf("  --mix NAME     Only run the named synthetic mix, 'none' skips all of them\n");
+    printf("  --json PATH    Also write the results as JSON, '-' for stdout\n");
+    exit(EXIT_SUCCESS);
+}
+
+// Every dispatcher executes the same instruction stream, so one untimed pass stepping a single instruction
+// at a time counts what the timed runs go through. A HALT skipped to the next event counts as one step
+uint64_t bench_count_mix (bus_ctx *bus, mapper_ctx *mapper, cartridge_header *cart_h, const uint8_t *rom, size_t rom_size, uint64_t until) {
+    sm83_ctx cpu;
+    uint64_t instructions = 0;
+
+    bus_init(bus, rom, rom_size);
+    mapper_init(mapper, bus, cart_h, rom, rom_size);
+    sm83_reset(&cpu);
+
+    while (cpu.is_running && cpu.cycles < until) {
+        next_instruction(&cpu, bus);
+        instructions++;
+    }
+
+    mapper_free(mapper);
+    return instructions;
+}
+
+uint64_t bench_count_rom (gb_machine *gb, uint64_t cycles) {
+    uint64_t instructions = 0;
+
+    while (gb->cpu.is_running && gb->cpu.cycles < cycles) {
+        machine_step(gb);
+        instructions++;
+    }
+
+    return instructions;
+}
+
+// Synthetic mixes only exercise the CPU, so they run straight through the configured dispatcher
+void bench_run_mix (bus_ctx *bus, mapper_ctx *mapper, cartridge_header *cart_h, const uint8_t *rom, size_t rom_size, uint64_t until, bench_result *result) {
+    sm83_ctx cpu;
+    double start;
+
+    bus_init(bus, rom, rom_size);
+    mapper_init(mapper, bus, cart_h, rom, rom_size);
+    sm83_reset(&cpu);
+
+    start = now_seconds();
+    sm83_run(&cpu, bus, until);
+    result->seconds = now_seconds() - start;
+
+    result->cycles = cpu.cycles;
+    result->stopped = !cpu.is_running;
+    mapper_free(mapper);
+}
+
+// ROMs get the whole machine, anything polling LY, TIMA or an interrupt would otherwise spin forever
+void bench_run_rom (gb_machine *gb, uint64_t cycles, bench_result *result) {
+    double start = now_seconds();
+
+    machine_run(gb, cycles);
+    result->seconds = now_seconds() - start;
+
+    result->cycles = gb->cpu.cycles;
+    result->stopped = !gb->cpu.is_running;
+}
+
+bool bench_workload_run (bench_workload *workload, uint64_t cycles, int runs, bus_ctx *bus, bench_result *best) {
+    static uint8_t program_rom[BENCH_ROM_SIZE];
+    rom_image rom = {0};
+    cartridge_header cart_h = {0};
+    mapper_ctx mapper;
+    const uint8_t *rom_data = program_rom;
+    size_t rom_size = BENCH_ROM_SIZE;
+    gb_machine *gb;
+    uint64_t instructions;
+
+    if (workload->path) {
+        if (!rom_image_open(&rom, workload->path)) {
+            fprintf(stderr, "%s: unable to load ROM\n", workload->path);
+            rom_image_close(&rom);
+            return false;
+        }
+
+        rom_data = rom.data;
+        rom_size = rom.size;
+
+        if ((gb = machine_create(rom_data, rom_size)) == NULL) {
+            fprintf(stderr, "%s: truncated ROM or unsupported cartridge type\n", workload->name);
+            rom_image_close(&rom);
+            return false;
+        }
+
+        instructions = bench_count_rom(gb, cycles);
+        machine_destroy(gb);
+    } else {
+        memset(program_rom, 0, sizeof(program_rom));
+        memcpy(program_rom + BENCH_ENTRY, workload->program, workload->program_size);
+
+        instructions = bench_count_mix(bus, &mapper, &cart_h, rom_data, rom_size, cycles);
+    }
+
+    for (int i = 0; i < runs; i++) {
+        bench_result result;
+
+        if (workload->path) {
+            // The ROM already made one machine, so only memory can run out here
+            if ((gb = machine_create(rom_data, rom_size)) == NULL) {
+                fprintf(stderr, "%s: unable to allocate a machine\n", workload->name);
+                rom_image_close(&rom);
+                return false;
+            }
+
+            bench_run_rom(gb, cycles, &result);
+            machine_destroy(gb);
+        } else {
+            bench_run_mix(bus, &mapper, &cart_h, rom_data, rom_size, cycles, &result);
+        }
+
+        result.instructions = instructions;
+
+        if (i == 0 || result.seconds < best->seconds)
+            *best = result;
+    }
+
+    if (workload->path)
+        rom_image_close(&rom);
+
+    return true;
+}
+
+void print_json (FILE *out, bench_workload *workloads, bench_result *results, size_t count, uint64_t cycles) {
+    fprintf(out, "{\n  \"dispatch\": \"%s\",\n  \"clock_hz\": %d,\n  \"cycles_per_run\": %llu,\n  \"results\": [",
+        SM83_DISPATCH_NAME, SM83_CLOCK_HZ, (unsigned long long)cycles);
+
+    for (size_t i = 0; i < count; i++) {
+        bench_result *r = &results[i];
+
+        fprintf(out, "%s\n    { \"name\": \"", i ? "," : "");
+
+        // ROM paths are the only free-form strings
+        for (const char *c = workloads[i].name; *c; c++) {
+            if (*c == '"' || *c == '\\')
+                fputc('\\', out);
+            fputc(*c, out);
+        }
+
+        fprintf(out, "\", \"instructions\": %llu, \"cycles\": %llu, \"seconds\": %.6f, "
+            "\"instructions_per_sec\": %.0f, \"cycles_per_sec\": %.0f, \"speed_multiple\": %.2f, \"stopped\": %s }",
+            (unsigned long long)r->instructions, (unsigned long long)r->cycles, r->seconds,
+            r->instructions / r->seconds, r->cycles / r->seconds, r->cycles / r->seconds / SM83_CLOCK_HZ,
+            r->stopped ? "true" : "false");
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int main (int argc, char *argv[]) {
+    bench_workload mixes[] = {
+        { "alu", mix_alu, sizeof(mix_alu), NULL },
+        { "load_store", mix_load_store, sizeof(mix_load_store), NULL },
+        { "branch", mix_branch, sizeof(mix_branch), NULL },
+        { "cb", mix_cb, sizeof(mix_cb), NULL },
+    };
+    bench_workload workloads[BENCH_MAX_WORKLOADS];
+    bench_result results[BENCH_MAX_WORKLOADS];
+    const char *rom_paths[BENCH_MAX_WORKLOADS];
+    size_t rom_count = 0;
+    size_t workload_count = 0;
+    size_t result_count = 0;
+    uint64_t cycles = BENCH_DEFAULT_CYCLES;
+    int runs = BENCH_DEFAULT_RUNS;
+    const char *only_mix = NULL;
+    const char *json_path = NULL;
+    bus_ctx *bus = malloc(sizeof(bus_ctx));
+    bool failed = false;
+
+    if (bus == NULL) {
+        perror("Unable to allocate bench memory");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) {
+            cycles = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+        } else if (strcmp(argv[i], "--mix") == 0 && i + 1 < argc) {
+            only_mix = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            print_usage(argv[0]);
+        } else if (rom_count < BENCH_MAX_WORKLOADS - 4) {
+            rom_paths[rom_count++] = argv[i];
+        }
+    }
+
+    // Synthetic mixes go first so every report has the same leading rows
+    for (size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++) {
+        if (only_mix == NULL || strcmp(only_mix, mixes[i].name) == 0)
+            workloads[workload_count++] = mixes[i];
+    }
+
+    for (size_t i = 0; i < rom_count; i++)
+        workloads[workload_count++] = (bench_workload){ rom_paths[i], NULL, 0, rom_paths[i] };
+
+    printf("dispatch: %s, %llu cycles per run, best of %d\n", SM83_DISPATCH_NAME, (unsigned long long)cycles, runs);
+    printf("%-24s %14s %14s %12s %10s\n", "workload", "instructions", "instr/s", "cycles/s", "x DMG");
+
+    for (size_t i = 0; i < workload_count; i++) {
+        bench_result *r = &results[result_count];
+
+        if (!bench_workload_run(&workloads[i], cycles, runs, bus, r)) {
+            failed = true;
+            continue;
+        }
+
+        workloads[result_count++] = workloads[i];
+
+        printf("%-24s %14llu %14.0f %12.0f %10.1f%s\n", workloads[i].name,
+            (unsigned long long)r->instructions,
+            r->instructions / r->seconds,
+            r->cycles / r->seconds,
+            r->cycles / r->seconds / SM83_CLOCK_HZ,
+            r->stopped ? "  (stopped early)" : "");
+    }
+
+    if (json_path) {
+        FILE *out = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+
+        if (out == NULL) {
+            perror("Unable to open JSON output");
+            failed = true;
+        } else {
+            print_json(out, workloads, results, result_count, cycles);
+
+            if (out != stdout)
+                fclose(out);
+        }
+    }
+
+    free(bus);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include <time.h>
+
+#include "common.h"
+#include "tile_decode.h"
+
+#define BENCH_LINES 512
+#define BENCH_LINE_TILES 21
+#define BENCH_DEFAULT_PASSES 16000
+
+typedef void (*line_fn) (const uint8_t *src, const uint32_t *palette, uint32_t *out);
+
+typedef struct {
+    const char *name;
+    line_fn decode;
+    bool cached; // src is a line of tile cache colour indices rather than bit planes
+} decode_variant;
+
+// One scanline per call, the same shape as tile_decode_line, so palette setup is hoisted out of the tile loop
+#define BENCH_LINE_DECODER(name, row) \
+    void decode_line_##name (const uint8_t *planes, const uint32_t *palette, uint32_t *out) { \
+        uint32_t colors[4]; \
+        memcpy(colors, palette, sizeof(colors)); \
+        for (int i = 0; i < BENCH_LINE_TILES; i++) \
+            row(planes[i * 2], planes[i * 2 + 1], colors, out + i * 8); \
+    }
+
+BENCH_LINE_DECODER(scalar, tile_decode_row_scalar)
+BENCH_LINE_DECODER(swar, tile_decode_row_swar)
+#ifdef TILE_DECODE_HAS_SSE2
+BENCH_LINE_DECODER(sse2, tile_decode_row_sse2)
+#endif
+#ifdef TILE_DECODE_HAS_AVX2
+BENCH_LINE_DECODER(avx2, tile_decode_row_avx2)
+#endif
+#ifdef TILE_DECODE_HAS_NEON
+BENCH_LINE_DECODER(neon, tile_decode_row_neon)
+#endif
+
+// Palette pass over rows already decoded by the tile cache, what the PPU does per scanline
+#define BENCH_LINE_RESOLVER(name, resolve) \
+    void resolve_line_##name (const uint8_t *indices, const uint32_t *palette, uint32_t *out) { \
+        uint32_t colors[4]; \
+        memcpy(colors, palette, sizeof(colors)); \
+        resolve(indices, BENCH_LINE_TILES * 8, colors, out); \
+    }
+
+BENCH_LINE_RESOLVER(scalar, tile_resolve_scalar)
+#ifdef TILE_DECODE_HAS_SSE2
+BENCH_LINE_RESOLVER(sse2, tile_resolve_sse2)
+#endif
+#ifdef TILE_DECODE_HAS_AVX2
+BENCH_LINE_RESOLVER(avx2, tile_resolve_avx2)
+#endif
+#ifdef TILE_DECODE_HAS_NEON
+BENCH_LINE_RESOLVER(neon, tile_resolve_neon)
+#endif
+
+double now_seconds (void) {
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+uint64_t checksum (const uint32_t *pixels, size_t count) {
+    return hash_fnv1a_64(FNV1A_64_INIT, (const uint8_t *)pixels, count * sizeof(uint32_t));
+}
+
+int main (int argc, char *argv[]) {
+    const uint32_t palette[4] = { 0xFFE0F8D0, 0xFF88C070, 0xFF346856, 0xFF081820 };
+    uint8_t *planes = malloc(BENCH_LINES * BENCH_LINE_TILES * 2);
+    uint8_t *indices = malloc(BENCH_LINES * BENCH_LINE_TILES * 8);
+    uint32_t *out = malloc(BENCH_LINES * BENCH_LINE_TILES * 8 * sizeof(uint32_t));
+    int passes = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_PASSES;
+    uint64_t reference = 0;
+    uint32_t seed = 0x12345678;
+    bool mismatch = false;
+
+    decode_variant variants[] = {
+        { "scalar", decode_line_scalar, false },
+        { "swar", decode_line_swar, false },
+#ifdef TILE_DECODE_HAS_SSE2
+        { "sse2", decode_line_sse2, false },
+#endif
+#ifdef TILE_DECODE_HAS_AVX2
+        { "avx2", decode_line_avx2, false },
+#endif
+#ifdef TILE_DECODE_HAS_NEON
+        { "neon", decode_line_neon, false },
+#endif
+        { "scalar", resolve_line_scalar, true },
+#ifdef TILE_DECODE_HAS_SSE2
+        { "sse2", resolve_line_sse2, true },
+#endif
+#ifdef TILE_DECODE_HAS_AVX2
+        { "avx2", resolve_line_avx2, true },
+#endif
+#ifdef TILE_DECODE_HAS_NEON
+        { "neon", resolve_line_neon, true },
+#endif
+    };
+
+    if (planes == NULL || indices == NULL || out == NULL) {
+        perror("Unable to allocate bench memory");
+        return EXIT_FAILURE;
+    }
+
+    if (passes < 1)
+        passes = 1;
+
+    // xorshift, so every run decodes the same data
+    for (size_t i = 0; i < BENCH_LINES * BENCH_LINE_TILES * 2; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        planes[i] = seed;
+    }
+
+    for (size_t i = 0; i < BENCH_LINES * BENCH_LINE_TILES; i++)
+        tile_decode_indices(planes[i * 2], planes[i * 2 + 1], indices + i * 8);
+
+    printf("%d passes over %d scanlines of %d tiles\n", passes, BENCH_LINES, BENCH_LINE_TILES);
+    printf("%-16s %12s %12s\n", "decoder", "ns/line", "Mpixel/s");
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        line_fn decode = variants[v].decode;
+        const uint8_t *src = variants[v].cached ? indices : planes;
+        size_t stride = variants[v].cached ? BENCH_LINE_TILES * 8 : BENCH_LINE_TILES * 2;
+        double start, elapsed;
+        uint64_t sum;
+
+        start = now_seconds();
+
+        for (int pass = 0; pass < passes; pass++) {
+            for (size_t i = 0; i < BENCH_LINES; i++)
+                decode(src + i * stride, palette, out + i * BENCH_LINE_TILES * 8);
+        }
+
+        elapsed = now_seconds() - start;
+        sum = checksum(out, BENCH_LINES * BENCH_LINE_TILES * 8);
+
+        if (v == 0) {
+            reference = sum;
+        } else if (sum != reference) {
+            printf("%s: output differs from the scalar decoder\n", variants[v].name);
+            mismatch = true;
+        }
+
+        printf("%-7s%-9s %12.2f %12.1f%s\n", variants[v].cached ? "cached " : "", variants[v].name,
+            elapsed * 1e9 / ((double)passes * BENCH_LINES),
+            (double)passes * BENCH_LINES * BENCH_LINE_TILES * 8 / elapsed / 1e6,
+            strcmp(variants[v].name, TILE_DECODE_NAME) == 0 ? "  (build default)" : "");
+    }
+
+    free(planes);
+    free(indices);
+    free(out);
+
+    return mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <math.h>
+
+#include "common.h"
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_TAPS 16
+#define BLIP_MAX_SAMPLES 4096
+#define BLIP_CUTOFF 0.45 // Fraction of the output rate, just under Nyquist
+#define BLIP_LEAK (1.0f / 512) // High-pass on the integrator, keeps the output centred on 0
+
+// Band-limited step synthesis: amplitude changes are added as band-limited impulses at their exact
+// sub-sample position, and the running sum of those impulses is the output. Nothing is done per sample
+// until samples are read
+typedef struct {
+	uint64_t factor; // Output samples per input clock, 32.32 fixed point
+	uint64_t offset; // Fixed point sample position where the current frame starts
+	int avail;
+	float integrator;
+	float kernel[BLIP_PHASES][BLIP_TAPS];
+	float buffer[BLIP_MAX_SAMPLES + BLIP_TAPS];
+} blip_buffer;
+
+static inline void blip_init (blip_buffer *blip, uint32_t clock_rate, uint32_t sample_rate) {
+	memset(blip, 0, sizeof(*blip));
+
+	blip->factor = ((uint64_t)sample_rate << 32) / clock_rate;
+
+	// Blackman windowed sinc for each sub-sample phase, every phase sums to 1 so a step keeps its height
+	for (int p = 0; p < BLIP_PHASES; p++) {
+		double sum = 0;
+
+		for (int i = 0; i < BLIP_TAPS; i++) {
+			double x = i - BLIP_TAPS / 2 - (double)p / BLIP_PHASES;
+			double w = 0.42 + 0.5 * cos(M_PI * x / (BLIP_TAPS / 2)) + 0.08 * cos(2 * M_PI * x / (BLIP_TAPS / 2));
+			double s = x == 0 ? 1.0 : sin(2 * M_PI * BLIP_CUTOFF * x) / (2 * M_PI * BLIP_CUTOFF * x);
+
+			blip->kernel[p][i] = s * w;
+			sum += s * w;
+		}
+
+		for (int i = 0; i < BLIP_TAPS; i++)
+			blip->kernel[p][i] /= sum;
+	}
+}
+
+// time is in input clocks since the start of the frame
+static inline void blip_add_delta (blip_buffer *blip, uint64_t time, float delta) {
+	uint64_t fixed = time * blip->factor + blip->offset;
+	uint64_t index = fixed >> 32;
+	const float *kernel = blip->kernel[(fixed >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+
+	if (index >= BLIP_MAX_SAMPLES)
+		return;
+
+	for (int i = 0; i < BLIP_TAPS; i++)
+		blip->buffer[index + i] += delta * kernel[i];
+}
+
+// Makes the samples up to duration clocks after the frame start readable, the next frame starts there
+static inline void blip_end_frame (blip_buffer *blip, uint64_t duration) {
+	blip->offset += duration * blip->factor;
+
+	// Samples nobody read are dropped rather than overrunning the buffer
+	if ((blip->offset >> 32) > BLIP_MAX_SAMPLES)
+		blip->offset = (blip->offset & 0xFFFFFFFF) | ((uint64_t)BLIP_MAX_SAMPLES << 32);
+
+	blip->avail = blip->offset >> 32;
+}
+
+// Drops everything not yet read, the integrator keeps its level and the leak pulls it back to 0
+static inline void blip_clear (blip_buffer *blip) {
+	memset(blip->buffer, 0, sizeof(blip->buffer));
+	blip->offset = 0;
+	blip->avail = 0;
+}
+
+// Integrates up to count samples into out, stride apart so two buffers can fill one interleaved stream
+static inline int blip_read_samples (blip_buffer *blip, int16_t *out, int count, int stride) {
+	int n = count < blip->avail ? count : blip->avail;
+	float sum = blip->integrator;
+
+	for (int i = 0; i < n; i++) {
+		float s;
+
+		sum += blip->buffer[i];
+		s = sum < -32768.0f ? -32768.0f : sum > 32767.0f ? 32767.0f : sum;
+		out[i * stride] = (int16_t)s;
+		sum -= sum * BLIP_LEAK;
+	}
+
+	blip->integrator = sum;
+	memmove(blip->buffer, blip->buffer + n, (BLIP_MAX_SAMPLES + BLIP_TAPS - n) * sizeof(float));
+	memset(blip->buffer + BLIP_MAX_SAMPLES + BLIP_TAPS - n, 0, n * sizeof(float));
+
+	blip->offset -= (uint64_t)n << 32;
+	blip->avail -= n;
+
+	return n;
+}
\ No newline at end of file
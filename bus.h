@@ -0,0 +1,311 @@
+#pragma once
+
+#include "common.h"
+
+#define BUS_PAGE_SIZE 0x100
+#define BUS_PAGE_COUNT 0x100
+
+#define ROM_BANK_SIZE 0x4000
+#define VRAM_SIZE 0x2000
+#define VRAM_BANKS 2
+#define TILE_DATA_SIZE 0x1800
+#define TILES_PER_BANK (TILE_DATA_SIZE / 16)
+#define TILE_CACHE_TILES (VRAM_BANKS * TILES_PER_BANK)
+#define WRAM_SIZE 0x2000
+#define OAM_SIZE 0xA0
+#define IO_SIZE 0x80
+#define HRAM_SIZE 0x7F
+
+#define VRAM_ADDR 0x8000
+#define EXT_RAM_ADDR 0xA000
+#define WRAM_ADDR 0xC000
+#define ECHO_ADDR 0xE000
+#define OAM_ADDR 0xFE00
+#define IO_ADDR 0xFF00
+#define HRAM_ADDR 0xFF80
+#define IE_ADDR 0xFFFF
+#define VBK_ADDR 0xFF4F
+#define IF_ADDR 0xFF0F
+
+// IE/IF bits, lower bits win when several are pending
+#define INTERRUPT_VBLANK 0x01
+#define INTERRUPT_STAT 0x02
+#define INTERRUPT_TIMER 0x04
+#define INTERRUPT_SERIAL 0x08
+#define INTERRUPT_JOYPAD 0x10
+#define INTERRUPT_MASK 0x1F
+
+typedef uint8_t (*bus_read_fn) (void *ctx, uint16_t addr);
+typedef void (*bus_write_fn) (void *ctx, uint16_t addr, uint8_t data);
+
+typedef struct {
+	// Host pointers for every 256 byte page, NULL sends the access to the page's slow handler
+	const uint8_t *read_page[BUS_PAGE_COUNT];
+	uint8_t *write_page[BUS_PAGE_COUNT];
+
+	bus_read_fn read_slow[BUS_PAGE_COUNT];
+	bus_write_fn write_slow[BUS_PAGE_COUNT];
+	void *read_ctx[BUS_PAGE_COUNT];
+	void *write_ctx[BUS_PAGE_COUNT];
+
+	// IO registers at 0xFF00 - 0xFF7F, peripherals register handlers with bus_map_io
+	bus_read_fn io_read[IO_SIZE];
+	bus_write_fn io_write[IO_SIZE];
+	void *io_ctx[IO_SIZE];
+
+	const uint8_t *rom;
+	size_t rom_size;
+	uint8_t *eram; // cartridge RAM, owned by the mapper
+	size_t eram_size;
+
+	uint8_t vram[VRAM_BANKS * VRAM_SIZE]; // DMG only ever sees bank 0
+	uint8_t vram_bank;
+	bool cgb;
+	uint8_t wram[WRAM_SIZE];
+	uint8_t oam[OAM_SIZE];
+	bool oam_locked; // OAM DMA owns OAM, the CPU reads 0xFF and its writes are dropped
+	uint8_t io[IO_SIZE];
+	uint8_t hram[HRAM_SIZE];
+	uint8_t ie;
+
+	// Zeroed whenever IE or IF change, so a running CPU stops at the next instruction and looks for interrupts
+	uint64_t *interrupt_horizon;
+
+	// Pre-decoded 8x8 tiles as colour indices, a dirty bit per tile is set by every VRAM write that changes tile data
+	uint8_t tile_pixels[TILE_CACHE_TILES][64];
+	uint64_t tile_dirty[TILE_CACHE_TILES / 64];
+} bus_ctx;
+
+static inline uint8_t read_from_memory (bus_ctx *bus, uint16_t addr) {
+	const uint8_t *page = bus->read_page[addr >> 8];
+
+	if (page)
+		return page[addr & 0xFF];
+
+	return bus->read_slow[addr >> 8](bus->read_ctx[addr >> 8], addr);
+}
+
+static inline void write_to_memory (bus_ctx *bus, uint16_t addr, uint8_t data) {
+	uint8_t *page = bus->write_page[addr >> 8];
+
+	if (page) {
+		page[addr & 0xFF] = data;
+		return;
+	}
+
+	bus->write_slow[addr >> 8](bus->write_ctx[addr >> 8], addr, data);
+}
+
+// Points pages directly at host memory, writable pages also take stores without a handler
+static inline void bus_map_memory (bus_ctx *bus, uint8_t first_page, uint16_t page_count, const uint8_t *base, bool writable) {
+	for (uint16_t i = 0; i < page_count; i++) {
+		bus->read_page[first_page + i] = base ? base + i * BUS_PAGE_SIZE : NULL;
+		bus->write_page[first_page + i] = base && writable ? (uint8_t *)base + i * BUS_PAGE_SIZE : NULL;
+	}
+}
+
+// Sets the handlers used for pages that are not directly mapped
+static inline void bus_map_handler (bus_ctx *bus, uint8_t first_page, uint16_t page_count, bus_read_fn read, bus_write_fn write, void *ctx) {
+	for (uint16_t i = 0; i < page_count; i++) {
+		if (read) {
+			bus->read_slow[first_page + i] = read;
+			bus->read_ctx[first_page + i] = ctx;
+		}
+
+		if (write) {
+			bus->write_slow[first_page + i] = write;
+			bus->write_ctx[first_page + i] = ctx;
+		}
+	}
+}
+
+static inline void bus_map_io (bus_ctx *bus, uint16_t addr, bus_read_fn read, bus_write_fn write, void *ctx) {
+	bus->io_read[addr - IO_ADDR] = read;
+	bus->io_write[addr - IO_ADDR] = write;
+	bus->io_ctx[addr - IO_ADDR] = ctx;
+}
+
+static inline uint8_t bus_read_open (void *ctx, uint16_t addr) {
+	return 0xFF;
+}
+
+static inline void bus_write_ignore (void *ctx, uint16_t addr, uint8_t data) {
+}
+
+// 0xFE00 - 0xFEFF: OAM followed by the unusable area
+static inline uint8_t bus_read_oam (void *ctx, uint16_t addr) {
+	bus_ctx *bus = ctx;
+
+	return addr < OAM_ADDR + OAM_SIZE && !bus->oam_locked ? bus->oam[addr - OAM_ADDR] : 0xFF;
+}
+
+static inline void bus_write_oam (void *ctx, uint16_t addr, uint8_t data) {
+	bus_ctx *bus = ctx;
+
+	if (addr < OAM_ADDR + OAM_SIZE && !bus->oam_locked)
+		bus->oam[addr - OAM_ADDR] = data;
+}
+
+// 0x8000 - 0x9FFF: reads are direct, stores land here so the tile cache sees them
+static inline void bus_write_vram (void *ctx, uint16_t addr, uint8_t data) {
+	bus_ctx *bus = ctx;
+	uint16_t offset = addr - VRAM_ADDR;
+	uint8_t *vram = bus->vram + bus->vram_bank * VRAM_SIZE;
+	uint16_t tile = bus->vram_bank * TILES_PER_BANK + offset / 16;
+
+	if (vram[offset] == data)
+		return;
+
+	vram[offset] = data;
+
+	if (offset < TILE_DATA_SIZE)
+		bus->tile_dirty[tile / 64] |= 1ULL << (tile % 64);
+}
+
+// Block store into the current VRAM bank for DMA, every tile the range touches is marked dirty
+static inline void bus_copy_vram (bus_ctx *bus, uint16_t offset, const uint8_t *src, uint16_t len) {
+	memcpy(bus->vram + bus->vram_bank * VRAM_SIZE + offset, src, len);
+
+	for (uint16_t i = offset / 16; i <= (offset + len - 1) / 16 && i < TILES_PER_BANK; i++) {
+		uint16_t tile = bus->vram_bank * TILES_PER_BANK + i;
+
+		bus->tile_dirty[tile / 64] |= 1ULL << (tile % 64);
+	}
+}
+
+// Reads len bytes that do not cross a page, straight from the page table when the page is plain memory
+static inline void bus_read_block (bus_ctx *bus, uint16_t addr, uint8_t *out, uint16_t len) {
+	const uint8_t *page = bus->read_page[addr >> 8];
+
+	if (page) {
+		memcpy(out, page + (addr & 0xFF), len);
+		return;
+	}
+
+	for (uint16_t i = 0; i < len; i++)
+		out[i] = bus->read_slow[addr >> 8](bus->read_ctx[addr >> 8], addr + i);
+}
+
+static inline void bus_map_vram (bus_ctx *bus) {
+	bus_map_memory(bus, VRAM_ADDR >> 8, VRAM_SIZE / BUS_PAGE_SIZE, bus->vram + bus->vram_bank * VRAM_SIZE, false);
+}
+
+// VBK only exists in CGB mode, on DMG it reads as open bus
+static inline uint8_t bus_read_vbk (void *ctx, uint16_t addr) {
+	bus_ctx *bus = ctx;
+
+	return bus->cgb ? 0xFE | bus->vram_bank : 0xFF;
+}
+
+static inline void bus_write_vbk (void *ctx, uint16_t addr, uint8_t data) {
+	bus_ctx *bus = ctx;
+
+	if (bus->cgb) {
+		bus->vram_bank = data & 1;
+		bus_map_vram(bus);
+	}
+}
+
+static inline void bus_poll_interrupts (bus_ctx *bus) {
+	if (bus->interrupt_horizon)
+		*bus->interrupt_horizon = 0;
+}
+
+// Peripherals raise interrupts through here rather than writing IF themselves
+static inline void bus_request_interrupt (bus_ctx *bus, uint8_t bits) {
+	bus->io[IF_ADDR - IO_ADDR] |= bits;
+	bus_poll_interrupts(bus);
+}
+
+static inline uint8_t bus_read_if (void *ctx, uint16_t addr) {
+	bus_ctx *bus = ctx;
+
+	return 0xE0 | bus->io[IF_ADDR - IO_ADDR];
+}
+
+static inline void bus_write_if (void *ctx, uint16_t addr, uint8_t data) {
+	bus_ctx *bus = ctx;
+
+	bus->io[IF_ADDR - IO_ADDR] = data & INTERRUPT_MASK;
+	bus_poll_interrupts(bus);
+}
+
+// 0xFF00 - 0xFFFF: IO registers, HRAM and IE
+static inline uint8_t bus_read_high (void *ctx, uint16_t addr) {
+	bus_ctx *bus = ctx;
+	uint8_t reg = addr & 0xFF;
+
+	if (addr == IE_ADDR)
+		return bus->ie;
+
+	if (addr >= HRAM_ADDR)
+		return bus->hram[addr - HRAM_ADDR];
+
+	if (bus->io_read[reg])
+		return bus->io_read[reg](bus->io_ctx[reg], addr);
+
+	return bus->io[reg];
+}
+
+static inline void bus_write_high (void *ctx, uint16_t addr, uint8_t data) {
+	bus_ctx *bus = ctx;
+	uint8_t reg = addr & 0xFF;
+
+	if (addr == IE_ADDR) {
+		bus->ie = data;
+		bus_poll_interrupts(bus);
+	} else if (addr >= HRAM_ADDR) {
+		bus->hram[addr - HRAM_ADDR] = data;
+	} else if (bus->io_write[reg]) {
+		bus->io_write[reg](bus->io_ctx[reg], addr, data);
+	} else {
+		bus->io[reg] = data;
+	}
+}
+
+static inline void bus_init (bus_ctx *bus, const uint8_t *rom, size_t rom_size) {
+	uint16_t rom_pages = (rom_size < 2 * ROM_BANK_SIZE ? rom_size : 2 * ROM_BANK_SIZE) / BUS_PAGE_SIZE;
+
+	memset(bus, 0, sizeof(*bus));
+
+	bus->rom = rom;
+	bus->rom_size = rom_size;
+
+	bus_map_handler(bus, 0x00, BUS_PAGE_COUNT, bus_read_open, bus_write_ignore, bus);
+
+	// ROM banks 0 and 1, writes land on the ignore handler until a mapper claims them
+	bus_map_memory(bus, 0x00, rom_pages, rom, false);
+
+	bus_map_vram(bus);
+	bus_map_handler(bus, VRAM_ADDR >> 8, VRAM_SIZE / BUS_PAGE_SIZE, NULL, bus_write_vram, bus);
+	memset(bus->tile_dirty, 0xFF, sizeof(bus->tile_dirty));
+	bus_map_memory(bus, WRAM_ADDR >> 8, WRAM_SIZE / BUS_PAGE_SIZE, bus->wram, true);
+
+	// Echo RAM mirrors 0xC000 - 0xDDFF, the mirror costs nothing when it is just more page pointers
+	bus_map_memory(bus, ECHO_ADDR >> 8, (OAM_ADDR - ECHO_ADDR) / BUS_PAGE_SIZE, bus->wram, true);
+
+	bus_map_handler(bus, OAM_ADDR >> 8, 1, bus_read_oam, bus_write_oam, bus);
+	bus_map_handler(bus, IO_ADDR >> 8, 1, bus_read_high, bus_write_high, bus);
+	bus_map_io(bus, VBK_ADDR, bus_read_vbk, bus_write_vbk, bus);
+	bus_map_io(bus, IF_ADDR, bus_read_if, bus_write_if, bus);
+
+	// Left behind by the boot ROM
+	bus->io[IF_ADDR - IO_ADDR] = INTERRUPT_VBLANK;
+}
+
+// Fingerprint of every RAM region the CPU can reach
+static inline uint64_t bus_hash (bus_ctx *bus) {
+	uint64_t hash = FNV1A_64_INIT;
+
+	hash = hash_fnv1a_64(hash, bus->vram, VRAM_BANKS * VRAM_SIZE);
+	hash = hash_fnv1a_64(hash, bus->wram, WRAM_SIZE);
+	hash = hash_fnv1a_64(hash, bus->oam, OAM_SIZE);
+	hash = hash_fnv1a_64(hash, bus->io, IO_SIZE);
+	hash = hash_fnv1a_64(hash, bus->hram, HRAM_SIZE);
+	hash = hash_fnv1a_64(hash, &bus->ie, 1);
+
+	if (bus->eram)
+		hash = hash_fnv1a_64(hash, bus->eram, bus->eram_size);
+
+	return hash;
+}
\ No newline at end of file
@@ -13,6 +13,7 @@
 #define TITLE_ADDR 0x0134
 #define VERSION_ADDR 0x014C
 #define CHECKSUM_ADDR 0x014D
+#define CARTRIDGE_HEADER_END 0x0150
 
 typedef struct {
     char title[17];
@@ -28,7 +29,7 @@ typedef struct {
     uint8_t checksum;
 } cartridge_header;
 
-void print_c_header (cartridge_header *cart_h) {
+static inline void print_c_header (cartridge_header *cart_h) {
     printf("Title: %s\n", cart_h->title);
     printf("CGB Flag: %2X\n", cart_h->cgb_f);
     printf("Licensee Code: %s\n", cart_h->license_c);
@@ -41,7 +42,7 @@ void print_c_header (cartridge_header *cart_h) {
     printf("Header Checksum: %2X\n", cart_h->checksum);
 }
 
-void store_c_header_data (uint8_t *memory, cartridge_header *cart_h) {
+static inline void store_c_header_data (const uint8_t *memory, cartridge_header *cart_h) {
     uint8_t max_title_size = 16;
     uint8_t cgb_f = 0;
     char current_char;
@@ -6,11 +6,11 @@
 #include <stdint.h>
 #include <string.h>
 
-uint8_t get_bit_u8 (uint8_t *target, uint8_t index) {
+static inline uint8_t get_bit_u8 (uint8_t *target, uint8_t index) {
     return (*target & (1 << index)) >> index;
 }
 
-void set_bit_u8 (uint8_t *target, uint8_t index, bool turn_bit_on) {
+static inline void set_bit_u8 (uint8_t *target, uint8_t index, bool turn_bit_on) {
     if (index > 7) return;
 
     if (turn_bit_on) {
@@ -20,6 +20,18 @@ void set_bit_u8 (uint8_t *target, uint8_t index, bool turn_bit_on) {
     }
 }
 
-uint16_t bytes_to_u16 (uint8_t low_byte, uint8_t high_byte) {
+static inline uint16_t bytes_to_u16 (uint8_t low_byte, uint8_t high_byte) {
     return ((uint16_t)high_byte << 8) | low_byte;
+}
+
+#define FNV1A_64_INIT 0xCBF29CE484222325ULL
+
+// FNV-1a, used to fingerprint memory at the end of a headless run. Pass FNV1A_64_INIT or a previous result to chain regions
+static inline uint64_t hash_fnv1a_64 (uint64_t hash, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
 }
\ No newline at end of file
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdarg.h>
+
+#include <SDL3/SDL.h>
+#include <SDL3_ttf/SDL_ttf.h>
+
+#include "common.h"
+
+#define GLYPH_FIRST ' '
+#define GLYPH_LAST '~'
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+
+#define PANEL_ROWS 23
+#define PANEL_COLUMNS 24
+#define PANEL_QUADS (PANEL_ROWS * PANEL_COLUMNS)
+
+// Printable ASCII rendered once into a single row of fixed-size cells
+typedef struct {
+	SDL_Texture *texture;
+	float glyph_w;
+	float glyph_h;
+} glyph_atlas;
+
+// A grid of text drawn from the atlas, every character slot owns one quad
+typedef struct {
+	glyph_atlas atlas;
+	float x;
+	float y;
+	char text[PANEL_ROWS][PANEL_COLUMNS];
+	SDL_Vertex vertices[PANEL_QUADS * 4];
+	int indices[PANEL_QUADS * 6];
+} debug_panel;
+
+static inline bool glyph_atlas_init (glyph_atlas *atlas, SDL_Renderer *renderer, TTF_Font *font) {
+	SDL_Color white = { 255, 255, 255, SDL_ALPHA_OPAQUE };
+	SDL_Surface *sheet;
+	int advance = 0;
+	int height = TTF_GetFontHeight(font);
+
+	// The font is monospaced, the widest advance is the cell width for every glyph
+	for (Uint32 c = GLYPH_FIRST; c <= GLYPH_LAST; c++) {
+		int w;
+
+		if (TTF_GetGlyphMetrics(font, c, NULL, NULL, NULL, NULL, &w) && w > advance)
+			advance = w;
+	}
+
+	if (advance <= 0 || height <= 0)
+		return false;
+
+	sheet = SDL_CreateSurface(advance * GLYPH_COUNT, height, SDL_PIXELFORMAT_ARGB8888);
+
+	if (sheet == NULL)
+		return false;
+
+	SDL_FillSurfaceRect(sheet, NULL, 0);
+
+	for (Uint32 c = GLYPH_FIRST; c <= GLYPH_LAST; c++) {
+		SDL_Surface *glyph = TTF_RenderGlyph_Blended(font, c, white);
+		SDL_Rect cell = { (c - GLYPH_FIRST) * advance, 0, advance, height };
+
+		// Space and anything the font lacks stay transparent
+		if (glyph == NULL)
+			continue;
+
+		SDL_SetSurfaceBlendMode(glyph, SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(glyph, NULL, sheet, &cell);
+		SDL_DestroySurface(glyph);
+	}
+
+	atlas->texture = SDL_CreateTextureFromSurface(renderer, sheet);
+	atlas->glyph_w = advance;
+	atlas->glyph_h = height;
+
+	SDL_DestroySurface(sheet);
+
+	if (atlas->texture == NULL)
+		return false;
+
+	SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+	SDL_SetTextureScaleMode(atlas->texture, SDL_SCALEMODE_NEAREST);
+
+	return true;
+}
+
+static inline void glyph_atlas_free (glyph_atlas *atlas) {
+	SDL_DestroyTexture(atlas->texture);
+	atlas->texture = NULL;
+}
+
+// Rebuilds the quads of one row, characters past the end of the string collapse to nothing
+static inline void debug_panel_layout_row (debug_panel *panel, int row) {
+	const char *text = panel->text[row];
+	bool ended = false;
+	float y = panel->y + row * panel->atlas.glyph_h;
+
+	for (int col = 0; col < PANEL_COLUMNS; col++) {
+		SDL_Vertex *v = &panel->vertices[(row * PANEL_COLUMNS + col) * 4];
+		float x = panel->x + col * panel->atlas.glyph_w;
+		float u0, u1;
+
+		if (text[col] == '\0')
+			ended = true;
+
+		if (ended || text[col] <= GLYPH_FIRST || text[col] > GLYPH_LAST) {
+			for (int i = 0; i < 4; i++)
+				v[i].position = (SDL_FPoint){ x, y };
+			continue;
+		}
+
+		u0 = (float)(text[col] - GLYPH_FIRST) / GLYPH_COUNT;
+		u1 = (float)(text[col] - GLYPH_FIRST + 1) / GLYPH_COUNT;
+
+		v[0].position = (SDL_FPoint){ x, y };
+		v[1].position = (SDL_FPoint){ x + panel->atlas.glyph_w, y };
+		v[2].position = (SDL_FPoint){ x + panel->atlas.glyph_w, y + panel->atlas.glyph_h };
+		v[3].position = (SDL_FPoint){ x, y + panel->atlas.glyph_h };
+		v[0].tex_coord = (SDL_FPoint){ u0, 0.0f };
+		v[1].tex_coord = (SDL_FPoint){ u1, 0.0f };
+		v[2].tex_coord = (SDL_FPoint){ u1, 1.0f };
+		v[3].tex_coord = (SDL_FPoint){ u0, 1.0f };
+	}
+}
+
+static inline bool debug_panel_init (debug_panel *panel, SDL_Renderer *renderer, TTF_Font *font, float x, float y) {
+	SDL_FColor white = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	memset(panel, 0, sizeof(*panel));
+
+	if (!glyph_atlas_init(&panel->atlas, renderer, font))
+		return false;
+
+	panel->x = x;
+	panel->y = y;
+
+	// Two triangles per quad, the index list never changes
+	for (int q = 0; q < PANEL_QUADS; q++) {
+		int *i = &panel->indices[q * 6];
+
+		i[0] = q * 4;
+		i[1] = q * 4 + 1;
+		i[2] = q * 4 + 2;
+		i[3] = q * 4;
+		i[4] = q * 4 + 2;
+		i[5] = q * 4 + 3;
+	}
+
+	for (int v = 0; v < PANEL_QUADS * 4; v++)
+		panel->vertices[v].color = white;
+
+	for (int row = 0; row < PANEL_ROWS; row++)
+		debug_panel_layout_row(panel, row);
+
+	return true;
+}
+
+static inline void debug_panel_free (debug_panel *panel) {
+	glyph_atlas_free(&panel->atlas);
+}
+
+// Only rows whose text actually changed are laid out again
+static inline void debug_panel_printf (debug_panel *panel, int row, const char *fmt, ...) {
+	char str[PANEL_COLUMNS];
+	va_list args;
+
+	if (row < 0 || row >= PANEL_ROWS)
+		return;
+
+	va_start(args, fmt);
+	vsnprintf(str, sizeof(str), fmt, args);
+	va_end(args);
+
+	if (strcmp(panel->text[row], str) == 0)
+		return;
+
+	memcpy(panel->text[row], str, sizeof(str));
+	debug_panel_layout_row(panel, row);
+}
+
+// The whole panel is one geometry submission
+static inline void debug_panel_render (debug_panel *panel, SDL_Renderer *renderer) {
+	SDL_RenderGeometry(renderer, panel->atlas.texture, panel->vertices, PANEL_QUADS * 4, panel->indices, PANEL_QUADS * 6);
+}
\ No newline at end of file
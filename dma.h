@@ -0,0 +1,129 @@
+#pragma once
+
+#include "common.h"
+#include "bus.h"
+#include "scheduler.h"
+#include "ppu.h"
+
+#define DMA_ADDR 0xFF46
+#define HDMA1_ADDR 0xFF51
+#define HDMA2_ADDR 0xFF52
+#define HDMA3_ADDR 0xFF53
+#define HDMA4_ADDR 0xFF54
+#define HDMA5_ADDR 0xFF55
+
+#define OAM_DMA_CYCLES (4 + OAM_SIZE * 4)
+#define HDMA_BLOCK_SIZE 16
+#define HDMA_BLOCK_CYCLES 32
+#define HDMA_HBLANK 0x80
+
+typedef struct {
+	bus_ctx *bus;
+	scheduler_ctx *sched;
+	ppu_ctx *ppu;
+	uint64_t *clock; // GDMA and HBlank blocks stall the CPU by pushing its clock forward
+
+	uint16_t hdma_src;
+	uint16_t hdma_dst; // Offset into VRAM
+	uint8_t hdma_blocks; // 16 byte blocks still to copy
+	bool hdma_hblank; // An HBlank transfer is running
+} dma_ctx;
+
+// OAM is released once the 160 M-cycle transfer would have finished
+static inline void dma_oam_event (void *ctx, uint64_t when) {
+	dma_ctx *dma = ctx;
+
+	dma->bus->oam_locked = false;
+}
+
+// The whole 160 byte copy happens up front, the scheduler only times how long the CPU is locked out of OAM
+static inline void dma_write_oam (void *ctx, uint16_t addr, uint8_t data) {
+	dma_ctx *dma = ctx;
+	uint16_t src = (data >= 0xE0 ? data - 0x20 : data) << 8;
+
+	ppu_sync(dma->ppu);
+
+	dma->bus->io[DMA_ADDR - IO_ADDR] = data;
+	dma->bus->oam_locked = false;
+	bus_read_block(dma->bus, src, dma->bus->oam, OAM_SIZE);
+	dma->bus->oam_locked = true;
+
+	scheduler_schedule(dma->sched, SCHED_DMA, *dma->clock + OAM_DMA_CYCLES);
+}
+
+static inline void dma_hdma_block (dma_ctx *dma) {
+	uint8_t block[HDMA_BLOCK_SIZE];
+
+	bus_read_block(dma->bus, dma->hdma_src, block, HDMA_BLOCK_SIZE);
+	bus_copy_vram(dma->bus, dma->hdma_dst, block, HDMA_BLOCK_SIZE);
+
+	dma->hdma_src += HDMA_BLOCK_SIZE;
+	dma->hdma_dst = (dma->hdma_dst + HDMA_BLOCK_SIZE) & (VRAM_SIZE - 1);
+	dma->hdma_blocks--;
+	*dma->clock += HDMA_BLOCK_CYCLES;
+}
+
+// One block per mode 0, the PPU is already synced to this dot so no catch-up here
+static inline void dma_hblank (void *ctx) {
+	dma_ctx *dma = ctx;
+
+	if (!dma->hdma_hblank)
+		return;
+
+	dma_hdma_block(dma);
+
+	if (dma->hdma_blocks == 0)
+		dma->hdma_hblank = false;
+}
+
+static inline uint8_t dma_read_hdma5 (void *ctx, uint16_t addr) {
+	dma_ctx *dma = ctx;
+
+	if (dma->hdma_blocks == 0)
+		return 0xFF;
+
+	return (dma->hdma_hblank ? 0 : HDMA_HBLANK) | (dma->hdma_blocks - 1);
+}
+
+static inline void dma_write_hdma5 (void *ctx, uint16_t addr, uint8_t data) {
+	dma_ctx *dma = ctx;
+	uint8_t *io = dma->bus->io;
+
+	// Clearing bit 7 while an HBlank transfer runs stops it where it is
+	if (dma->hdma_hblank && !(data & HDMA_HBLANK)) {
+		dma->hdma_hblank = false;
+		return;
+	}
+
+	dma->hdma_src = bytes_to_u16(io[HDMA2_ADDR - IO_ADDR] & 0xF0, io[HDMA1_ADDR - IO_ADDR]);
+	dma->hdma_dst = bytes_to_u16(io[HDMA4_ADDR - IO_ADDR] & 0xF0, io[HDMA3_ADDR - IO_ADDR] & 0x1F);
+	dma->hdma_blocks = (data & 0x7F) + 1;
+	dma->hdma_hblank = data & HDMA_HBLANK;
+
+	if (dma->hdma_hblank)
+		return;
+
+	// General purpose: the CPU stops until every block is copied, so copy them all now
+	ppu_sync(dma->ppu);
+
+	while (dma->hdma_blocks)
+		dma_hdma_block(dma);
+}
+
+static inline void dma_init (dma_ctx *dma, bus_ctx *bus, scheduler_ctx *sched, ppu_ctx *ppu, uint64_t *clock) {
+	memset(dma, 0, sizeof(*dma));
+
+	dma->bus = bus;
+	dma->sched = sched;
+	dma->ppu = ppu;
+	dma->clock = clock;
+
+	bus_map_io(bus, DMA_ADDR, NULL, dma_write_oam, dma);
+	scheduler_register(sched, SCHED_DMA, dma_oam_event, dma);
+
+	if (bus->cgb) {
+		ppu->hblank = dma_hblank;
+		ppu->hblank_ctx = dma;
+		bus_map_io(bus, HDMA5_ADDR, dma_read_hdma5, dma_write_hdma5, dma);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+
+#define HEADLESS_DEFAULT_FRAMES 60
+#define HEADLESS_SERIAL_TIMEOUT_FRAMES 7200 // Two emulated minutes
+#define HEADLESS_CHUNK_CYCLES CYCLES_PER_FRAME // Serial output is looked at between chunks, so a stop lands within a frame of the text
+
+typedef enum {
+	STOP_NONE,
+	STOP_CYCLES,
+	STOP_FRAMES,
+	STOP_PC,
+	STOP_OPCODE,
+	STOP_SERIAL_PASS,
+	STOP_SERIAL_FAIL,
+	STOP_CPU
+} headless_stop;
+
+typedef struct {
+	uint64_t max_cycles;
+	uint64_t max_frames;
+	int32_t until_pc; // -1 when unused
+	int16_t until_op; // -1 when unused
+	const char *serial_pass; // Stop as soon as the serial output contains these, NULL when unused
+	const char *serial_fail;
+} headless_opts;
+
+static inline const char *headless_stop_name (headless_stop reason) {
+	switch (reason) {
+	case STOP_CYCLES: return "cycles";
+	case STOP_FRAMES: return "frames";
+	case STOP_PC: return "pc";
+	case STOP_OPCODE: return "opcode";
+	case STOP_SERIAL_PASS: return "serial_pass";
+	case STOP_SERIAL_FAIL: return "serial_fail";
+	case STOP_CPU: return "cpu";
+	default: return "none";
+	}
+}
+
+static inline void headless_dump_state (sm83_ctx *cpu, bus_ctx *bus, serial_buffer *serial, headless_stop reason) {
+	printf("stop=%s\n", headless_stop_name(reason));
+	printf("cycles=%llu\n", (unsigned long long)cpu->cycles);
+	printf("frames=%llu\n", (unsigned long long)(cpu->cycles / CYCLES_PER_FRAME));
+	printf("pc=0x%04X sp=0x%04X\n", cpu->pc, cpu->sp);
+	printf("a=0x%02X f=0x%02X b=0x%02X c=0x%02X d=0x%02X e=0x%02X h=0x%02X l=0x%02X\n",
+		cpu->rA, sm83_get_f(cpu), cpu->rB, cpu->rC, cpu->rD, cpu->rE, cpu->rH, cpu->rL);
+	printf("ime=%d halted=%d\n", cpu->ime, cpu->is_halted);
+	printf("memory_hash=0x%016llX\n", (unsigned long long)bus_hash(bus));
+	printf("serial=\"");
+
+	// One line per field, so the serial text is escaped
+	for (size_t i = 0; i < serial->len; i++) {
+		uint8_t c = serial->data[i];
+
+		if (c == '\n')
+			printf("\\n");
+		else if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20 || c >= 0x7F)
+			printf("\\x%02X", c);
+		else
+			putchar(c);
+	}
+
+	printf("\"\n");
+}
+
+// Runs the machine with no window, font or renderer until one of the stop conditions is met
+static inline headless_stop run_headless (gb_machine *gb, headless_opts *opts) {
+	serial_buffer serial;
+	sm83_ctx *cpu = &gb->cpu;
+	bus_ctx *bus = &gb->bus;
+	uint64_t cycle_limit = UINT64_MAX;
+	size_t serial_seen = 0;
+	bool stepping = opts->until_pc >= 0 || opts->until_op >= 0; // Only PC and opcode stops need every instruction boundary
+	headless_stop reason = STOP_NONE;
+
+	// Waiting on the serial port only needs a cap on how long to wait, not a fixed run length
+	if (opts->max_cycles == 0 && opts->max_frames == 0 && opts->until_pc < 0 && opts->until_op < 0)
+		opts->max_frames = opts->serial_pass || opts->serial_fail ? HEADLESS_SERIAL_TIMEOUT_FRAMES : HEADLESS_DEFAULT_FRAMES;
+
+	if (opts->max_cycles)
+		cycle_limit = opts->max_cycles;
+
+	if (opts->max_frames && opts->max_frames * CYCLES_PER_FRAME < cycle_limit)
+		cycle_limit = opts->max_frames * CYCLES_PER_FRAME;
+
+	serial.len = 0;
+	serial.data[0] = '\0';
+	serial_set_sink(&gb->serial, serial_sink_buffer, &serial);
+
+	while (reason == STOP_NONE) {
+		if (!cpu->is_running) {
+			reason = STOP_CPU;
+		} else if (cpu->cycles >= cycle_limit) {
+			reason = cycle_limit == opts->max_cycles ? STOP_CYCLES : STOP_FRAMES;
+		} else if (opts->until_pc >= 0 && cpu->pc == opts->until_pc) {
+			reason = STOP_PC;
+		} else if (opts->until_op >= 0 && read_from_memory(bus, cpu->pc) == opts->until_op) {
+			reason = STOP_OPCODE;
+		} else if (serial.len != serial_seen && opts->serial_fail && strstr(serial.data, opts->serial_fail)) {
+			reason = STOP_SERIAL_FAIL;
+		} else if (serial.len != serial_seen && opts->serial_pass && strstr(serial.data, opts->serial_pass)) {
+			reason = STOP_SERIAL_PASS;
+		} else if (stepping) {
+			serial_seen = serial.len;
+			sm83_step_scheduled(cpu, bus, &gb->sched);
+		} else {
+			uint64_t left = cycle_limit - cpu->cycles;
+
+			serial_seen = serial.len;
+			machine_run(gb, left < HEADLESS_CHUNK_CYCLES ? left : HEADLESS_CHUNK_CYCLES);
+		}
+	}
+
+	headless_dump_state(cpu, bus, &serial, reason);
+
+	return reason;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "machine.h"
+
+bool machine_init (gb_machine *gb, const uint8_t *rom, size_t rom_size) {
+	if (rom_size < CARTRIDGE_HEADER_END)
+		return false;
+
+	memset(&gb->cart_h, 0, sizeof(gb->cart_h));
+	store_c_header_data(rom, &gb->cart_h);
+
+	bus_init(&gb->bus, rom, rom_size);
+
+	// A CGB flag in the header unlocks VBK and HDMA, everything else still runs as a DMG
+	gb->bus.cgb = gb->cart_h.cgb_f != 0;
+
+	if (!mapper_init(&gb->mapper, &gb->bus, &gb->cart_h, rom, rom_size))
+		return false;
+
+	sm83_reset(&gb->cpu);
+	scheduler_init(&gb->sched);
+	ppu_init(&gb->ppu, &gb->bus, &gb->sched, &gb->cpu.cycles);
+	timer_init(&gb->timer, &gb->bus, &gb->sched, &gb->cpu.cycles);
+	serial_init(&gb->serial, &gb->bus, &gb->sched, &gb->cpu.cycles);
+	dma_init(&gb->dma, &gb->bus, &gb->sched, &gb->ppu, &gb->cpu.cycles);
+	apu_init(&gb->apu, &gb->bus, &gb->sched, &gb->cpu.cycles);
+
+	return true;
+}
+
+void machine_free (gb_machine *gb) {
+	mapper_free(&gb->mapper);
+}
+
+gb_machine *machine_create (const uint8_t *rom, size_t rom_size) {
+	gb_machine *gb = malloc(sizeof(*gb));
+
+	// A failed init has nothing allocated yet
+	if (gb && !machine_init(gb, rom, rom_size)) {
+		free(gb);
+		return NULL;
+	}
+
+	return gb;
+}
+
+void machine_destroy (gb_machine *gb) {
+	if (gb == NULL)
+		return;
+
+	machine_free(gb);
+	free(gb);
+}
+
+void machine_run (gb_machine *gb, uint64_t cycles) {
+	sm83_run_scheduled(&gb->cpu, &gb->bus, &gb->sched, gb->cpu.cycles + cycles);
+}
+
+uint8_t machine_step (gb_machine *gb) {
+	return sm83_step_scheduled(&gb->cpu, &gb->bus, &gb->sched);
+}
\ No newline at end of file
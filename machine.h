@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+#include "cartridge_header.h"
+#include "bus.h"
+#include "scheduler.h"
+#include "sm83.h"
+#include "mapper.h"
+#include "ppu.h"
+#include "timer.h"
+#include "serial.h"
+#include "dma.h"
+#include "apu.h"
+
+// Everything one emulated Game Boy owns. Components point at each other, so a machine is never moved or copied
+typedef struct {
+	cartridge_header cart_h;
+	sm83_ctx cpu;
+	bus_ctx bus;
+	mapper_ctx mapper;
+	scheduler_ctx sched;
+	ppu_ctx ppu;
+	timer_ctx timer;
+	serial_ctx serial;
+	dma_ctx dma;
+	apu_ctx apu;
+} gb_machine;
+
+// The ROM is borrowed and has to outlive the machine, any number of machines may share one image.
+// Nothing here touches global state, so separate machines can run on separate threads.
+// Init fails on a ROM too short for a header or an unsupported cartridge type, leaving nothing to free
+bool machine_init (gb_machine *gb, const uint8_t *rom, size_t rom_size);
+void machine_free (gb_machine *gb);
+
+// Heap allocated machine, NULL when init fails or memory runs out
+gb_machine *machine_create (const uint8_t *rom, size_t rom_size);
+void machine_destroy (gb_machine *gb);
+
+// Runs for at least cycles T-cycles, stopping at an instruction boundary
+void machine_run (gb_machine *gb, uint64_t cycles);
+uint8_t machine_step (gb_machine *gb);
\ No newline at end of file
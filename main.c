@@ -6,6 +6,12 @@
 #include "common.h"
 #include "cartridge_header.h"
 #include "sm83.h"
+#include "headless.h"
+#include "rom_image.h"
+#include "machine.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "debug_panel.h"
 
 #define MEMORY_MAX 8388608
 #define ROM_GB 1
@@ -21,6 +27,20 @@
 #define SCREEN_X (WINDOW_SIZE - (SCREEN_WIDTH * 1.25)) / 2
 #define SCREEN_Y (WINDOW_SIZE - SCREEN_HEIGHT) / 2
 
+#define FRAME_TIME_NS ((Uint64)CYCLES_PER_FRAME * SDL_NS_PER_SECOND / SM83_CLOCK_HZ)
+#define MAX_FRAME_LAG 4
+#define DEFAULT_TURBO_FRAME_SKIP 4
+#define PANEL_INTERVAL_NS (SDL_NS_PER_SECOND / 10)
+#define MAX_AUDIO_QUEUE_BYTES (APU_SAMPLE_RATE / 10 * 2 * sizeof(int16_t))
+#define REWIND_BUFFER_BYTES (48 << 20)
+#define REWIND_MAX_FRAMES (10 * 60 * 60) // Ten minutes of slices
+
+typedef enum {
+    RUN_STEP,
+    RUN_REALTIME,
+    RUN_TURBO
+} run_mode;
+
 uint8_t gb_rom_type (char *filePath) {
     int len = strlen(filePath);
     char *ext2 = (char *)(filePath + len - 3);
@@ -41,12 +61,84 @@ void error (const char *msg) {
 }
 
 void print_usage (const char *program_name) {
-    // Just setting this up to potentially take some options and flags later on
-    printf("%s%s%s", "Usage: ", program_name, " (file.gb / file.gbc) [-o] [-f]\n");
+    printf("%s%s%s", "Usage: ", program_name, " (file.gb / file.gbc) [options]\n");
+    printf("  --mode MODE       step, realtime (default) or turbo\n");
+    printf("  --frameskip N     Turbo: present one frame in N + 1 (default %d)\n", DEFAULT_TURBO_FRAME_SKIP);
+    printf("  --headless        Run without a window and dump the final CPU state\n");
+    printf("  --cycles N        Headless: stop after N T-cycles\n");
+    printf("  --frames N        Headless: stop after N frames (%d cycles each)\n", CYCLES_PER_FRAME);
+    printf("  --until-pc ADDR   Headless: stop when PC reaches ADDR\n");
+    printf("  --until-op OP     Headless: stop before executing opcode OP\n");
+    printf("  --serial-pass STR Headless: stop once the serial output contains STR, e.g. Passed\n");
+    printf("  --serial-fail STR Headless: stop and fail once the serial output contains STR, e.g. Failed\n");
+    printf("Keys: SPACE step, P pause/resume, TAB toggle turbo, F5 save state, F9 load state, hold BACKSPACE rewind, ESC quit\n");
     exit(EXIT_SUCCESS);
 }
 
-void render_screen (SDL_Window *window, SDL_Renderer *renderer) {
+run_mode parse_run_mode (const char *program_name, const char *str) {
+    if (strcmp(str, "step") == 0) return RUN_STEP;
+    if (strcmp(str, "realtime") == 0) return RUN_REALTIME;
+    if (strcmp(str, "turbo") == 0) return RUN_TURBO;
+
+    print_usage(program_name);
+    return RUN_STEP;
+}
+
+void parse_options (int argc, char *argv[], bool *headless, headless_opts *opts, run_mode *mode, int *frame_skip) {
+    for (int i = 2; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "--mode") == 0 && has_value) {
+            *mode = parse_run_mode(argv[0], argv[++i]);
+        } else if (strcmp(argv[i], "--frameskip") == 0 && has_value) {
+            *frame_skip = (int)(strtoul(argv[++i], NULL, 0) & 0xFF);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            *headless = true;
+        } else if (strcmp(argv[i], "--cycles") == 0 && has_value) {
+            opts->max_cycles = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            opts->max_frames = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--until-pc") == 0 && has_value) {
+            opts->until_pc = (int32_t)(strtoul(argv[++i], NULL, 16) & 0xFFFF);
+        } else if (strcmp(argv[i], "--until-op") == 0 && has_value) {
+            opts->until_op = (int16_t)(strtoul(argv[++i], NULL, 16) & 0xFF);
+        } else if (strcmp(argv[i], "--serial-pass") == 0 && has_value) {
+            opts->serial_pass = argv[++i];
+        } else if (strcmp(argv[i], "--serial-fail") == 0 && has_value) {
+            opts->serial_fail = argv[++i];
+        } else {
+            print_usage(argv[0]);
+        }
+    }
+}
+
+bool write_state_file (const char *path, const uint8_t *state, size_t size) {
+    FILE *file = fopen(path, "wb");
+    bool ok;
+
+    if (file == NULL)
+        return false;
+
+    ok = size > 0 && fwrite(state, 1, size, file) == size;
+
+    return fclose(file) == 0 && ok;
+}
+
+// Anything but exactly size bytes cannot be a state for this cartridge
+bool read_state_file (const char *path, uint8_t *state, size_t size) {
+    FILE *file = fopen(path, "rb");
+    bool ok;
+
+    if (file == NULL)
+        return false;
+
+    ok = fread(state, 1, size, file) == size && fgetc(file) == EOF;
+    fclose(file);
+
+    return ok;
+}
+
+void render_screen (SDL_Window *window, SDL_Renderer *renderer, SDL_Texture *lcd) {
     SDL_FRect screen = {
         SCREEN_X,
         SCREEN_Y,
@@ -86,124 +178,40 @@ void render_screen (SDL_Window *window, SDL_Renderer *renderer) {
     SDL_RenderFillRect(renderer, &h_line);
     SDL_RenderFillRect(renderer, &v_line);
 
-    SDL_RenderRect(renderer, &screen);
+    SDL_RenderTexture(renderer, lcd, NULL, &screen);
     SDL_RenderFillRect(renderer, &debug_window);
 }
 
-int render_text (SDL_Window *window, SDL_Renderer *renderer, TTF_Font *font, SDL_Color *color, SDL_FRect *d_rect, const char *str) {
-    SDL_Surface *surface;
-    SDL_Texture *texture;
-
-    surface = TTF_RenderText_Solid(font, str, strlen(str), *color);
-
-    if (surface) {
-        texture = SDL_CreateTextureFromSurface(renderer, surface);
-        SDL_DestroySurface(surface);
-    }
-
-    if (!texture) {
-        error("Error loading cpu state information\n");
-        exit(EXIT_FAILURE);
-    }
-
-    d_rect->w = texture->w;
-    d_rect->h = texture->h;
-
-    SDL_RenderTexture(renderer, texture, NULL, d_rect);
-
-    SDL_DestroyTexture(texture);
-}
-
-void render_cpu_state (sm83_ctx *cpu, uint8_t *memory, SDL_Window *window, SDL_Renderer *renderer, TTF_Font *font) {
-    SDL_Color color = { 255, 255, 255, SDL_ALPHA_OPAQUE };
-    SDL_FRect rect = {0};
-    char str[40] = {0};
-    int x = SCREEN_X + SCREEN_WIDTH + BORDER_WIDTH;
-    int y = SCREEN_Y + BORDER_WIDTH;
-
-    // Refactor this mess later
-
-    rect.x = x;
-    rect.y = y;
-
-    snprintf(str, 39, "PC: 0x%04X", cpu->pc);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "SP: 0x%04X", cpu->sp);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h * 2;
-    snprintf(str, 39, "OP: 0x%02X", memory[cpu->pc]);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "n8: %d", memory[cpu->pc + 1]);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "n16: %d (0x%04X)", bytes_to_u16(memory[cpu->pc + 1], memory[cpu->pc + 2]), bytes_to_u16(memory[cpu->pc + 1], memory[cpu->pc + 2]));
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h * 2;
-    snprintf(str, 39, "A: %d", cpu->rA);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "B: %d", cpu->rB);
-    render_text(window, renderer, font, &color, &rect, str);
-    
-    rect.y += rect.h;
-    snprintf(str, 39, "C: %d", cpu->rC);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "D: %d", cpu->rD);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "E: %d", cpu->rE);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "H: %d", cpu->rH);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "L: %d", cpu->rL);
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "AF: %d", bytes_to_u16(cpu->rF, cpu->rA));
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "BC: %d", bytes_to_u16(cpu->rC, cpu->rB));
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "DE: %d", bytes_to_u16(cpu->rE, cpu->rD));
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "HL: %d (0x%04X)", bytes_to_u16(cpu->rL, cpu->rH), bytes_to_u16(cpu->rL, cpu->rH));
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h * 2;
-    snprintf(str, 39, "Z: %d", get_bit_u8(&cpu->rF, ZERO_FLAG));
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "N: %d", get_bit_u8(&cpu->rF, SUBTRACTION_FLAG));
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "H: %d", get_bit_u8(&cpu->rF, HALF_CARRY_FLAG));
-    render_text(window, renderer, font, &color, &rect, str);
-
-    rect.y += rect.h;
-    snprintf(str, 39, "C: %d", get_bit_u8(&cpu->rF, CARRY_FLAG));
-    render_text(window, renderer, font, &color, &rect, str);
+void render_cpu_state (sm83_ctx *cpu, bus_ctx *bus, SDL_Renderer *renderer, debug_panel *panel) {
+    uint16_t n16 = bytes_to_u16(read_from_memory(bus, cpu->pc + 1), read_from_memory(bus, cpu->pc + 2));
+    uint16_t hl = bytes_to_u16(cpu->rL, cpu->rH);
+
+    // Skipped rows stay blank and separate the groups
+    debug_panel_printf(panel, 0, "PC: 0x%04X", cpu->pc);
+    debug_panel_printf(panel, 1, "SP: 0x%04X", cpu->sp);
+
+    debug_panel_printf(panel, 3, "OP: 0x%02X", read_from_memory(bus, cpu->pc));
+    debug_panel_printf(panel, 4, "n8: %d", read_from_memory(bus, cpu->pc + 1));
+    debug_panel_printf(panel, 5, "n16: %d (0x%04X)", n16, n16);
+
+    debug_panel_printf(panel, 7, "A: %d", cpu->rA);
+    debug_panel_printf(panel, 8, "B: %d", cpu->rB);
+    debug_panel_printf(panel, 9, "C: %d", cpu->rC);
+    debug_panel_printf(panel, 10, "D: %d", cpu->rD);
+    debug_panel_printf(panel, 11, "E: %d", cpu->rE);
+    debug_panel_printf(panel, 12, "H: %d", cpu->rH);
+    debug_panel_printf(panel, 13, "L: %d", cpu->rL);
+    debug_panel_printf(panel, 14, "AF: %d", bytes_to_u16(sm83_get_f(cpu), cpu->rA));
+    debug_panel_printf(panel, 15, "BC: %d", bytes_to_u16(cpu->rC, cpu->rB));
+    debug_panel_printf(panel, 16, "DE: %d", bytes_to_u16(cpu->rE, cpu->rD));
+    debug_panel_printf(panel, 17, "HL: %d (0x%04X)", hl, hl);
+
+    debug_panel_printf(panel, 19, "Z: %d", sm83_flag(cpu, ZERO_FLAG));
+    debug_panel_printf(panel, 20, "N: %d", sm83_flag(cpu, SUBTRACTION_FLAG));
+    debug_panel_printf(panel, 21, "H: %d", sm83_flag(cpu, HALF_CARRY_FLAG));
+    debug_panel_printf(panel, 22, "C: %d", sm83_flag(cpu, CARRY_FLAG));
+
+    debug_panel_render(panel, renderer);
 }
 
 int main (int argc, char *argv[]) {
@@ -212,12 +220,31 @@ int main (int argc, char *argv[]) {
     SDL_Event event;
     TTF_Font *font;
 
-    sm83_ctx cpu = {0};
-    cartridge_header cart_h = {0};
+    gb_machine *gb = NULL;
+    headless_opts opts = { 0, 0, -1, -1, NULL, NULL };
+    run_mode mode = RUN_REALTIME;
+    run_mode resume_mode = RUN_REALTIME;
+    Uint64 next_frame_ns = 0;
+    Uint64 panel_ns = 0;
+    uint64_t slices = 0;
+    int frame_skip = DEFAULT_TURBO_FRAME_SKIP;
+    bool headless = false;
+    bool redraw = true;
     uint8_t rom_type = 0;
-    uint8_t *memory = NULL;
-    size_t rom_size = 0;
-    FILE *file = NULL;
+    rom_image rom = {0};
+    char state_path[FILENAME_MAX];
+    uint8_t *state = NULL;
+    size_t state_size = 0;
+    rewind_ctx rw;
+    bool rewinding = false;
+    SDL_AudioSpec audio_spec = { SDL_AUDIO_S16, 2, APU_SAMPLE_RATE };
+    SDL_AudioStream *audio = NULL;
+    static int16_t samples[BLIP_MAX_SAMPLES * 2];
+    int audio_frames = 0;
+    debug_panel panel;
+    SDL_Texture *lcd = NULL;
+    int lcd_top = 0;
+    int lcd_lines = 0;
 
     if (argc == 1)
         print_usage(argv[0]);
@@ -225,17 +252,44 @@ int main (int argc, char *argv[]) {
     if ((rom_type = gb_rom_type(argv[1])) == 0)
         print_usage(argv[0]);
 
-    if ((file = fopen(argv[1], "rb")) == NULL)
-        error("Unable to open file provided\n");
+    parse_options(argc, argv, &headless, &opts, &mode, &frame_skip);
+
+    if (!rom_image_open(&rom, argv[1]))
+        error("Unable to load ROM\n");
+
+    if ((gb = machine_create(rom.data, rom.size)) == NULL) {
+        fprintf(stderr, "ROM is truncated or its cartridge type is unsupported\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // A state is a fixed size for a given cartridge, so one buffer serves every save and load
+    state_size = savestate_size(gb);
+
+    if ((state = malloc(state_size)) == NULL)
+        error("Unable to allocate the save state buffer\n");
+
+    snprintf(state_path, sizeof(state_path), "%s.state", argv[1]);
+
+    // Headless runs never touch SDL video or TTF
+    if (headless) {
+        headless_stop reason = run_headless(gb, &opts);
+
+        free(state);
+        machine_destroy(gb);
+        rom_image_close(&rom);
+
+        // Running out of time before the pass text showed up counts as a failure too
+        if (reason == STOP_CPU || reason == STOP_SERIAL_FAIL || (opts.serial_pass && reason != STOP_SERIAL_PASS))
+            return EXIT_FAILURE;
 
-    if (fseek(file, 0, SEEK_END) < 0 || (rom_size = ftell(file)) < 0)
-        error("Error occured getting ROM size\n");
+        return EXIT_SUCCESS;
+    }
 
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    if (!SDL_Init(SDL_INIT_VIDEO)) {
         error("Unable to initialize SDL\n");
     }
 
-    if (TTF_Init() < 0) {
+    if (!TTF_Init()) {
         error("Unable to initialize SDL_TTF\n");
     }
 
@@ -247,44 +301,171 @@ int main (int argc, char *argv[]) {
 
     font = TTF_OpenFont("./fonts/CourierPrime-Regular.ttf", 12);
 
-    memory = (uint8_t *)malloc(rom_size);
+    // Glyphs are rasterised once here, the font is not needed afterwards
+    if (font == NULL || !debug_panel_init(&panel, renderer, font, SCREEN_X + SCREEN_WIDTH + BORDER_WIDTH, SCREEN_Y + BORDER_WIDTH))
+        error("Unable to build the debugger glyph atlas\n");
+
+    TTF_CloseFont(font);
+
+    // One streaming texture for the LCD, uploaded once per finished frame and scaled up by the renderer
+    lcd = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, RESOLUTION_WIDTH, RESOLUTION_HEIGHT);
+
+    if (lcd == NULL)
+        error("Unable to create LCD texture\n");
+
+    SDL_SetTextureScaleMode(lcd, SDL_SCALEMODE_NEAREST);
+
+    // Sound is optional, the emulator carries on silently without a playback device
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO))
+        audio = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &audio_spec, NULL, NULL);
 
-    rewind(file);
-    fread(memory, 1, rom_size, file);
+    if (audio == NULL)
+        fprintf(stderr, "Unable to open audio: %s\n", SDL_GetError());
+    else
+        SDL_ResumeAudioStreamDevice(audio);
 
-    store_c_header_data(memory, &cart_h);
+    if (!rewind_init(&rw, gb, REWIND_BUFFER_BYTES, REWIND_MAX_FRAMES))
+        error("Unable to allocate the rewind buffer\n");
 
-    cpu.sp = 0xFFFE;
-    cpu.is_running = true;
+    SDL_UpdateTexture(lcd, NULL, gb->ppu.front, RESOLUTION_WIDTH * sizeof(uint32_t));
+    ppu_take_dirty_lines(&gb->ppu, &lcd_top, &lcd_lines);
+
+    if (mode != RUN_STEP)
+        resume_mode = mode;
+
+    next_frame_ns = SDL_GetTicksNS();
 
     // Main Loop
-    while (cpu.is_running) {
-        while(SDL_PollEvent(&event)) {
+    while (gb->cpu.is_running) {
+        // While single stepping nothing changes until an event arrives, so block instead of spinning
+        if (mode == RUN_STEP && !redraw)
+            SDL_WaitEvent(NULL);
+
+        while (SDL_PollEvent(&event)) {
             switch (event.type) {
                 case SDL_EVENT_QUIT:
-                    cpu.is_running = false;
+                    gb->cpu.is_running = false;
+                    break;
+                case SDL_EVENT_WINDOW_EXPOSED:
+                    redraw = true;
                     break;
                 case SDL_EVENT_KEY_DOWN:
                     switch (event.key.scancode) {
                         case SDL_SCANCODE_ESCAPE:
-                            cpu.is_running = false;
+                            gb->cpu.is_running = false;
                             break;
                         case SDL_SCANCODE_SPACE:
-                            next_instruction(&cpu, memory);
+                            if (mode == RUN_STEP) {
+                                machine_step(gb);
+                                redraw = true;
+                            }
+                            break;
+                        case SDL_SCANCODE_P:
+                            mode = mode == RUN_STEP ? resume_mode : RUN_STEP;
+                            next_frame_ns = SDL_GetTicksNS();
+                            redraw = true;
+                            break;
+                        case SDL_SCANCODE_F5:
+                            if (!write_state_file(state_path, state, savestate_save(gb, state, state_size)))
+                                fprintf(stderr, "Unable to write %s\n", state_path);
+                            break;
+                        case SDL_SCANCODE_F9:
+                            if (!read_state_file(state_path, state, state_size) || !savestate_load(gb, state, state_size))
+                                fprintf(stderr, "Unable to load %s\n", state_path);
+
+                            next_frame_ns = SDL_GetTicksNS();
+                            redraw = true;
+                            break;
+                        case SDL_SCANCODE_BACKSPACE:
+                            rewinding = true;
+                            break;
+                        case SDL_SCANCODE_TAB:
+                            if (mode != RUN_STEP) {
+                                mode = resume_mode = mode == RUN_TURBO ? RUN_REALTIME : RUN_TURBO;
+                                next_frame_ns = SDL_GetTicksNS();
+                            }
+                            break;
+                        default:
                             break;
                     }
                     break;
+                case SDL_EVENT_KEY_UP:
+                    if (event.key.scancode == SDL_SCANCODE_BACKSPACE)
+                        rewinding = false;
+                    break;
+            }
+        }
+
+        // Run one frame's worth of cycles per slice between event drains
+        if (mode != RUN_STEP) {
+            // Rewinding goes back two slices and runs one, so every frame on screen is still emulated and drawn
+            if (rewinding)
+                rewind_step_back(&rw, gb, 2);
+
+            machine_run(gb, CYCLES_PER_FRAME);
+            rewind_push(&rw, gb);
+            slices++;
+
+            // One push per slice, turbo and a backed up device drop the audio instead
+            apu_end_frame(&gb->apu);
+            audio_frames = apu_read_samples(&gb->apu, samples, BLIP_MAX_SAMPLES);
+
+            if (audio && mode == RUN_REALTIME && !rewinding) {
+                int queued = SDL_GetAudioStreamQueued(audio);
+
+                // Negative means the stream failed, nothing is queued behind it then
+                if (queued >= 0 && (size_t)queued < MAX_AUDIO_QUEUE_BYTES)
+                    SDL_PutAudioStreamData(audio, samples, audio_frames * 2 * sizeof(int16_t));
+            }
+        }
+
+        // Turbo only looks at the LCD once every frame_skip + 1 slices
+        if (redraw || (mode != RUN_STEP && (mode != RUN_TURBO || slices % (frame_skip + 1) == 0))) {
+            ppu_sync(&gb->ppu);
+
+            // Only lines that changed since the last upload are sent, an unchanged frame needs no present at all
+            if (ppu_take_dirty_lines(&gb->ppu, &lcd_top, &lcd_lines)) {
+                SDL_Rect rect = { 0, lcd_top, RESOLUTION_WIDTH, lcd_lines };
+
+                SDL_UpdateTexture(lcd, &rect, gb->ppu.front + lcd_top * RESOLUTION_WIDTH, RESOLUTION_WIDTH * sizeof(uint32_t));
+                redraw = true;
             }
+
+            // The register panel changes every instruction, while running it is refreshed at a capped rate
+            if (mode != RUN_STEP && SDL_GetTicksNS() - panel_ns >= PANEL_INTERVAL_NS)
+                redraw = true;
+        }
+
+        if (redraw) {
+            render_screen(window, renderer, lcd);
+            render_cpu_state(&gb->cpu, &gb->bus, renderer, &panel);
+
+            SDL_RenderPresent(renderer);
+            panel_ns = SDL_GetTicksNS();
+            redraw = false;
         }
 
-        render_screen(window, renderer);
-        render_cpu_state(&cpu, memory, window, renderer, font);
+        if (mode == RUN_REALTIME) {
+            Uint64 now = SDL_GetTicksNS();
+
+            next_frame_ns += FRAME_TIME_NS;
 
-        SDL_RenderPresent(renderer);
+            // Resynchronise rather than trying to catch up after a long stall
+            if (now > next_frame_ns + FRAME_TIME_NS * MAX_FRAME_LAG)
+                next_frame_ns = now;
+            else if (next_frame_ns > now)
+                SDL_DelayNS(next_frame_ns - now);
+        }
     }
 
-    free(memory);
+    free(state);
+    machine_destroy(gb);
+    rom_image_close(&rom);
 
+    rewind_free(&rw);
+    debug_panel_free(&panel);
+    SDL_DestroyAudioStream(audio);
+    SDL_DestroyTexture(lcd);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
 
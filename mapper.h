@@ -0,0 +1,263 @@
+#pragma once
+
+#include "common.h"
+#include "bus.h"
+#include "cartridge_header.h"
+
+#define EXT_RAM_SIZE 0x2000
+#define ROM_BANK_PAGES (ROM_BANK_SIZE / BUS_PAGE_SIZE)
+#define EXT_RAM_PAGES (EXT_RAM_SIZE / BUS_PAGE_SIZE)
+#define RTC_REGISTER_COUNT 5
+#define RTC_SELECT_FIRST 0x08
+
+typedef enum {
+	MAPPER_NONE,
+	MAPPER_MBC1,
+	MAPPER_MBC3,
+	MAPPER_MBC5
+} mapper_kind;
+
+typedef struct {
+	mapper_kind kind;
+	bus_ctx *bus;
+
+	const uint8_t *rom;
+	uint16_t rom_banks;
+	uint8_t *ram;
+	size_t ram_size;
+	uint8_t ram_banks;
+	bool has_battery;
+	bool has_rtc;
+
+	// Bank registers as written, the effective banks are worked out on remap
+	bool ram_enabled;
+	uint16_t rom_bank;
+	uint8_t ram_bank; // MBC1 upper bits, MBC3 RAM bank or RTC select, MBC5 RAM bank
+	uint8_t banking_mode; // MBC1 only
+
+	// MBC3 clock: S, M, H, DL, DH. The registers are stored and latched but the clock does not tick
+	uint8_t rtc[RTC_REGISTER_COUNT];
+	uint8_t rtc_latched[RTC_REGISTER_COUNT];
+	uint8_t rtc_latch;
+} mapper_ctx;
+
+static inline const char *mapper_name (mapper_kind kind) {
+	switch (kind) {
+	case MAPPER_MBC1: return "MBC1";
+	case MAPPER_MBC3: return "MBC3";
+	case MAPPER_MBC5: return "MBC5";
+	default: return "none";
+	}
+}
+
+static inline size_t mapper_ram_size (uint8_t ram_size_c) {
+	switch (ram_size_c) {
+	case 0x01: return 0x800;
+	case 0x02: return 0x2000;
+	case 0x03: return 0x8000;
+	case 0x04: return 0x20000;
+	case 0x05: return 0x10000;
+	default: return 0;
+	}
+}
+
+// Bank switches only repoint the 0x4000 - 0x7FFF (and MBC1 mode 1 0x0000 - 0x3FFF) pages
+static inline void mapper_map_rom (mapper_ctx *mapper) {
+	uint16_t bank0 = 0;
+	uint16_t bankx = mapper->rom_bank;
+
+	switch (mapper->kind) {
+	case MAPPER_MBC1:
+		bankx = mapper->rom_bank & 0x1F;
+		bankx = ((mapper->ram_bank & 0x03) << 5) | (bankx ? bankx : 1);
+
+		if (mapper->banking_mode)
+			bank0 = (mapper->ram_bank & 0x03) << 5;
+		break;
+	case MAPPER_MBC3:
+		bankx = mapper->rom_bank & 0x7F;
+		bankx = bankx ? bankx : 1;
+		break;
+	case MAPPER_MBC5:
+		bankx = mapper->rom_bank & 0x1FF;
+		break;
+	default:
+		return;
+	}
+
+	bus_map_memory(mapper->bus, 0x00, ROM_BANK_PAGES, mapper->rom + (bank0 % mapper->rom_banks) * ROM_BANK_SIZE, false);
+	bus_map_memory(mapper->bus, 0x40, ROM_BANK_PAGES, mapper->rom + (bankx % mapper->rom_banks) * ROM_BANK_SIZE, false);
+}
+
+// Disabled RAM and the MBC3 clock registers stay unmapped so they land on the mapper's slow handlers
+static inline void mapper_map_ram (mapper_ctx *mapper) {
+	uint8_t bank = mapper->ram_bank;
+	uint16_t pages = 0;
+
+	if (mapper->kind == MAPPER_MBC1)
+		bank = mapper->banking_mode ? mapper->ram_bank & 0x03 : 0;
+
+	bus_map_memory(mapper->bus, EXT_RAM_ADDR >> 8, EXT_RAM_PAGES, NULL, false);
+
+	if (!mapper->ram_enabled || mapper->ram == NULL)
+		return;
+
+	if (mapper->kind == MAPPER_MBC3 && bank >= RTC_SELECT_FIRST)
+		return;
+
+	pages = (mapper->ram_size < EXT_RAM_SIZE ? mapper->ram_size : EXT_RAM_SIZE) / BUS_PAGE_SIZE;
+
+	bus_map_memory(mapper->bus, EXT_RAM_ADDR >> 8, pages, mapper->ram + (bank % mapper->ram_banks) * EXT_RAM_SIZE, true);
+}
+
+// 0x0000 - 0x7FFF: bank control registers
+static inline void mapper_write_rom (void *ctx, uint16_t addr, uint8_t data) {
+	mapper_ctx *mapper = ctx;
+
+	switch (addr >> 13) {
+	case 0: // 0x0000 - 0x1FFF
+		mapper->ram_enabled = (data & 0x0F) == 0x0A;
+		mapper_map_ram(mapper);
+		break;
+	case 1: // 0x2000 - 0x3FFF
+		if (mapper->kind == MAPPER_MBC5)
+			mapper->rom_bank = addr < 0x3000 ? (mapper->rom_bank & 0x100) | data : (mapper->rom_bank & 0xFF) | ((data & 1) << 8);
+		else
+			mapper->rom_bank = data;
+
+		mapper_map_rom(mapper);
+		break;
+	case 2: // 0x4000 - 0x5FFF
+		mapper->ram_bank = data;
+
+		if (mapper->kind == MAPPER_MBC1)
+			mapper_map_rom(mapper);
+
+		mapper_map_ram(mapper);
+		break;
+	case 3: // 0x6000 - 0x7FFF
+		if (mapper->kind == MAPPER_MBC1) {
+			mapper->banking_mode = data & 1;
+			mapper_map_rom(mapper);
+			mapper_map_ram(mapper);
+		} else if (mapper->kind == MAPPER_MBC3) {
+			if (mapper->rtc_latch == 0x00 && data == 0x01)
+				memcpy(mapper->rtc_latched, mapper->rtc, RTC_REGISTER_COUNT);
+
+			mapper->rtc_latch = data;
+		}
+		break;
+	}
+}
+
+// 0xA000 - 0xBFFF when not directly mapped
+static inline uint8_t mapper_read_ram (void *ctx, uint16_t addr) {
+	mapper_ctx *mapper = ctx;
+	uint8_t reg = mapper->ram_bank - RTC_SELECT_FIRST;
+
+	if (mapper->kind == MAPPER_MBC3 && mapper->ram_enabled && reg < RTC_REGISTER_COUNT)
+		return mapper->rtc_latched[reg];
+
+	return 0xFF;
+}
+
+static inline void mapper_write_ram (void *ctx, uint16_t addr, uint8_t data) {
+	mapper_ctx *mapper = ctx;
+	uint8_t reg = mapper->ram_bank - RTC_SELECT_FIRST;
+
+	if (mapper->kind == MAPPER_MBC3 && mapper->ram_enabled && reg < RTC_REGISTER_COUNT) {
+		mapper->rtc[reg] = data;
+		mapper->rtc_latched[reg] = data;
+	}
+}
+
+// Picks the mapper from the cartridge type and claims the ROM and external RAM pages, false when unsupported
+static inline bool mapper_init (mapper_ctx *mapper, bus_ctx *bus, cartridge_header *cart_h, const uint8_t *rom, size_t rom_size) {
+	memset(mapper, 0, sizeof(*mapper));
+
+	mapper->bus = bus;
+	mapper->rom = rom;
+	mapper->rom_banks = rom_size / ROM_BANK_SIZE;
+	mapper->rom_bank = 1;
+
+	switch (cart_h->cartridge_t) {
+	case 0x00: // ROM ONLY
+	case 0x08: // ROM+RAM
+		mapper->kind = MAPPER_NONE;
+		break;
+	case 0x09: // ROM+RAM+BATTERY
+		mapper->kind = MAPPER_NONE;
+		mapper->has_battery = true;
+		break;
+	case 0x01: // MBC1
+	case 0x02: // MBC1+RAM
+		mapper->kind = MAPPER_MBC1;
+		break;
+	case 0x03: // MBC1+RAM+BATTERY
+		mapper->kind = MAPPER_MBC1;
+		mapper->has_battery = true;
+		break;
+	case 0x0F: // MBC3+TIMER+BATTERY
+	case 0x10: // MBC3+TIMER+RAM+BATTERY
+		mapper->kind = MAPPER_MBC3;
+		mapper->has_battery = true;
+		mapper->has_rtc = true;
+		break;
+	case 0x11: // MBC3
+	case 0x12: // MBC3+RAM
+		mapper->kind = MAPPER_MBC3;
+		break;
+	case 0x13: // MBC3+RAM+BATTERY
+		mapper->kind = MAPPER_MBC3;
+		mapper->has_battery = true;
+		break;
+	case 0x19: // MBC5
+	case 0x1A: // MBC5+RAM
+	case 0x1C: // MBC5+RUMBLE
+	case 0x1D: // MBC5+RUMBLE+RAM
+		mapper->kind = MAPPER_MBC5;
+		break;
+	case 0x1B: // MBC5+RAM+BATTERY
+	case 0x1E: // MBC5+RUMBLE+RAM+BATTERY
+		mapper->kind = MAPPER_MBC5;
+		mapper->has_battery = true;
+		break;
+	default:
+		return false;
+	}
+
+	if (mapper->kind != MAPPER_NONE && mapper->rom_banks < 2)
+		return false;
+
+	if ((mapper->ram_size = mapper_ram_size(cart_h->ram_size_c)) > 0) {
+		if ((mapper->ram = calloc(mapper->ram_size, 1)) == NULL)
+			return false;
+
+		mapper->ram_banks = mapper->ram_size > EXT_RAM_SIZE ? mapper->ram_size / EXT_RAM_SIZE : 1;
+	}
+
+	bus->eram = mapper->ram;
+	bus->eram_size = mapper->ram_size;
+
+	bus_map_handler(bus, EXT_RAM_ADDR >> 8, EXT_RAM_PAGES, mapper_read_ram, mapper_write_ram, mapper);
+
+	// Without an MBC the RAM is always on and ROM writes keep going to the bus's ignore handler
+	if (mapper->kind == MAPPER_NONE) {
+		mapper->ram_enabled = true;
+	} else {
+		bus_map_handler(bus, 0x00, 2 * ROM_BANK_PAGES, NULL, mapper_write_rom, mapper);
+		mapper_map_rom(mapper);
+	}
+
+	mapper_map_ram(mapper);
+
+	return true;
+}
+
+static inline void mapper_free (mapper_ctx *mapper) {
+	free(mapper->ram);
+
+	mapper->ram = NULL;
+	mapper->bus->eram = NULL;
+	mapper->bus->eram_size = 0;
+}
\ No newline at end of file
@@ -0,0 +1,480 @@
+#pragma once
+
+#include "common.h"
+#include "bus.h"
+#include "scheduler.h"
+#include "tile_decode.h"
+
+#define LCD_WIDTH 160
+#define LCD_HEIGHT 144
+
+#define PPU_LINE_CYCLES 456
+#define PPU_LINES 154
+#define PPU_OAM_SCAN_END 80
+#define PPU_DRAW_END (PPU_OAM_SCAN_END + 172)
+#define PPU_MAX_LINE_SPRITES 10
+#define PPU_LINE_TILES 21
+
+#define LCDC_ADDR 0xFF40
+#define STAT_ADDR 0xFF41
+#define SCY_ADDR 0xFF42
+#define SCX_ADDR 0xFF43
+#define LY_ADDR 0xFF44
+#define LYC_ADDR 0xFF45
+#define BGP_ADDR 0xFF47
+#define OBP0_ADDR 0xFF48
+#define OBP1_ADDR 0xFF49
+#define WY_ADDR 0xFF4A
+#define WX_ADDR 0xFF4B
+
+#define LCDC_BG_ENABLE 0x01
+#define LCDC_OBJ_ENABLE 0x02
+#define LCDC_OBJ_TALL 0x04
+#define LCDC_BG_MAP 0x08
+#define LCDC_TILE_DATA 0x10
+#define LCDC_WINDOW_ENABLE 0x20
+#define LCDC_WINDOW_MAP 0x40
+#define LCDC_ENABLE 0x80
+
+#define PPU_MODE_HBLANK 0
+#define PPU_MODE_VBLANK 1
+#define PPU_MODE_OAM 2
+#define PPU_MODE_DRAW 3
+
+#define STAT_LYC_MATCH 0x04
+#define STAT_HBLANK_IRQ 0x08
+#define STAT_VBLANK_IRQ 0x10
+#define STAT_OAM_IRQ 0x20
+#define STAT_LYC_IRQ 0x40
+
+// Packed ARGB8888, matches SDL_PIXELFORMAT_ARGB8888
+static const uint32_t ppu_dmg_palette[4] = { 0xFFE0F8D0, 0xFF88C070, 0xFF346856, 0xFF081820 };
+
+typedef struct {
+	bus_ctx *bus;
+	scheduler_ctx *sched;
+	const uint64_t *clock; // CPU cycle counter the PPU catches up to
+
+	// Lines are drawn into back, front always holds the last complete frame
+	uint32_t buffers[2][LCD_WIDTH * LCD_HEIGHT];
+	uint32_t *back;
+	uint32_t *front;
+
+	// Hash of every line as last drawn. Lines whose hash changes widen the dirty range, which the
+	// frontend takes when it uploads, so an unchanged frame costs no upload or present
+	uint64_t line_hash[LCD_HEIGHT];
+	int pending_top;
+	int pending_bottom;
+	int dirty_top;
+	int dirty_bottom;
+
+	uint64_t cycles;
+	uint64_t frame_count;
+	uint16_t dot;
+	uint8_t ly;
+	uint8_t mode;
+	uint8_t window_line;
+	bool stat_line; // STAT interrupt fires on a rising edge of the OR of its enabled sources
+
+	// Called as each visible line enters mode 0, with the PPU already caught up to that dot
+	void (*hblank) (void *ctx);
+	void *hblank_ctx;
+} ppu_ctx;
+
+// Tile cache index for a BG/window map entry, 0x8800 addressing covers tiles 128 - 383
+static inline uint16_t ppu_bg_tile (uint8_t lcdc, uint8_t tile) {
+	if (lcdc & LCDC_TILE_DATA)
+		return tile;
+
+	return 256 + (int8_t)tile;
+}
+
+// The four colours a BGP/OBP register selects
+static inline void ppu_resolve_palette (uint8_t reg, uint32_t *out) {
+	for (int i = 0; i < 4; i++)
+		out[i] = ppu_dmg_palette[(reg >> (i * 2)) & 3];
+}
+
+// Colour indices for one row of a cached tile, the tile is decoded again only if a VRAM write dirtied it
+static inline const uint8_t *ppu_tile_row (bus_ctx *bus, uint16_t tile, uint8_t row) {
+	uint64_t bit = 1ULL << (tile % 64);
+
+	if (bus->tile_dirty[tile / 64] & bit) {
+		const uint8_t *data = bus->vram + (tile / TILES_PER_BANK) * VRAM_SIZE + (tile % TILES_PER_BANK) * 16;
+
+		for (int y = 0; y < 8; y++)
+			tile_decode_indices(data[y * 2], data[y * 2 + 1], bus->tile_pixels[tile] + y * 8);
+
+		bus->tile_dirty[tile / 64] &= ~bit;
+	}
+
+	return bus->tile_pixels[tile] + row * 8;
+}
+
+// Copies the cached rows under one line of a tile map into a run of colour indices
+static inline void ppu_fetch_map_row (bus_ctx *bus, uint8_t lcdc, uint16_t map, uint8_t tile_x, uint8_t row, int tiles, uint8_t *out) {
+	for (int i = 0; i < tiles; i++)
+		memcpy(out + i * 8, ppu_tile_row(bus, ppu_bg_tile(lcdc, bus->vram[map + ((tile_x + i) & 31)]), row), 8);
+}
+
+static inline uint64_t ppu_line_hash (const uint32_t *line) {
+	uint64_t hash = FNV1A_64_INIT;
+
+	// FNV-1a over two pixels at a time, the full byte-wise version is overkill for change detection
+	for (int x = 0; x < LCD_WIDTH; x += 2) {
+		uint64_t pair;
+
+		memcpy(&pair, line + x, sizeof(pair));
+		hash = (hash ^ pair) * 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+static inline void ppu_mark_line (ppu_ctx *ppu) {
+	uint64_t hash = ppu_line_hash(ppu->back + ppu->ly * LCD_WIDTH);
+
+	if (hash == ppu->line_hash[ppu->ly])
+		return;
+
+	ppu->line_hash[ppu->ly] = hash;
+
+	if (ppu->ly < ppu->pending_top)
+		ppu->pending_top = ppu->ly;
+
+	ppu->pending_bottom = ppu->ly;
+}
+
+static inline void ppu_render_line (ppu_ctx *ppu) {
+	bus_ctx *bus = ppu->bus;
+	uint8_t lcdc = bus->io[LCDC_ADDR - IO_ADDR];
+	uint8_t wy = bus->io[WY_ADDR - IO_ADDR];
+	int wx = bus->io[WX_ADDR - IO_ADDR] - 7;
+	uint32_t *out = ppu->back + ppu->ly * LCD_WIDTH;
+	uint32_t palette[4];
+	uint8_t indices[PPU_LINE_TILES * 8] = {0};
+	uint8_t window[PPU_LINE_TILES * 8];
+	uint8_t *line = indices;
+
+	// BG and window are assembled as colour indices from the tile cache, then resolved in one pass
+	if (lcdc & LCDC_BG_ENABLE) {
+		uint8_t scy = bus->io[SCY_ADDR - IO_ADDR];
+		uint8_t scx = bus->io[SCX_ADDR - IO_ADDR];
+		uint8_t y = scy + ppu->ly;
+
+		// 21 tiles cover a line scrolled mid-tile
+		ppu_fetch_map_row(bus, lcdc, (lcdc & LCDC_BG_MAP ? 0x1C00 : 0x1800) + (y / 8) * 32, scx / 8, y & 7, PPU_LINE_TILES, indices);
+		line = indices + (scx & 7);
+
+		// The window shares the BG enable bit on DMG and keeps its own line counter
+		if ((lcdc & LCDC_WINDOW_ENABLE) && ppu->ly >= wy && wx < LCD_WIDTH) {
+			int start = wx < 0 ? 0 : wx;
+
+			ppu_fetch_map_row(bus, lcdc, (lcdc & LCDC_WINDOW_MAP ? 0x1C00 : 0x1800) + (ppu->window_line / 8) * 32, 0, ppu->window_line & 7, (LCD_WIDTH - wx + 7) / 8, window);
+			memcpy(line + start, window + (start - wx), LCD_WIDTH - start);
+
+			ppu->window_line++;
+		}
+
+		ppu_resolve_palette(bus->io[BGP_ADDR - IO_ADDR], palette);
+		tile_resolve_line(line, LCD_WIDTH, palette, out);
+	} else {
+		for (int x = 0; x < LCD_WIDTH; x++)
+			out[x] = ppu_dmg_palette[0];
+	}
+
+	if (lcdc & LCDC_OBJ_ENABLE) {
+		uint8_t height = lcdc & LCDC_OBJ_TALL ? 16 : 8;
+		uint8_t sprites[PPU_MAX_LINE_SPRITES];
+		uint32_t obj_palettes[2][4];
+		int count = 0;
+
+		ppu_resolve_palette(bus->io[OBP0_ADDR - IO_ADDR], obj_palettes[0]);
+		ppu_resolve_palette(bus->io[OBP1_ADDR - IO_ADDR], obj_palettes[1]);
+
+		// OAM scan keeps the first ten sprites on the line
+		for (int i = 0; i < OAM_SIZE / 4 && count < PPU_MAX_LINE_SPRITES; i++) {
+			int top = bus->oam[i * 4] - 16;
+
+			if (ppu->ly >= top && ppu->ly < top + height)
+				sprites[count++] = i;
+		}
+
+		// Lower X wins, ties go to the earlier OAM entry. Drawing the winners last lets them overwrite
+		for (int i = 1; i < count; i++) {
+			uint8_t sprite = sprites[i];
+			int j = i - 1;
+
+			while (j >= 0 && bus->oam[sprites[j] * 4 + 1] > bus->oam[sprite * 4 + 1]) {
+				sprites[j + 1] = sprites[j];
+				j--;
+			}
+
+			sprites[j + 1] = sprite;
+		}
+
+		for (int i = count - 1; i >= 0; i--) {
+			const uint8_t *obj = bus->oam + sprites[i] * 4;
+			uint8_t attr = obj[3];
+			const uint32_t *obj_palette = obj_palettes[(attr >> 4) & 1];
+			uint8_t tile = height == 16 ? obj[2] & 0xFE : obj[2];
+			const uint8_t *pixels;
+			uint8_t row = ppu->ly - (obj[0] - 16);
+			int left = obj[1] - 8;
+
+			if (attr & 0x40)
+				row = height - 1 - row;
+
+			pixels = ppu_tile_row(bus, tile + (row >> 3), row & 7);
+
+			for (int p = 0; p < 8; p++) {
+				int x = left + (attr & 0x20 ? 7 - p : p);
+
+				if (x < 0 || x >= LCD_WIDTH || pixels[p] == 0)
+					continue;
+
+				if ((attr & 0x80) && line[x])
+					continue;
+
+				out[x] = obj_palette[pixels[p]];
+			}
+		}
+	}
+}
+
+static inline void ppu_update_stat (ppu_ctx *ppu) {
+	uint8_t stat = ppu->bus->io[STAT_ADDR - IO_ADDR];
+	bool line = false;
+
+	if (ppu->bus->io[LCDC_ADDR - IO_ADDR] & LCDC_ENABLE) {
+		line = ((stat & STAT_LYC_IRQ) && ppu->ly == ppu->bus->io[LYC_ADDR - IO_ADDR]) ||
+			((stat & STAT_HBLANK_IRQ) && ppu->mode == PPU_MODE_HBLANK) ||
+			((stat & STAT_VBLANK_IRQ) && ppu->mode == PPU_MODE_VBLANK) ||
+			((stat & STAT_OAM_IRQ) && ppu->mode == PPU_MODE_OAM);
+	}
+
+	if (line && !ppu->stat_line)
+		bus_request_interrupt(ppu->bus, INTERRUPT_STAT);
+
+	ppu->stat_line = line;
+}
+
+static inline void ppu_enter_line (ppu_ctx *ppu) {
+	if (ppu->ly == LCD_HEIGHT) {
+		uint32_t *done = ppu->back;
+
+		ppu->back = ppu->front;
+		ppu->front = done;
+		ppu->frame_count++;
+
+		if (ppu->pending_top < ppu->dirty_top)
+			ppu->dirty_top = ppu->pending_top;
+
+		if (ppu->pending_bottom > ppu->dirty_bottom)
+			ppu->dirty_bottom = ppu->pending_bottom;
+
+		ppu->pending_top = LCD_HEIGHT;
+		ppu->pending_bottom = -1;
+		ppu->mode = PPU_MODE_VBLANK;
+		bus_request_interrupt(ppu->bus, INTERRUPT_VBLANK);
+	} else if (ppu->ly < LCD_HEIGHT) {
+		ppu->mode = PPU_MODE_OAM;
+	}
+}
+
+// Dot of the next mode change or LY increment on the current line
+static inline uint16_t ppu_next_boundary (ppu_ctx *ppu) {
+	if (ppu->ly < LCD_HEIGHT && ppu->dot < PPU_OAM_SCAN_END)
+		return PPU_OAM_SCAN_END;
+
+	if (ppu->ly < LCD_HEIGHT && ppu->dot < PPU_DRAW_END)
+		return PPU_DRAW_END;
+
+	return PPU_LINE_CYCLES;
+}
+
+// Catch-up: runs the PPU forward to the CPU's cycle count, drawing every line it passes
+static inline void ppu_sync (ppu_ctx *ppu) {
+	uint64_t now = *ppu->clock;
+
+	if (!(ppu->bus->io[LCDC_ADDR - IO_ADDR] & LCDC_ENABLE)) {
+		ppu->cycles = now;
+		return;
+	}
+
+	while (ppu->cycles < now) {
+		uint16_t next = ppu_next_boundary(ppu);
+
+		if (ppu->cycles + (next - ppu->dot) > now) {
+			ppu->dot += now - ppu->cycles;
+			ppu->cycles = now;
+			break;
+		}
+
+		ppu->cycles += next - ppu->dot;
+		ppu->dot = next;
+
+		if (next == PPU_OAM_SCAN_END) {
+			ppu->mode = PPU_MODE_DRAW;
+		} else if (next == PPU_DRAW_END) {
+			ppu_render_line(ppu);
+			ppu_mark_line(ppu);
+			ppu->mode = PPU_MODE_HBLANK;
+
+			if (ppu->hblank)
+				ppu->hblank(ppu->hblank_ctx);
+		} else {
+			ppu->dot = 0;
+			ppu->ly = (ppu->ly + 1) % PPU_LINES;
+
+			if (ppu->ly == 0)
+				ppu->window_line = 0;
+
+			ppu_enter_line(ppu);
+		}
+
+		ppu_update_stat(ppu);
+	}
+}
+
+// Queues the next mode transition, nothing is queued while the LCD is off
+static inline void ppu_schedule (ppu_ctx *ppu) {
+	if (ppu->bus->io[LCDC_ADDR - IO_ADDR] & LCDC_ENABLE)
+		scheduler_schedule(ppu->sched, SCHED_PPU, ppu->cycles + (ppu_next_boundary(ppu) - ppu->dot));
+	else
+		scheduler_cancel(ppu->sched, SCHED_PPU);
+}
+
+// Mode transitions happen on time so VBlank and STAT changes are seen without a register access
+static inline void ppu_event (void *ctx, uint64_t when) {
+	ppu_ctx *ppu = ctx;
+
+	ppu_sync(ppu);
+	ppu_schedule(ppu);
+}
+
+// Lines of the front buffer that changed since the last call, false when there is nothing to upload
+static inline bool ppu_take_dirty_lines (ppu_ctx *ppu, int *top, int *count) {
+	if (ppu->dirty_top > ppu->dirty_bottom)
+		return false;
+
+	*top = ppu->dirty_top;
+	*count = ppu->dirty_bottom - ppu->dirty_top + 1;
+
+	ppu->dirty_top = LCD_HEIGHT;
+	ppu->dirty_bottom = -1;
+
+	return true;
+}
+
+static inline uint8_t ppu_read_ly (void *ctx, uint16_t addr) {
+	ppu_ctx *ppu = ctx;
+
+	ppu_sync(ppu);
+	return ppu->ly;
+}
+
+static inline uint8_t ppu_read_stat (void *ctx, uint16_t addr) {
+	ppu_ctx *ppu = ctx;
+	uint8_t stat = ppu->bus->io[STAT_ADDR - IO_ADDR] & 0x78;
+
+	ppu_sync(ppu);
+
+	if (ppu->ly == ppu->bus->io[LYC_ADDR - IO_ADDR])
+		stat |= STAT_LYC_MATCH;
+
+	return 0x80 | stat | ppu->mode;
+}
+
+static inline void ppu_write_stat (void *ctx, uint16_t addr, uint8_t data) {
+	ppu_ctx *ppu = ctx;
+
+	ppu_sync(ppu);
+	ppu->bus->io[STAT_ADDR - IO_ADDR] = data & 0x78;
+	ppu_update_stat(ppu);
+}
+
+static inline void ppu_write_ly (void *ctx, uint16_t addr, uint8_t data) {
+}
+
+static inline void ppu_write_lcdc (void *ctx, uint16_t addr, uint8_t data) {
+	ppu_ctx *ppu = ctx;
+	uint8_t old = ppu->bus->io[LCDC_ADDR - IO_ADDR];
+
+	ppu_sync(ppu);
+	ppu->bus->io[LCDC_ADDR - IO_ADDR] = data;
+
+	// Switching the LCD off parks it at the top of the frame, switching it on starts a new one
+	if ((old ^ data) & LCDC_ENABLE) {
+		ppu->dot = 0;
+		ppu->ly = 0;
+		ppu->window_line = 0;
+		ppu->mode = data & LCDC_ENABLE ? PPU_MODE_OAM : PPU_MODE_HBLANK;
+		ppu_update_stat(ppu);
+		ppu_schedule(ppu);
+	}
+}
+
+// VRAM and OAM writes catch the PPU up first, so lines already scanned out keep the old data
+static inline void ppu_write_vram (void *ctx, uint16_t addr, uint8_t data) {
+	ppu_ctx *ppu = ctx;
+
+	ppu_sync(ppu);
+	bus_write_vram(ppu->bus, addr, data);
+}
+
+static inline void ppu_write_oam (void *ctx, uint16_t addr, uint8_t data) {
+	ppu_ctx *ppu = ctx;
+
+	ppu_sync(ppu);
+	bus_write_oam(ppu->bus, addr, data);
+}
+
+// Registers that only change how later lines look, the lines before the write are drawn first
+static inline void ppu_write_reg (void *ctx, uint16_t addr, uint8_t data) {
+	ppu_ctx *ppu = ctx;
+
+	ppu_sync(ppu);
+	ppu->bus->io[addr - IO_ADDR] = data;
+
+	if (addr == LYC_ADDR)
+		ppu_update_stat(ppu);
+}
+
+static inline void ppu_init (ppu_ctx *ppu, bus_ctx *bus, scheduler_ctx *sched, const uint64_t *clock) {
+	memset(ppu, 0, sizeof(*ppu));
+
+	ppu->bus = bus;
+	ppu->sched = sched;
+	ppu->clock = clock;
+	ppu->back = ppu->buffers[0];
+	ppu->front = ppu->buffers[1];
+	ppu->cycles = *clock;
+	ppu->mode = PPU_MODE_OAM;
+	ppu->pending_top = LCD_HEIGHT;
+	ppu->pending_bottom = -1;
+	ppu->dirty_top = 0;
+	ppu->dirty_bottom = LCD_HEIGHT - 1;
+
+	for (int i = 0; i < LCD_WIDTH * LCD_HEIGHT; i++)
+		ppu->buffers[0][i] = ppu->buffers[1][i] = ppu_dmg_palette[0];
+
+	// Values the boot ROM leaves behind
+	bus->io[LCDC_ADDR - IO_ADDR] = 0x91;
+	bus->io[BGP_ADDR - IO_ADDR] = 0xFC;
+
+	bus_map_handler(bus, VRAM_ADDR >> 8, VRAM_SIZE / BUS_PAGE_SIZE, NULL, ppu_write_vram, ppu);
+	bus_map_handler(bus, OAM_ADDR >> 8, 1, NULL, ppu_write_oam, ppu);
+
+	bus_map_io(bus, LCDC_ADDR, NULL, ppu_write_lcdc, ppu);
+	bus_map_io(bus, STAT_ADDR, ppu_read_stat, ppu_write_stat, ppu);
+	bus_map_io(bus, LY_ADDR, ppu_read_ly, ppu_write_ly, ppu);
+
+	for (uint16_t addr = SCY_ADDR; addr <= WX_ADDR; addr++) {
+		if (addr != LY_ADDR && addr != 0xFF46)
+			bus_map_io(bus, addr, NULL, ppu_write_reg, ppu);
+	}
+
+	scheduler_register(sched, SCHED_PPU, ppu_event, ppu);
+	ppu_schedule(ppu);
+}
\ No newline at end of file
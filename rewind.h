@@ -0,0 +1,254 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+#include "savestate.h"
+
+#define REWIND_MIN_SKIP 4 // Unchanged bytes it takes to end a literal run, shorter gaps are cheaper kept inline
+
+/*
+	Every captured frame is stored as the XOR of its save state with the one captured before it, run-length
+	coded as (unchanged bytes to skip, changed bytes, XOR of those bytes) tokens. Only the newest state is
+	kept whole, and XORing the newest delta into it gives back the frame before, so stepping back one frame
+	is a single pass over a few hundred bytes plus a state load.
+
+	Deltas live back to back in one byte ring, the oldest are dropped as new ones need their space
+*/
+typedef struct {
+	size_t state_size;
+	uint8_t *current; // Whole state of the newest frame in the history
+	uint8_t *next;
+	uint8_t *delta;
+	bool has_current;
+
+	uint8_t *data;
+	size_t capacity;
+	size_t write_pos;
+
+	// Ring of deltas, oldest first. Delta i turns frame i + 1 back into frame i
+	uint32_t *offset;
+	uint32_t *length;
+	uint32_t max_frames;
+	uint32_t first;
+	uint32_t count;
+} rewind_ctx;
+
+static inline size_t rewind_put_varint (uint8_t *out, size_t value) {
+	size_t n = 0;
+
+	while (value >= 0x80) {
+		out[n++] = (uint8_t)value | 0x80;
+		value >>= 7;
+	}
+
+	out[n++] = (uint8_t)value;
+	return n;
+}
+
+static inline size_t rewind_get_varint (const uint8_t *in, size_t *pos) {
+	size_t value = 0;
+	int shift = 0;
+	uint8_t b;
+
+	do {
+		b = in[(*pos)++];
+		value |= (size_t)(b & 0x7F) << shift;
+		shift += 7;
+	} while (b & 0x80);
+
+	return value;
+}
+
+// Encodes prev ^ next into out, an identical pair encodes to nothing
+static inline size_t rewind_encode (const uint8_t *prev, const uint8_t *next, size_t size, uint8_t *out) {
+	size_t len = 0;
+	size_t i = 0;
+
+	while (i < size) {
+		size_t start = i;
+		size_t literal;
+		size_t same = 0;
+
+		// Unchanged stretches are the bulk of every frame, compared a word at a time
+		while (i + 8 <= size && memcmp(prev + i, next + i, 8) == 0)
+			i += 8;
+
+		while (i < size && prev[i] == next[i])
+			i++;
+
+		if (i == size)
+			break;
+
+		literal = i;
+
+		while (i < size && same < REWIND_MIN_SKIP) {
+			same = prev[i] == next[i] ? same + 1 : 0;
+			i++;
+		}
+
+		i -= same;
+
+		len += rewind_put_varint(out + len, literal - start);
+		len += rewind_put_varint(out + len, i - literal);
+
+		for (size_t j = literal; j < i; j++)
+			out[len++] = prev[j] ^ next[j];
+	}
+
+	return len;
+}
+
+// XORs an encoded delta into state, which turns either side of the pair into the other
+static inline void rewind_apply (uint8_t *state, const uint8_t *delta, size_t len) {
+	size_t pos = 0;
+	size_t i = 0;
+
+	while (pos < len) {
+		size_t n;
+
+		i += rewind_get_varint(delta, &pos);
+		n = rewind_get_varint(delta, &pos);
+
+		for (size_t j = 0; j < n; j++)
+			state[i + j] ^= delta[pos + j];
+
+		pos += n;
+		i += n;
+	}
+}
+
+static inline void rewind_reset (rewind_ctx *rw) {
+	rw->has_current = false;
+	rw->write_pos = 0;
+	rw->first = 0;
+	rw->count = 0;
+}
+
+static inline void rewind_free (rewind_ctx *rw) {
+	free(rw->current);
+	free(rw->next);
+	free(rw->delta);
+	free(rw->data);
+	free(rw->offset);
+	free(rw->length);
+
+	memset(rw, 0, sizeof(*rw));
+}
+
+// capacity bytes of deltas and at most max_frames of them, whichever runs out first bounds the history
+static inline bool rewind_init (rewind_ctx *rw, gb_machine *gb, size_t capacity, uint32_t max_frames) {
+	memset(rw, 0, sizeof(*rw));
+
+	rw->state_size = savestate_size(gb);
+	rw->capacity = capacity;
+	rw->max_frames = max_frames;
+
+	// Each token holds at least one changed byte and REWIND_MIN_SKIP unchanged ones separate tokens, so a
+	// delta can never need more than double the state
+	rw->current = malloc(rw->state_size);
+	rw->next = malloc(rw->state_size);
+	rw->delta = malloc(rw->state_size * 2 + 16);
+	rw->data = malloc(capacity);
+	rw->offset = malloc(max_frames * sizeof(uint32_t));
+	rw->length = malloc(max_frames * sizeof(uint32_t));
+
+	if (!rw->current || !rw->next || !rw->delta || !rw->data || !rw->offset || !rw->length) {
+		rewind_free(rw);
+		return false;
+	}
+
+	return true;
+}
+
+static inline uint32_t rewind_slot (rewind_ctx *rw, uint32_t index) {
+	return (rw->first + index) % rw->max_frames;
+}
+
+static inline void rewind_drop_oldest (rewind_ctx *rw) {
+	rw->first = rewind_slot(rw, 1);
+	rw->count--;
+}
+
+// Finds room for len bytes after the newest delta, wrapping to the start of the ring when the end is too short
+static inline bool rewind_reserve (rewind_ctx *rw, size_t len, size_t *at) {
+	size_t pos = rw->write_pos;
+
+	if (len > rw->capacity)
+		return false;
+
+	if (rw->count == rw->max_frames)
+		rewind_drop_oldest(rw);
+
+	// Everything between here and the end of the ring is older than anything at the start
+	if (pos + len > rw->capacity) {
+		while (rw->count && rw->offset[rw->first] >= pos)
+			rewind_drop_oldest(rw);
+
+		pos = 0;
+	}
+
+	// Going forward from pos the deltas are in age order, so the oldest is always the next one in the way
+	while (rw->count && rw->offset[rw->first] >= pos && rw->offset[rw->first] < pos + len)
+		rewind_drop_oldest(rw);
+
+	*at = pos;
+	return true;
+}
+
+// Captures the machine as the newest frame of the history
+static inline void rewind_push (rewind_ctx *rw, gb_machine *gb) {
+	uint8_t *swap;
+	size_t len;
+	size_t at;
+
+	if (!rw->has_current) {
+		savestate_save(gb, rw->current, rw->state_size);
+		rw->has_current = true;
+		return;
+	}
+
+	savestate_save(gb, rw->next, rw->state_size);
+	len = rewind_encode(rw->next, rw->current, rw->state_size, rw->delta);
+
+	if (!rewind_reserve(rw, len, &at)) {
+		rewind_reset(rw);
+		return;
+	}
+
+	memcpy(rw->data + at, rw->delta, len);
+
+	rw->offset[rewind_slot(rw, rw->count)] = at;
+	rw->length[rewind_slot(rw, rw->count)] = len;
+	rw->write_pos = at + len;
+	rw->count++;
+
+	swap = rw->current;
+	rw->current = rw->next;
+	rw->next = swap;
+}
+
+// Steps the history back by up to frames and loads the frame it lands on, false when there is nothing to go back to
+static inline bool rewind_step_back (rewind_ctx *rw, gb_machine *gb, uint32_t frames) {
+	if (!rw->has_current || rw->count == 0)
+		return false;
+
+	while (frames-- && rw->count) {
+		uint32_t slot = rewind_slot(rw, rw->count - 1);
+
+		rewind_apply(rw->current, rw->data + rw->offset[slot], rw->length[slot]);
+		rw->write_pos = rw->offset[slot];
+		rw->count--;
+	}
+
+	return savestate_load(gb, rw->current, rw->state_size);
+}
+
+// Bytes the deltas in the history take up
+static inline size_t rewind_used (rewind_ctx *rw) {
+	size_t used = 0;
+
+	for (uint32_t i = 0; i < rw->count; i++)
+		used += rw->length[rewind_slot(rw, i)];
+
+	return used;
+}
\ No newline at end of file
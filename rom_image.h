@@ -0,0 +1,92 @@
+#pragma once
+
+#include "common.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ROM_IMAGE_HAS_MMAP
+#endif
+
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	bool is_mapped; // false when the image is a private heap copy
+} rom_image;
+
+// Reads the whole file into a heap buffer, used where mmap is unavailable or fails
+static inline bool rom_image_read (rom_image *rom, const char *path) {
+	FILE *file = NULL;
+	uint8_t *data = NULL;
+	long size = 0;
+
+	if ((file = fopen(path, "rb")) == NULL)
+		return false;
+
+	if (fseek(file, 0, SEEK_END) < 0 || (size = ftell(file)) <= 0 ||
+		(data = malloc(size)) == NULL) {
+		fclose(file);
+		return false;
+	}
+
+	rewind(file);
+
+	if (fread(data, 1, size, file) != (size_t)size) {
+		free(data);
+		fclose(file);
+		return false;
+	}
+
+	fclose(file);
+
+	rom->data = data;
+	rom->size = size;
+	rom->is_mapped = false;
+
+	return true;
+}
+
+// Maps the ROM read-only so every instance on the host shares the same page cache pages
+static inline bool rom_image_open (rom_image *rom, const char *path) {
+	memset(rom, 0, sizeof(*rom));
+
+#ifdef ROM_IMAGE_HAS_MMAP
+	struct stat st;
+	void *data = MAP_FAILED;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// The mapping holds its own reference to the file
+	close(fd);
+
+	if (data != MAP_FAILED) {
+		rom->data = data;
+		rom->size = st.st_size;
+		rom->is_mapped = true;
+
+		return true;
+	}
+#endif
+
+	return rom_image_read(rom, path);
+}
+
+static inline void rom_image_close (rom_image *rom) {
+#ifdef ROM_IMAGE_HAS_MMAP
+	if (rom->is_mapped) {
+		munmap((void *)rom->data, rom->size);
+		memset(rom, 0, sizeof(*rom));
+		return;
+	}
+#endif
+
+	free((void *)rom->data);
+	memset(rom, 0, sizeof(*rom));
+}
\ No newline at end of file
@@ -0,0 +1,278 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+
+#define SAVESTATE_MAGIC "GBSS"
+#define SAVESTATE_VERSION 1
+#define SAVESTATE_HEADER_SIZE 8
+#define SAVESTATE_CHUNK_HEADER_SIZE 8
+
+/*
+	Layout, host byte order:
+
+	"GBSS" u16 version u16 chunk count
+	then per chunk: 4 byte tag, u32 payload size, payload
+
+	Every chunk is written and read by the same function, so a field can never be saved in one order and
+	loaded in another. Only RAM and registers are stored, never ROM, page tables, caches or frame buffers.
+	Unknown tags are skipped and a known tag with the wrong size rejects the whole state before anything
+	is touched
+*/
+
+typedef enum {
+	STATE_MEASURE,
+	STATE_SAVE,
+	STATE_LOAD
+} state_mode;
+
+typedef struct {
+	state_mode mode;
+	uint8_t *data;
+	size_t pos;
+} state_io;
+
+static inline void state_bytes (state_io *io, void *field, size_t len) {
+	if (io->mode == STATE_SAVE)
+		memcpy(io->data + io->pos, field, len);
+	else if (io->mode == STATE_LOAD)
+		memcpy(field, io->data + io->pos, len);
+
+	io->pos += len;
+}
+
+#define STATE_FIELD(io, field) state_bytes(io, &(field), sizeof(field))
+
+static inline void state_cpu (state_io *io, gb_machine *gb) {
+	// sm83_ctx is plain registers and counters, the run deadline included is meaningless but harmless
+	STATE_FIELD(io, gb->cpu);
+}
+
+static inline void state_bus (state_io *io, gb_machine *gb) {
+	STATE_FIELD(io, gb->bus.vram);
+	STATE_FIELD(io, gb->bus.vram_bank);
+	STATE_FIELD(io, gb->bus.wram);
+	STATE_FIELD(io, gb->bus.oam);
+	STATE_FIELD(io, gb->bus.oam_locked);
+	STATE_FIELD(io, gb->bus.io);
+	STATE_FIELD(io, gb->bus.hram);
+	STATE_FIELD(io, gb->bus.ie);
+}
+
+static inline void state_mapper (state_io *io, gb_machine *gb) {
+	mapper_ctx *mapper = &gb->mapper;
+
+	STATE_FIELD(io, mapper->ram_enabled);
+	STATE_FIELD(io, mapper->rom_bank);
+	STATE_FIELD(io, mapper->ram_bank);
+	STATE_FIELD(io, mapper->banking_mode);
+	STATE_FIELD(io, mapper->rtc);
+	STATE_FIELD(io, mapper->rtc_latched);
+	STATE_FIELD(io, mapper->rtc_latch);
+
+	if (mapper->ram)
+		state_bytes(io, mapper->ram, mapper->ram_size);
+}
+
+static inline void state_ppu (state_io *io, gb_machine *gb) {
+	ppu_ctx *ppu = &gb->ppu;
+
+	STATE_FIELD(io, ppu->cycles);
+	STATE_FIELD(io, ppu->frame_count);
+	STATE_FIELD(io, ppu->dot);
+	STATE_FIELD(io, ppu->ly);
+	STATE_FIELD(io, ppu->mode);
+	STATE_FIELD(io, ppu->window_line);
+	STATE_FIELD(io, ppu->stat_line);
+}
+
+static inline void state_timer (state_io *io, gb_machine *gb) {
+	STATE_FIELD(io, gb->timer.div_base);
+	STATE_FIELD(io, gb->timer.synced);
+}
+
+static inline void state_dma (state_io *io, gb_machine *gb) {
+	STATE_FIELD(io, gb->dma.hdma_src);
+	STATE_FIELD(io, gb->dma.hdma_dst);
+	STATE_FIELD(io, gb->dma.hdma_blocks);
+	STATE_FIELD(io, gb->dma.hdma_hblank);
+}
+
+static inline void state_apu (state_io *io, gb_machine *gb) {
+	apu_ctx *apu = &gb->apu;
+
+	STATE_FIELD(io, apu->ch);
+	STATE_FIELD(io, apu->frame_step);
+	STATE_FIELD(io, apu->sweep_enabled);
+	STATE_FIELD(io, apu->sweep_shadow);
+	STATE_FIELD(io, apu->sweep_timer);
+	STATE_FIELD(io, apu->lfsr);
+}
+
+// Pending deadlines only, handlers are registered by machine_init
+static inline void state_sched (state_io *io, gb_machine *gb) {
+	STATE_FIELD(io, gb->sched.deadline);
+}
+
+typedef struct {
+	char tag[4];
+	void (*fn) (state_io *io, gb_machine *gb);
+} state_chunk;
+
+static const state_chunk savestate_chunks[] = {
+	{ "CPU ", state_cpu },
+	{ "BUS ", state_bus },
+	{ "MAPR", state_mapper },
+	{ "PPU ", state_ppu },
+	{ "TIMR", state_timer },
+	{ "DMA ", state_dma },
+	{ "APU ", state_apu },
+	{ "SCHD", state_sched },
+};
+
+#define SAVESTATE_CHUNK_COUNT (sizeof(savestate_chunks) / sizeof(savestate_chunks[0]))
+
+static inline size_t state_chunk_size (const state_chunk *chunk, gb_machine *gb) {
+	state_io io = { STATE_MEASURE, NULL, 0 };
+
+	chunk->fn(&io, gb);
+	return io.pos;
+}
+
+// Bytes a save of this machine takes, fixed for a given cartridge
+static inline size_t savestate_size (gb_machine *gb) {
+	size_t size = SAVESTATE_HEADER_SIZE;
+
+	for (size_t i = 0; i < SAVESTATE_CHUNK_COUNT; i++)
+		size += SAVESTATE_CHUNK_HEADER_SIZE + state_chunk_size(&savestate_chunks[i], gb);
+
+	return size;
+}
+
+// Writes the whole machine into out, returns the bytes used or 0 if capacity is too small
+static inline size_t savestate_save (gb_machine *gb, uint8_t *out, size_t capacity) {
+	state_io io = { STATE_SAVE, out, SAVESTATE_HEADER_SIZE };
+	uint16_t version = SAVESTATE_VERSION;
+	uint16_t count = SAVESTATE_CHUNK_COUNT;
+
+	if (capacity < savestate_size(gb))
+		return 0;
+
+	memcpy(out, SAVESTATE_MAGIC, 4);
+	memcpy(out + 4, &version, sizeof(version));
+	memcpy(out + 6, &count, sizeof(count));
+
+	for (size_t i = 0; i < SAVESTATE_CHUNK_COUNT; i++) {
+		size_t start = io.pos + SAVESTATE_CHUNK_HEADER_SIZE;
+		uint32_t size;
+
+		memcpy(out + io.pos, savestate_chunks[i].tag, 4);
+		io.pos = start;
+		savestate_chunks[i].fn(&io, gb);
+
+		size = io.pos - start;
+		memcpy(out + start - 4, &size, sizeof(size));
+	}
+
+	return io.pos;
+}
+
+static inline const state_chunk *state_find_chunk (const uint8_t *tag) {
+	for (size_t i = 0; i < SAVESTATE_CHUNK_COUNT; i++) {
+		if (memcmp(savestate_chunks[i].tag, tag, 4) == 0)
+			return &savestate_chunks[i];
+	}
+
+	return NULL;
+}
+
+// Walks the chunks, calling apply for each known one. With apply false it only checks the framing, the sizes
+// and that every chunk this build knows is there, so a load never restores half a machine
+static inline bool state_walk (gb_machine *gb, const uint8_t *data, size_t size, bool apply) {
+	bool seen[SAVESTATE_CHUNK_COUNT] = { false };
+	size_t pos = SAVESTATE_HEADER_SIZE;
+	uint16_t count;
+
+	memcpy(&count, data + 6, sizeof(count));
+
+	for (uint16_t i = 0; i < count; i++) {
+		const state_chunk *chunk;
+		uint32_t chunk_size;
+
+		if (size - pos < SAVESTATE_CHUNK_HEADER_SIZE)
+			return false;
+
+		memcpy(&chunk_size, data + pos + 4, sizeof(chunk_size));
+		chunk = state_find_chunk(data + pos);
+		pos += SAVESTATE_CHUNK_HEADER_SIZE;
+
+		if (size - pos < chunk_size)
+			return false;
+
+		if (chunk && !apply && state_chunk_size(chunk, gb) != chunk_size)
+			return false;
+
+		if (chunk)
+			seen[chunk - savestate_chunks] = true;
+
+		if (chunk && apply) {
+			state_io io = { STATE_LOAD, (uint8_t *)data + pos, 0 };
+
+			chunk->fn(&io, gb);
+		}
+
+		pos += chunk_size;
+	}
+
+	for (size_t i = 0; i < SAVESTATE_CHUNK_COUNT; i++) {
+		if (!seen[i])
+			return false;
+	}
+
+	return true;
+}
+
+// Everything derived from the restored state: bank mappings, decoded tiles and the event queue
+static inline void state_rebuild (gb_machine *gb) {
+	gb->cpu.deadline = 0;
+
+	bus_map_vram(&gb->bus);
+	memset(gb->bus.tile_dirty, 0xFF, sizeof(gb->bus.tile_dirty));
+
+	mapper_map_rom(&gb->mapper);
+	mapper_map_ram(&gb->mapper);
+
+	for (int id = 0; id < SCHED_EVENT_COUNT; id++) {
+		uint64_t deadline = gb->sched.deadline[id];
+
+		gb->sched.slot[id] = -1;
+		gb->sched.deadline[id] = SCHED_NEVER;
+
+		if (deadline != SCHED_NEVER)
+			scheduler_schedule(&gb->sched, id, deadline);
+	}
+
+	// Audio already in the buffers belongs to the old timeline
+	blip_clear(&gb->apu.left);
+	blip_clear(&gb->apu.right);
+	gb->apu.frame_start = gb->cpu.cycles;
+}
+
+// Restores a state made by savestate_save for the same cartridge, the machine is untouched when it returns false
+static inline bool savestate_load (gb_machine *gb, const uint8_t *data, size_t size) {
+	uint16_t version;
+
+	if (size < SAVESTATE_HEADER_SIZE || memcmp(data, SAVESTATE_MAGIC, 4) != 0)
+		return false;
+
+	memcpy(&version, data + 4, sizeof(version));
+
+	if (version != SAVESTATE_VERSION || !state_walk(gb, data, size, false))
+		return false;
+
+	gb->sched.count = 0;
+	state_walk(gb, data, size, true);
+	state_rebuild(gb);
+
+	return true;
+}
\ No newline at end of file
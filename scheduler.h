@@ -0,0 +1,147 @@
+#pragma once
+
+#include "common.h"
+
+#define SCHED_NEVER UINT64_MAX
+
+// Every timed component owns one event slot, an event is either pending once or not at all
+typedef enum {
+	SCHED_PPU,
+	SCHED_TIMER,
+	SCHED_SERIAL,
+	SCHED_DMA,
+	SCHED_APU,
+	SCHED_EVENT_COUNT
+} sched_event;
+
+// Called with the cycle the event was due at, the clock may already be a few cycles past it
+typedef void (*sched_fn) (void *ctx, uint64_t when);
+
+typedef struct {
+	// Binary min-heap of pending event ids ordered by deadline
+	uint8_t heap[SCHED_EVENT_COUNT];
+	int8_t slot[SCHED_EVENT_COUNT]; // Position of each event in heap, -1 when not pending
+	uint8_t count;
+
+	uint64_t deadline[SCHED_EVENT_COUNT];
+	sched_fn handler[SCHED_EVENT_COUNT];
+	void *ctx[SCHED_EVENT_COUNT];
+
+	// Stop cycle of the run slice in progress, pulled in when an earlier event is scheduled
+	uint64_t *horizon;
+} scheduler_ctx;
+
+static inline void scheduler_swap (scheduler_ctx *sched, int a, int b) {
+	uint8_t id = sched->heap[a];
+
+	sched->heap[a] = sched->heap[b];
+	sched->heap[b] = id;
+	sched->slot[sched->heap[a]] = a;
+	sched->slot[sched->heap[b]] = b;
+}
+
+static inline void scheduler_sift_up (scheduler_ctx *sched, int i) {
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+
+		if (sched->deadline[sched->heap[parent]] <= sched->deadline[sched->heap[i]])
+			break;
+
+		scheduler_swap(sched, i, parent);
+		i = parent;
+	}
+}
+
+static inline void scheduler_sift_down (scheduler_ctx *sched, int i) {
+	for (;;) {
+		int least = i;
+		int left = i * 2 + 1;
+		int right = left + 1;
+
+		if (left < sched->count && sched->deadline[sched->heap[left]] < sched->deadline[sched->heap[least]])
+			least = left;
+
+		if (right < sched->count && sched->deadline[sched->heap[right]] < sched->deadline[sched->heap[least]])
+			least = right;
+
+		if (least == i)
+			break;
+
+		scheduler_swap(sched, i, least);
+		i = least;
+	}
+}
+
+static inline void scheduler_init (scheduler_ctx *sched) {
+	memset(sched, 0, sizeof(*sched));
+
+	for (int id = 0; id < SCHED_EVENT_COUNT; id++) {
+		sched->slot[id] = -1;
+		sched->deadline[id] = SCHED_NEVER;
+	}
+}
+
+static inline void scheduler_register (scheduler_ctx *sched, sched_event id, sched_fn handler, void *ctx) {
+	sched->handler[id] = handler;
+	sched->ctx[id] = ctx;
+}
+
+static inline bool scheduler_pending (scheduler_ctx *sched, sched_event id) {
+	return sched->slot[id] >= 0;
+}
+
+// Deadline of the earliest pending event
+static inline uint64_t scheduler_next (scheduler_ctx *sched) {
+	return sched->count ? sched->deadline[sched->heap[0]] : SCHED_NEVER;
+}
+
+// Adds the event or moves it if it is already pending
+static inline void scheduler_schedule (scheduler_ctx *sched, sched_event id, uint64_t when) {
+	int i = sched->slot[id];
+
+	if (i < 0) {
+		i = sched->count++;
+		sched->heap[i] = id;
+		sched->slot[id] = i;
+		sched->deadline[id] = when;
+		scheduler_sift_up(sched, i);
+	} else if (when < sched->deadline[id]) {
+		sched->deadline[id] = when;
+		scheduler_sift_up(sched, i);
+	} else {
+		sched->deadline[id] = when;
+		scheduler_sift_down(sched, i);
+	}
+
+	if (sched->horizon && when < *sched->horizon)
+		*sched->horizon = when;
+}
+
+static inline void scheduler_cancel (scheduler_ctx *sched, sched_event id) {
+	int i = sched->slot[id];
+
+	if (i < 0)
+		return;
+
+	scheduler_swap(sched, i, --sched->count);
+	sched->slot[id] = -1;
+	sched->deadline[id] = SCHED_NEVER;
+
+	if (i < sched->count) {
+		scheduler_sift_up(sched, i);
+		scheduler_sift_down(sched, i);
+	}
+}
+
+// Fires every event due at or before now in deadline order, handlers are free to schedule again
+static inline void scheduler_run_due (scheduler_ctx *sched, uint64_t now) {
+	while (sched->count && sched->deadline[sched->heap[0]] <= now) {
+		uint8_t id = sched->heap[0];
+		uint64_t when = sched->deadline[id];
+
+		scheduler_cancel(sched, id);
+
+		if (sched->handler[id])
+			sched->handler[id](sched->ctx[id], when);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "common.h"
+#include "bus.h"
+#include "scheduler.h"
+
+#define SB_ADDR 0xFF01
+#define SC_ADDR 0xFF02
+
+#define SC_START 0x80
+#define SC_INTERNAL_CLOCK 0x01
+#define SC_UNUSED 0x7E // Read back as 1 on DMG
+
+#define SERIAL_BYTE_CYCLES 4096 // 8 bits at 8192 Hz
+#define SERIAL_BUFFER_SIZE 4096
+
+// Takes the byte shifted out when a transfer completes and returns the byte shifted in
+typedef uint8_t (*serial_sink_fn) (void *ctx, uint8_t out);
+
+typedef struct {
+	bus_ctx *bus;
+	scheduler_ctx *sched;
+	const uint64_t *clock;
+
+	// With no sink the port behaves as if no cable is plugged in
+	serial_sink_fn sink;
+	void *sink_ctx;
+} serial_ctx;
+
+// Sink that keeps everything sent, NUL terminated so it can be searched as it grows
+typedef struct {
+	char data[SERIAL_BUFFER_SIZE + 1];
+	size_t len;
+} serial_buffer;
+
+static inline uint8_t serial_sink_buffer (void *ctx, uint8_t out) {
+	serial_buffer *buffer = ctx;
+
+	if (buffer->len < SERIAL_BUFFER_SIZE) {
+		buffer->data[buffer->len++] = out;
+		buffer->data[buffer->len] = '\0';
+	}
+
+	return 0xFF;
+}
+
+static inline uint8_t serial_sink_stdout (void *ctx, uint8_t out) {
+	putchar(out);
+	fflush(stdout);
+
+	return 0xFF;
+}
+
+// The other end of a link cable, ctx is the peer's port. The bytes in the two SB registers swap places, and
+// a peer waiting on the external clock finishes its transfer on the same cycle
+static inline uint8_t serial_sink_peer (void *ctx, uint8_t out) {
+	serial_ctx *peer = ctx;
+	uint8_t *sb = &peer->bus->io[SB_ADDR - IO_ADDR];
+	uint8_t *sc = &peer->bus->io[SC_ADDR - IO_ADDR];
+	uint8_t in = *sb;
+
+	*sb = out;
+
+	if ((*sc & (SC_START | SC_INTERNAL_CLOCK)) == SC_START) {
+		*sc &= ~SC_START;
+		bus_request_interrupt(peer->bus, INTERRUPT_SERIAL);
+	}
+
+	return in;
+}
+
+static inline void serial_set_sink (serial_ctx *serial, serial_sink_fn sink, void *ctx) {
+	serial->sink = sink;
+	serial->sink_ctx = ctx;
+}
+
+// Plugs a cable between two ports, whichever side uses the internal clock drives the transfer.
+// Both machines have to run on the same thread, interleaved in slices shorter than a byte
+static inline void serial_connect (serial_ctx *a, serial_ctx *b) {
+	serial_set_sink(a, serial_sink_peer, b);
+	serial_set_sink(b, serial_sink_peer, a);
+}
+
+// The whole byte is exchanged when the transfer finishes, nothing can observe the bits in between
+static inline void serial_event (void *ctx, uint64_t when) {
+	serial_ctx *serial = ctx;
+	uint8_t *sb = &serial->bus->io[SB_ADDR - IO_ADDR];
+
+	*sb = serial->sink ? serial->sink(serial->sink_ctx, *sb) : 0xFF;
+	serial->bus->io[SC_ADDR - IO_ADDR] &= ~SC_START;
+
+	bus_request_interrupt(serial->bus, INTERRUPT_SERIAL);
+}
+
+static inline uint8_t serial_read_sc (void *ctx, uint16_t addr) {
+	serial_ctx *serial = ctx;
+
+	return serial->bus->io[SC_ADDR - IO_ADDR] | SC_UNUSED;
+}
+
+// Only the internal clock starts a transfer, an external clock waits for a connected peer to drive it
+static inline void serial_write_sc (void *ctx, uint16_t addr, uint8_t data) {
+	serial_ctx *serial = ctx;
+
+	serial->bus->io[SC_ADDR - IO_ADDR] = data & (SC_START | SC_INTERNAL_CLOCK);
+
+	if ((data & (SC_START | SC_INTERNAL_CLOCK)) == (SC_START | SC_INTERNAL_CLOCK))
+		scheduler_schedule(serial->sched, SCHED_SERIAL, *serial->clock + SERIAL_BYTE_CYCLES);
+	else
+		scheduler_cancel(serial->sched, SCHED_SERIAL);
+}
+
+static inline void serial_init (serial_ctx *serial, bus_ctx *bus, scheduler_ctx *sched, const uint64_t *clock) {
+	memset(serial, 0, sizeof(*serial));
+
+	serial->bus = bus;
+	serial->sched = sched;
+	serial->clock = clock;
+
+	bus_map_io(bus, SC_ADDR, serial_read_sc, serial_write_sc, serial);
+
+	scheduler_register(sched, SCHED_SERIAL, serial_event, serial);
+}
\ No newline at end of file
@@ -1,12 +1,19 @@
 #pragma once
 
 #include "common.h"
+#include "bus.h"
+#include "scheduler.h"
 
 #define CARRY_FLAG 4
 #define HALF_CARRY_FLAG 5
 #define SUBTRACTION_FLAG 6
 #define ZERO_FLAG 7
 
+#define SM83_CLOCK_HZ 4194304
+#define CYCLES_PER_FRAME 70224
+#define SM83_INTERRUPT_CYCLES 20
+#define SM83_HALT_STEP_CYCLES 4
+
 typedef struct {
 	uint8_t ime;
 	uint8_t rA;
@@ -14,1125 +21,913 @@ typedef struct {
 	uint8_t rC;
 	uint8_t rD;
 	uint8_t rE;
-	uint8_t rF;
 	uint8_t rH;
 	uint8_t rL;
 	uint16_t sp;
 	uint16_t pc;
+	// F is evaluated lazily from the last flag-setting operation, see sm83_get_f
+	uint16_t flag_res; // Z is set when the low byte is 0, C is bit 8
+	uint8_t flag_a; // H is bit 4 of flag_a ^ flag_b ^ flag_res
+	uint8_t flag_b;
+	uint8_t flag_n;
+	uint64_t cycles;
+	uint64_t deadline; // sm83_run stops once cycles reaches this, the scheduler may lower it mid-run
+	bool ei_pending; // EI sets IME only once the instruction after it has run
 	bool is_halted;
 	bool is_running;
 } sm83_ctx;
 
-uint8_t read_from_memory (uint8_t *memory, uint16_t addr) {
-	// This will be greatly expanded and error checked later
-	return *(memory + addr);
+// T-cycles per opcode, conditional instructions use their not-taken cost here
+static const uint8_t sm83_op_cycles[256] = {
+//	x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+	 4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4, // 0x
+	 4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4, // 1x
+	 8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 2x
+	 8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 3x
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 4x
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 5x
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 6x
+	 8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4, // 7x
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 8x
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 9x
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // Ax
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // Bx
+	 8, 12, 12, 16, 12, 16,  8, 16,  8, 16, 12,  4, 12, 24,  8, 16, // Cx
+	 8, 12, 12,  4, 12, 16,  8, 16,  8, 16, 12,  4, 12,  4,  8, 16, // Dx
+	12, 12,  8,  4,  4, 16,  8, 16, 16,  4, 16,  4,  4,  4,  8, 16, // Ex
+	12, 12,  8,  4,  4, 16,  8, 16, 12,  8, 16,  4,  4,  4,  8, 16  // Fx
+};
+
+// T-cycles for conditional JR/JP/CALL/RET when the branch is taken
+static const uint8_t sm83_op_cycles_taken[256] = {
+//	x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 1x
+	12,  0,  0,  0,  0,  0,  0,  0, 12,  0,  0,  0,  0,  0,  0,  0, // 2x
+	12,  0,  0,  0,  0,  0,  0,  0, 12,  0,  0,  0,  0,  0,  0,  0, // 3x
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 4x
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 5x
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 6x
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 7x
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 8x
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 9x
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // Ax
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // Bx
+	20,  0, 16,  0, 24,  0,  0,  0, 20,  0, 16,  0, 24,  0,  0,  0, // Cx
+	20,  0, 16,  0, 24,  0,  0,  0, 20,  0, 16,  0, 24,  0,  0,  0, // Dx
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // Ex
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0  // Fx
+};
+
+
+// T-cycles for CB-prefixed opcodes on top of the 4 charged for the 0xCB prefix byte
+static const uint8_t sm83_cb_cycles[256] = {
+//	x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // 0x RLC / RRC
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // 1x RL / RR
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // 2x SLA / SRA
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // 3x SWAP / SRL
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 4x BIT
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 5x
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 6x
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 7x
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // 8x RES
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // 9x
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // Ax
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // Bx
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // Cx SET
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // Dx
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4, // Ex
+	 4,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  4,  4, 12,  4  // Fx
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SM83_ALWAYS_INLINE static inline __attribute__((always_inline))
+#else
+#define SM83_ALWAYS_INLINE static inline
+#endif
+
+/*
+ * Lazy flags
+ *
+ * ALU ops only record their operands and 9-bit result, Z/N/H/C are worked
+ * out when something reads them. Z comes from the low byte of flag_res, C
+ * from bit 8, and H is the carry into bit 4, which is bit 4 of
+ * a ^ b ^ result for both addition and subtraction. Ops with fixed H pick
+ * flag_a so that expression gives the wanted bit.
+ */
+
+SM83_ALWAYS_INLINE uint8_t sm83_flag (sm83_ctx *cpu, uint8_t flag_index) {
+	switch (flag_index) {
+	case ZERO_FLAG: return (cpu->flag_res & 0xFF) == 0;
+	case SUBTRACTION_FLAG: return cpu->flag_n;
+	case HALF_CARRY_FLAG: return ((cpu->flag_a ^ cpu->flag_b ^ cpu->flag_res) >> 4) & 1;
+	default: return (cpu->flag_res >> 8) & 1;
+	}
 }
 
-uint8_t read_next_byte (sm83_ctx *cpu, uint8_t *memory) {
-	uint8_t nb = read_from_memory(memory, cpu->pc);
-
-	cpu->pc++;
-	return nb;
+SM83_ALWAYS_INLINE void set_flags (sm83_ctx *cpu, bool zero, bool subtraction, bool half_carry, bool carry) {
+	cpu->flag_res = (uint16_t)(zero ? 0 : 1) | ((uint16_t)carry << 8);
+	cpu->flag_a = half_carry << 4;
+	cpu->flag_b = 0;
+	cpu->flag_n = subtraction;
 }
 
-void write_to_memory (uint8_t *memory, uint16_t addr, uint8_t data) {
-	// This will also be worked on
-	*(memory + addr) = data;
+static inline uint8_t sm83_get_f (sm83_ctx *cpu) {
+	return (sm83_flag(cpu, ZERO_FLAG) << ZERO_FLAG) |
+		(sm83_flag(cpu, SUBTRACTION_FLAG) << SUBTRACTION_FLAG) |
+		(sm83_flag(cpu, HALF_CARRY_FLAG) << HALF_CARRY_FLAG) |
+		(sm83_flag(cpu, CARRY_FLAG) << CARRY_FLAG);
 }
 
-void ld_next_byte (sm83_ctx *cpu, uint8_t *memory, uint8_t *dest) {
-	*dest = read_next_byte(cpu, memory);
+static inline void sm83_set_f (sm83_ctx *cpu, uint8_t f) {
+	set_flags(cpu,
+		get_bit_u8(&f, ZERO_FLAG), get_bit_u8(&f, SUBTRACTION_FLAG),
+		get_bit_u8(&f, HALF_CARRY_FLAG), get_bit_u8(&f, CARRY_FLAG));
 }
 
-void ld_next_u16 (sm83_ctx *cpu, uint8_t *memory, uint8_t *low_b_addr, uint8_t *high_b_addr) {
-	*low_b_addr = read_next_byte(cpu, memory);
-	*high_b_addr = read_next_byte(cpu, memory);
+// Register state the DMG boot ROM hands over to the cartridge at 0x0100
+static inline void sm83_reset (sm83_ctx *cpu) {
+	memset(cpu, 0, sizeof(*cpu));
+	sm83_set_f(cpu, 0xB0);
+
+	cpu->rA = 0x01;
+	cpu->rC = 0x13;
+	cpu->rE = 0xD8;
+	cpu->rH = 0x01;
+	cpu->rL = 0x4D;
+	cpu->sp = 0xFFFE;
+	cpu->pc = 0x0100;
+	cpu->is_running = true;
 }
 
-void call_cc (sm83_ctx *cpu, uint8_t *memory, uint8_t flag_index, uint8_t call_if_value) {
-	uint8_t h_byte = read_next_byte(cpu, memory);
-	uint8_t l_byte = read_next_byte(cpu, memory);
+static inline uint8_t read_next_byte (sm83_ctx *cpu, bus_ctx *bus) {
+	uint8_t nb = read_from_memory(bus, cpu->pc);
 
-	if (get_bit_u8(&cpu->rF, flag_index) == call_if_value) {
-		cpu->sp--;
-		write_to_memory(memory, cpu->sp, h_byte);
+	cpu->pc++;
+	return nb;
+}
 
-		cpu->sp--;
-		write_to_memory(memory, cpu->sp, l_byte);
+static inline uint16_t read_next_u16 (sm83_ctx *cpu, bus_ctx *bus) {
+	uint8_t low_byte = read_next_byte(cpu, bus);
+	uint8_t high_byte = read_next_byte(cpu, bus);
 
-		cpu->pc = bytes_to_u16(l_byte, h_byte);
-	}
+	return bytes_to_u16(low_byte, high_byte);
 }
 
-void pop_r16 (sm83_ctx *cpu, uint8_t *memory, uint8_t *h_reg, uint8_t *l_reg) {
-	*l_reg = read_from_memory(memory, cpu->sp++);
-	*h_reg = read_from_memory(memory, cpu->sp++);
+static inline void set_r16 (uint8_t *high_reg, uint8_t *low_reg, uint16_t value) {
+	*high_reg = (value & 0xFF00) >> 8;
+	*low_reg = value & 0x00FF;
 }
 
-void push_r16 (sm83_ctx *cpu, uint8_t *memory, uint8_t h_byte, uint8_t l_byte) {
+static inline void push_u16 (sm83_ctx *cpu, bus_ctx *bus, uint16_t data) {
 	cpu->sp--;
-	write_to_memory(memory, cpu->sp, h_byte);
+	write_to_memory(bus, cpu->sp, (data & 0xFF00) >> 8);
 
 	cpu->sp--;
-	write_to_memory(memory, cpu->sp, l_byte);
+	write_to_memory(bus, cpu->sp, data & 0x00FF);
 }
 
-void push_u16 (sm83_ctx *cpu, uint8_t *memory, uint16_t data) {
-	uint8_t l_byte = (uint8_t)((data & 0xFF00) >> 8);
-	uint8_t h_byte = (uint8_t)(data & 0x00FF);
+static inline uint16_t pop_u16 (sm83_ctx *cpu, bus_ctx *bus) {
+	uint8_t low_byte = read_from_memory(bus, cpu->sp++);
+	uint8_t high_byte = read_from_memory(bus, cpu->sp++);
 
-	cpu->sp--;
-	write_to_memory(memory, cpu->sp, h_byte);
+	return bytes_to_u16(low_byte, high_byte);
+}
 
-	cpu->sp--;
-	write_to_memory(memory, cpu->sp, l_byte);
+SM83_ALWAYS_INLINE bool call_cc (sm83_ctx *cpu, bus_ctx *bus, uint8_t flag_index, uint8_t call_if_value) {
+	uint16_t call_address = read_next_u16(cpu, bus);
+
+	if (sm83_flag(cpu, flag_index) == call_if_value) {
+		push_u16(cpu, bus, cpu->pc);
+		cpu->pc = call_address;
+		return true;
+	}
+
+	return false;
 }
 
-void jp_cc (sm83_ctx *cpu, uint8_t *memory, uint8_t flag_index, uint8_t jump_if_value) {
-	uint16_t jp_address = bytes_to_u16(read_next_byte(cpu, memory), read_next_byte(cpu, memory));
+SM83_ALWAYS_INLINE bool jp_cc (sm83_ctx *cpu, bus_ctx *bus, uint8_t flag_index, uint8_t jump_if_value) {
+	uint16_t jp_address = read_next_u16(cpu, bus);
 
-	if (get_bit_u8(&cpu->rF, flag_index) == jump_if_value) {
+	if (sm83_flag(cpu, flag_index) == jump_if_value) {
 		cpu->pc = jp_address;
+		return true;
 	}
+
+	return false;
 }
 
-void jr_cc (sm83_ctx *cpu, uint8_t *memory, uint8_t flag_index, uint8_t jump_if_value) {
-	int8_t address_offset = read_next_byte(cpu, memory);
+SM83_ALWAYS_INLINE bool jr_cc (sm83_ctx *cpu, bus_ctx *bus, uint8_t flag_index, uint8_t jump_if_value) {
+	int8_t address_offset = (int8_t)read_next_byte(cpu, bus);
 
-	if (get_bit_u8(&cpu->rF, flag_index) == jump_if_value) {
-		if (address_offset < 0) {
-			cpu->pc -= (address_offset * -1);
-		} else {
-			cpu->pc += address_offset;
-		}
+	if (sm83_flag(cpu, flag_index) == jump_if_value) {
+		cpu->pc += address_offset;
+		return true;
 	}
+
+	return false;
 }
 
-void ret_cc (sm83_ctx *cpu, uint8_t *memory, uint8_t flag_index, uint8_t ret_if_value) {
-	if (get_bit_u8(&cpu->rF, flag_index) == ret_if_value) {
-		cpu->pc = bytes_to_u16(
-			read_from_memory(memory, cpu->sp++),
-			read_from_memory(memory, cpu->sp++));
+SM83_ALWAYS_INLINE bool ret_cc (sm83_ctx *cpu, bus_ctx *bus, uint8_t flag_index, uint8_t ret_if_value) {
+	if (sm83_flag(cpu, flag_index) == ret_if_value) {
+		cpu->pc = pop_u16(cpu, bus);
+		return true;
 	}
+
+	return false;
 }
 
-uint8_t alu_add (sm83_ctx *cpu, uint8_t a, uint8_t b) {
-	uint8_t result = a + b;
+// Records an 8-bit add/sub, result keeps its borrow/carry in bit 8
+SM83_ALWAYS_INLINE uint8_t alu_record (sm83_ctx *cpu, uint8_t a, uint8_t b, uint16_t result, bool subtraction) {
+	cpu->flag_res = result;
+	cpu->flag_a = a;
+	cpu->flag_b = b;
+	cpu->flag_n = subtraction;
+
+	return (uint8_t)result;
+}
 
-	set_bit_u8(&cpu->rF, ZERO_FLAG, result == 0);
-	set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, false);
-	set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, (a & 0x0F) > (result & 0x0F));
-	set_bit_u8(&cpu->rF, CARRY_FLAG, a > result);
+static inline uint8_t alu_add (sm83_ctx *cpu, uint8_t a, uint8_t b) {
+	return alu_record(cpu, a, b, a + b, false);
+}
+
+static inline uint8_t alu_adc (sm83_ctx *cpu, uint8_t a, uint8_t b) {
+	return alu_record(cpu, a, b, a + b + sm83_flag(cpu, CARRY_FLAG), false);
+}
+
+static inline uint8_t alu_sub (sm83_ctx *cpu, uint8_t a, uint8_t b) {
+	return alu_record(cpu, a, b, (uint16_t)(a - b), true);
+}
+
+static inline uint8_t alu_sbc (sm83_ctx *cpu, uint8_t a, uint8_t b) {
+	return alu_record(cpu, a, b, (uint16_t)(a - b - sm83_flag(cpu, CARRY_FLAG)), true);
+}
+
+// Logic ops clear C, AND sets H and OR/XOR clear it
+static inline uint8_t alu_and (sm83_ctx *cpu, uint8_t a, uint8_t b) {
+	uint8_t result = a & b;
+
+	return alu_record(cpu, result ^ 0x10, 0, result, false);
+}
+
+static inline uint8_t alu_or (sm83_ctx *cpu, uint8_t a, uint8_t b) {
+	uint8_t result = a | b;
+
+	return alu_record(cpu, result, 0, result, false);
+}
+
+static inline uint8_t alu_xor (sm83_ctx *cpu, uint8_t a, uint8_t b) {
+	uint8_t result = a ^ b;
+
+	return alu_record(cpu, result, 0, result, false);
+}
+
+// CP only sets flags, returning a lets it share the ALU row generator with the others
+static inline uint8_t alu_cp (sm83_ctx *cpu, uint8_t a, uint8_t b) {
+	alu_sub(cpu, a, b);
+
+	return a;
+}
+
+// INC/DEC leave C alone, so bit 8 of the previous result carries over
+static inline uint8_t alu_inc (sm83_ctx *cpu, uint8_t value) {
+	return alu_record(cpu, value, 1, (uint8_t)(value + 1) | (cpu->flag_res & 0x100), false);
+}
+
+static inline uint8_t alu_dec (sm83_ctx *cpu, uint8_t value) {
+	return alu_record(cpu, value, 1, (uint8_t)(value - 1) | (cpu->flag_res & 0x100), true);
+}
+
+static inline uint8_t alu_rlc (sm83_ctx *cpu, uint8_t value) {
+	uint8_t result = (value << 1) | (value >> 7);
+
+	set_flags(cpu, result == 0, false, false, value >> 7);
 
 	return result;
 }
 
-uint8_t alu_sub (sm83_ctx *cpu, uint8_t a, uint8_t b) {
-	uint8_t result = a - b;
+static inline uint8_t alu_rrc (sm83_ctx *cpu, uint8_t value) {
+	uint8_t result = (value >> 1) | (value << 7);
 
-	set_bit_u8(&cpu->rF, ZERO_FLAG, result == 0);
-	set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, true);
-	set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, (a & 0x0F) < (result & 0x0F));
-	set_bit_u8(&cpu->rF, CARRY_FLAG, a < result);
+	set_flags(cpu, result == 0, false, false, value & 1);
 
 	return result;
 }
 
-uint8_t alu_and (sm83_ctx *cpu, uint8_t a, uint8_t b) {
-	uint8_t result = a & b;
+static inline uint8_t alu_rl (sm83_ctx *cpu, uint8_t value) {
+	uint8_t result = (value << 1) | sm83_flag(cpu, CARRY_FLAG);
 
-	set_bit_u8(&cpu->rF, ZERO_FLAG, result == 0);
-	set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, false);
-	set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, true);
-	set_bit_u8(&cpu->rF, CARRY_FLAG, false);
+	set_flags(cpu, result == 0, false, false, value >> 7);
 
 	return result;
 }
 
-uint8_t alu_or (sm83_ctx *cpu, uint8_t a, uint8_t b) {
-	uint8_t result = a | b;
+static inline uint8_t alu_rr (sm83_ctx *cpu, uint8_t value) {
+	uint8_t result = (value >> 1) | (sm83_flag(cpu, CARRY_FLAG) << 7);
 
-	set_bit_u8(&cpu->rF, ZERO_FLAG, result == 0);
-	set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, false);
-	set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, false);
-	set_bit_u8(&cpu->rF, CARRY_FLAG, false);
+	set_flags(cpu, result == 0, false, false, value & 1);
 
 	return result;
 }
 
-uint8_t alu_xor (sm83_ctx *cpu, uint8_t a, uint8_t b) {
-	uint8_t result = a ^ b;
+static inline uint8_t alu_sla (sm83_ctx *cpu, uint8_t value) {
+	uint8_t result = value << 1;
 
-	set_bit_u8(&cpu->rF, ZERO_FLAG, result == 0);
-	set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, false);
-	set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, false);
-	set_bit_u8(&cpu->rF, CARRY_FLAG, false);
+	set_flags(cpu, result == 0, false, false, value >> 7);
 
 	return result;
 }
 
-void inc_reg (sm83_ctx *cpu, uint8_t *reg) {
-	uint8_t result = *reg + 1;
+static inline uint8_t alu_sra (sm83_ctx *cpu, uint8_t value) {
+	uint8_t result = (value >> 1) | (value & 0x80);
 
-	set_bit_u8(&cpu->rF, ZERO_FLAG, result == 0);
-	set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, false);
-	set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, (*reg & 0x0F) > (result & 0x0F));
+	set_flags(cpu, result == 0, false, false, value & 1);
 
-	*reg = result;
+	return result;
 }
 
-void dec_reg (sm83_ctx *cpu, uint8_t *reg) {
-	uint8_t result = *reg - 1;
+static inline uint8_t alu_srl (sm83_ctx *cpu, uint8_t value) {
+	uint8_t result = value >> 1;
 
-	set_bit_u8(&cpu->rF, ZERO_FLAG, result == 0);
-	set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, true);
-	set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, (*reg & 0x0F) < (result & 0x0F));
+	set_flags(cpu, result == 0, false, false, value & 1);
 
-	*reg = result;
+	return result;
 }
 
-void mod_u16_reg (uint8_t *low_reg, uint8_t *high_reg, int8_t value) {
-	uint16_t hl_val = bytes_to_u16(*low_reg, *high_reg) + value;
+static inline uint8_t alu_swap (sm83_ctx *cpu, uint8_t value) {
+	uint8_t result = (value << 4) | (value >> 4);
+
+	set_flags(cpu, result == 0, false, false, false);
 
-	*low_reg = hl_val & 0x00FF;
-	*high_reg = (hl_val & 0xFF00) >> 8;
+	return result;
 }
 
-void mod_addr_in_hl (sm83_ctx *cpu, uint8_t *memory, int8_t value) {
-	uint8_t addr = bytes_to_u16(cpu->rL, cpu->rH);
-	uint8_t addr_val = read_from_memory(memory, addr);
-	uint8_t result = addr_val + value;
+static inline void alu_add_hl (sm83_ctx *cpu, uint16_t value) {
+	uint16_t hl = bytes_to_u16(cpu->rL, cpu->rH);
+
+	set_flags(cpu, sm83_flag(cpu, ZERO_FLAG), false,
+		(hl & 0x0FFF) + (value & 0x0FFF) > 0x0FFF,
+		hl + value > 0xFFFF);
 
-	set_bit_u8(&cpu->rF, ZERO_FLAG, result == 0);
+	set_r16(&cpu->rH, &cpu->rL, hl + value);
+}
 
-	if (value < 0) {
-		set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, true);
-		set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, (addr_val & 0x0F) < (result & 0x0F));
+// Shared by ADD SP, e8 and LD HL, SP + e8, flags come from the unsigned low byte add
+static inline uint16_t alu_add_sp (sm83_ctx *cpu, int8_t offset) {
+	uint8_t low_offset = (uint8_t)offset;
+
+	set_flags(cpu, false, false,
+		(cpu->sp & 0x0F) + (low_offset & 0x0F) > 0x0F,
+		(cpu->sp & 0xFF) + low_offset > 0xFF);
+
+	return cpu->sp + offset;
+}
+
+static inline void alu_daa (sm83_ctx *cpu) {
+	uint8_t adjust = 0;
+	bool carry = sm83_flag(cpu, CARRY_FLAG);
+
+	bool subtraction = sm83_flag(cpu, SUBTRACTION_FLAG);
+
+	if (subtraction) {
+		if (sm83_flag(cpu, HALF_CARRY_FLAG)) adjust |= 0x06;
+		if (carry) adjust |= 0x60;
+
+		cpu->rA -= adjust;
 	} else {
-		set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, false);
-		set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, (addr_val & 0x0F) > (result & 0x0F));
+		if (sm83_flag(cpu, HALF_CARRY_FLAG) || (cpu->rA & 0x0F) > 0x09) adjust |= 0x06;
+		if (carry || cpu->rA > 0x99) {
+			adjust |= 0x60;
+			carry = true;
+		}
+
+		cpu->rA += adjust;
 	}
 
-	write_to_memory(memory, addr, result);
+	set_flags(cpu, cpu->rA == 0, subtraction, false, carry);
 }
 
-uint8_t next_instruction (sm83_ctx *cpu, uint8_t *memory) {
-	uint8_t op_code = *(memory + cpu->pc);
+static inline void sm83_illegal (sm83_ctx *cpu, uint8_t op_code) {
+	cpu->is_running = false;
+	printf("Was unable to process instruction 0x%02X\n", op_code);
+}
 
-	cpu->pc++;
+/*
+ * Opcode handlers
+ *
+ * Every opcode gets one handler, sm83_op_XX. The regular parts of the grid
+ * (r8 loads, ALU rows, INC/DEC columns, RST, ...) are generated from the
+ * r8/r16 operand encodings below instead of written out per register. The
+ * dispatchers at the bottom of the file are built from the same handlers.
+ */
+
+#define SM83_OP(code) static inline void sm83_op_##code (sm83_ctx *cpu, bus_ctx *bus)
+
+// Extra T-cycles when a conditional opcode takes its branch, the base cost is added by the dispatcher
+#define SM83_TAKEN_EXTRA(code) (sm83_op_cycles_taken[0x##code] - sm83_op_cycles[0x##code])
+
+#define SM83_HL bytes_to_u16(cpu->rL, cpu->rH)
+
+// r8 operand encoding: B, C, D, E, H, L, [HL], A
+#define SM83_GET_R8_0 cpu->rB
+#define SM83_GET_R8_1 cpu->rC
+#define SM83_GET_R8_2 cpu->rD
+#define SM83_GET_R8_3 cpu->rE
+#define SM83_GET_R8_4 cpu->rH
+#define SM83_GET_R8_5 cpu->rL
+#define SM83_GET_R8_6 read_from_memory(bus, SM83_HL)
+#define SM83_GET_R8_7 cpu->rA
+
+#define SM83_SET_R8_0(v) cpu->rB = (v)
+#define SM83_SET_R8_1(v) cpu->rC = (v)
+#define SM83_SET_R8_2(v) cpu->rD = (v)
+#define SM83_SET_R8_3(v) cpu->rE = (v)
+#define SM83_SET_R8_4(v) cpu->rH = (v)
+#define SM83_SET_R8_5(v) cpu->rL = (v)
+#define SM83_SET_R8_6(v) write_to_memory(bus, SM83_HL, (v))
+#define SM83_SET_R8_7(v) cpu->rA = (v)
+
+// r16 operand encoding: BC, DE, HL, SP
+#define SM83_GET_R16_0 bytes_to_u16(cpu->rC, cpu->rB)
+#define SM83_GET_R16_1 bytes_to_u16(cpu->rE, cpu->rD)
+#define SM83_GET_R16_2 SM83_HL
+#define SM83_GET_R16_3 cpu->sp
+
+#define SM83_SET_R16_0(v) set_r16(&cpu->rB, &cpu->rC, (v))
+#define SM83_SET_R16_1(v) set_r16(&cpu->rD, &cpu->rE, (v))
+#define SM83_SET_R16_2(v) set_r16(&cpu->rH, &cpu->rL, (v))
+#define SM83_SET_R16_3(v) cpu->sp = (v)
+
+#define SM83_LD_R8_R8(code, d, s) SM83_OP(code) { SM83_SET_R8_##d(SM83_GET_R8_##s); }
+#define SM83_LD_R8_N8(code, r) SM83_OP(code) { SM83_SET_R8_##r(read_next_byte(cpu, bus)); }
+#define SM83_INC_R8(code, r) SM83_OP(code) { SM83_SET_R8_##r(alu_inc(cpu, SM83_GET_R8_##r)); }
+#define SM83_DEC_R8(code, r) SM83_OP(code) { SM83_SET_R8_##r(alu_dec(cpu, SM83_GET_R8_##r)); }
+#define SM83_ALU_R8(code, fn, s) SM83_OP(code) { cpu->rA = fn(cpu, cpu->rA, SM83_GET_R8_##s); }
+#define SM83_ALU_N8(code, fn) SM83_OP(code) { cpu->rA = fn(cpu, cpu->rA, read_next_byte(cpu, bus)); }
+
+#define SM83_LD_R16_N16(code, r) SM83_OP(code) { SM83_SET_R16_##r(read_next_u16(cpu, bus)); }
+#define SM83_INC_R16(code, r) SM83_OP(code) { SM83_SET_R16_##r(SM83_GET_R16_##r + 1); }
+#define SM83_DEC_R16(code, r) SM83_OP(code) { SM83_SET_R16_##r(SM83_GET_R16_##r - 1); }
+#define SM83_ADD_HL_R16(code, r) SM83_OP(code) { alu_add_hl(cpu, SM83_GET_R16_##r); }
+
+#define SM83_JR_CC(code, flag, value) SM83_OP(code) { if (jr_cc(cpu, bus, flag, value)) cpu->cycles += SM83_TAKEN_EXTRA(code); }
+#define SM83_JP_CC(code, flag, value) SM83_OP(code) { if (jp_cc(cpu, bus, flag, value)) cpu->cycles += SM83_TAKEN_EXTRA(code); }
+#define SM83_CALL_CC(code, flag, value) SM83_OP(code) { if (call_cc(cpu, bus, flag, value)) cpu->cycles += SM83_TAKEN_EXTRA(code); }
+#define SM83_RET_CC(code, flag, value) SM83_OP(code) { if (ret_cc(cpu, bus, flag, value)) cpu->cycles += SM83_TAKEN_EXTRA(code); }
+#define SM83_RST(code, vector) SM83_OP(code) { push_u16(cpu, bus, cpu->pc); cpu->pc = vector; }
+#define SM83_ILLEGAL(code) SM83_OP(code) { sm83_illegal(cpu, 0x##code); }
+
+#define SM83_LD_ROW(d, c0, c1, c2, c3, c4, c5, c6, c7) \
+	SM83_LD_R8_R8(c0, d, 0) SM83_LD_R8_R8(c1, d, 1) SM83_LD_R8_R8(c2, d, 2) SM83_LD_R8_R8(c3, d, 3) \
+	SM83_LD_R8_R8(c4, d, 4) SM83_LD_R8_R8(c5, d, 5) SM83_LD_R8_R8(c6, d, 6) SM83_LD_R8_R8(c7, d, 7)
+
+#define SM83_ALU_ROW(fn, c0, c1, c2, c3, c4, c5, c6, c7) \
+	SM83_ALU_R8(c0, fn, 0) SM83_ALU_R8(c1, fn, 1) SM83_ALU_R8(c2, fn, 2) SM83_ALU_R8(c3, fn, 3) \
+	SM83_ALU_R8(c4, fn, 4) SM83_ALU_R8(c5, fn, 5) SM83_ALU_R8(c6, fn, 6) SM83_ALU_R8(c7, fn, 7)
+
+// 0x00 - 0x3F
+SM83_OP(00) { } // NOP
+SM83_OP(02) { write_to_memory(bus, SM83_GET_R16_0, cpu->rA); } // LD [BC], A
+SM83_OP(12) { write_to_memory(bus, SM83_GET_R16_1, cpu->rA); } // LD [DE], A
+SM83_OP(22) { write_to_memory(bus, SM83_HL, cpu->rA); SM83_SET_R16_2(SM83_HL + 1); } // LD [HL+], A
+SM83_OP(32) { write_to_memory(bus, SM83_HL, cpu->rA); SM83_SET_R16_2(SM83_HL - 1); } // LD [HL-], A
+SM83_OP(0A) { cpu->rA = read_from_memory(bus, SM83_GET_R16_0); } // LD A, [BC]
+SM83_OP(1A) { cpu->rA = read_from_memory(bus, SM83_GET_R16_1); } // LD A, [DE]
+SM83_OP(2A) { cpu->rA = read_from_memory(bus, SM83_HL); SM83_SET_R16_2(SM83_HL + 1); } // LD A, [HL+]
+SM83_OP(3A) { cpu->rA = read_from_memory(bus, SM83_HL); SM83_SET_R16_2(SM83_HL - 1); } // LD A, [HL-]
+
+SM83_LD_R16_N16(01, 0) SM83_LD_R16_N16(11, 1) SM83_LD_R16_N16(21, 2) SM83_LD_R16_N16(31, 3)
+SM83_INC_R16(03, 0) SM83_INC_R16(13, 1) SM83_INC_R16(23, 2) SM83_INC_R16(33, 3)
+SM83_DEC_R16(0B, 0) SM83_DEC_R16(1B, 1) SM83_DEC_R16(2B, 2) SM83_DEC_R16(3B, 3)
+SM83_ADD_HL_R16(09, 0) SM83_ADD_HL_R16(19, 1) SM83_ADD_HL_R16(29, 2) SM83_ADD_HL_R16(39, 3)
+
+SM83_INC_R8(04, 0) SM83_INC_R8(0C, 1) SM83_INC_R8(14, 2) SM83_INC_R8(1C, 3)
+SM83_INC_R8(24, 4) SM83_INC_R8(2C, 5) SM83_INC_R8(34, 6) SM83_INC_R8(3C, 7)
+SM83_DEC_R8(05, 0) SM83_DEC_R8(0D, 1) SM83_DEC_R8(15, 2) SM83_DEC_R8(1D, 3)
+SM83_DEC_R8(25, 4) SM83_DEC_R8(2D, 5) SM83_DEC_R8(35, 6) SM83_DEC_R8(3D, 7)
+SM83_LD_R8_N8(06, 0) SM83_LD_R8_N8(0E, 1) SM83_LD_R8_N8(16, 2) SM83_LD_R8_N8(1E, 3)
+SM83_LD_R8_N8(26, 4) SM83_LD_R8_N8(2E, 5) SM83_LD_R8_N8(36, 6) SM83_LD_R8_N8(3E, 7)
+
+// The accumulator rotates always clear Z, a non-zero low result byte is enough for that
+SM83_OP(07) { cpu->rA = alu_rlc(cpu, cpu->rA); cpu->flag_res |= 1; } // RLCA
+SM83_OP(0F) { cpu->rA = alu_rrc(cpu, cpu->rA); cpu->flag_res |= 1; } // RRCA
+SM83_OP(17) { cpu->rA = alu_rl(cpu, cpu->rA); cpu->flag_res |= 1; } // RLA
+SM83_OP(1F) { cpu->rA = alu_rr(cpu, cpu->rA); cpu->flag_res |= 1; } // RRA
+
+SM83_OP(08) { // LD [a16], SP
+	uint16_t addr = read_next_u16(cpu, bus);
+
+	write_to_memory(bus, addr, cpu->sp & 0x00FF);
+	write_to_memory(bus, addr + 1, (cpu->sp & 0xFF00) >> 8);
+}
 
-	switch (op_code) {
-	case 0x00:
-		// NOP
-		break;
-	case 0x01:
-		// LD BC, n16
-		ld_next_u16(cpu, memory, &cpu->rC, &cpu->rB);
-		break;
-	case 0x02:
-		// LD [BC], A
-		write_to_memory(memory, bytes_to_u16(cpu->rC, cpu->rB), cpu->rA);
-		break;
-	case 0x03:
-		// INC BC
-		mod_u16_reg(&cpu->rC, &cpu->rB, 1);
-		break;
-	case 0x04:
-		// INC B
-		inc_reg(cpu, &cpu->rB);
-		break;
-	case 0x05:
-		// DEC B
-		dec_reg(cpu, &cpu->rD);
-		break;
-	case 0x06:
-		// LD B, n8
-		ld_next_byte(cpu, memory, &cpu->rB);
-		break;
-	case 0x07:
-		// TODO: refactor op codes using rotate
-		// RLCA
-		set_bit_u8(&cpu->rF, ZERO_FLAG, false);
-		set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, false);
-		set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, false);
-		set_bit_u8(&cpu->rF, CARRY_FLAG, (get_bit_u8(&cpu->rA, 7) == 1));
-		cpu->rA = cpu->rA << 1;
-		set_bit_u8(&cpu->rA, 7, (get_bit_u8(&cpu->rF, CARRY_FLAG) == 1));
-		break;
-	case 0x08:
-		// LD [a16], sp
-		uint16_t addr = bytes_to_u16(read_next_byte(cpu, memory), read_next_byte(cpu, memory));
-		write_to_memory(memory, addr, cpu->sp & 0x00FF);
-		write_to_memory(memory, addr + 1, (cpu->sp & 0xFF00) >> 8);
-		break;
-	case 0x0E:
-		// LD C, n8
-		ld_next_byte(cpu, memory, &cpu->rC);
-		break;
-	case 0x11:
-		// LD DE, n16
-		ld_next_u16(cpu, memory, &cpu->rE, &cpu->rD);
-		break;
-	case 0x12:
-		// LD [DE], A
-		write_to_memory(memory, bytes_to_u16(cpu->rE, cpu->rD), cpu->rA);
-		break;
-	case 0x13:
-		// INC DE
-		mod_u16_reg(&cpu->rE, &cpu->rD, 1);
-		break;
-	case 0x14:
-		// INC D
-		inc_reg(cpu, &cpu->rD);
-		break;
-	case 0x15:
-		// DEC D
-		dec_reg(cpu, &cpu->rD);
-		break;
-	case 0x16:
-		// LD D, n8
-		ld_next_byte(cpu, memory, &cpu->rD);
-		break;
-	case 0x17:
-		// RLA
-		set_bit_u8(&cpu->rF, ZERO_FLAG, false);
-		set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, false);
-		set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, false);
-		set_bit_u8(&cpu->rF, CARRY_FLAG, (get_bit_u8(&cpu->rA, 7) == 1));
-		cpu->rA = cpu->rA << 1;
-		set_bit_u8(&cpu->rA, 7, (get_bit_u8(&cpu->rF, CARRY_FLAG) == 1));
-		break;
-	case 0x18:
-		// JR e8
-		int8_t addr_offset = (int8_t)read_next_byte(cpu, memory);
+SM83_OP(10) { read_next_byte(cpu, bus); } // STOP, treated as a two byte NOP until there is a joypad to wake it
+SM83_OP(18) { cpu->pc += (int8_t)read_next_byte(cpu, bus); } // JR e8
+SM83_JR_CC(20, ZERO_FLAG, 0) SM83_JR_CC(28, ZERO_FLAG, 1) SM83_JR_CC(30, CARRY_FLAG, 0) SM83_JR_CC(38, CARRY_FLAG, 1)
 
-		if (addr_offset < 0) {
-			cpu->pc -= (addr_offset * -1);
-		} else {
-			cpu->pc += addr_offset;
+SM83_OP(27) { alu_daa(cpu); } // DAA
+SM83_OP(2F) { // CPL
+	cpu->rA = ~cpu->rA;
+	set_flags(cpu, sm83_flag(cpu, ZERO_FLAG), true, true, sm83_flag(cpu, CARRY_FLAG));
+}
+SM83_OP(37) { // SCF
+	set_flags(cpu, sm83_flag(cpu, ZERO_FLAG), false, false, true);
+}
+SM83_OP(3F) { // CCF
+	set_flags(cpu, sm83_flag(cpu, ZERO_FLAG), false, false, !sm83_flag(cpu, CARRY_FLAG));
+}
+
+// 0x40 - 0x7F: LD r8, r8 with HALT in place of LD [HL], [HL]
+SM83_LD_ROW(0, 40, 41, 42, 43, 44, 45, 46, 47)
+SM83_LD_ROW(1, 48, 49, 4A, 4B, 4C, 4D, 4E, 4F)
+SM83_LD_ROW(2, 50, 51, 52, 53, 54, 55, 56, 57)
+SM83_LD_ROW(3, 58, 59, 5A, 5B, 5C, 5D, 5E, 5F)
+SM83_LD_ROW(4, 60, 61, 62, 63, 64, 65, 66, 67)
+SM83_LD_ROW(5, 68, 69, 6A, 6B, 6C, 6D, 6E, 6F)
+SM83_LD_R8_R8(70, 6, 0) SM83_LD_R8_R8(71, 6, 1) SM83_LD_R8_R8(72, 6, 2) SM83_LD_R8_R8(73, 6, 3)
+SM83_LD_R8_R8(74, 6, 4) SM83_LD_R8_R8(75, 6, 5) SM83_LD_R8_R8(77, 6, 7)
+SM83_OP(76) { cpu->is_halted = true; cpu->deadline = 0; } // HALT
+SM83_LD_ROW(7, 78, 79, 7A, 7B, 7C, 7D, 7E, 7F)
+
+// 0x80 - 0xBF: ALU A, r8
+SM83_ALU_ROW(alu_add, 80, 81, 82, 83, 84, 85, 86, 87)
+SM83_ALU_ROW(alu_adc, 88, 89, 8A, 8B, 8C, 8D, 8E, 8F)
+SM83_ALU_ROW(alu_sub, 90, 91, 92, 93, 94, 95, 96, 97)
+SM83_ALU_ROW(alu_sbc, 98, 99, 9A, 9B, 9C, 9D, 9E, 9F)
+SM83_ALU_ROW(alu_and, A0, A1, A2, A3, A4, A5, A6, A7)
+SM83_ALU_ROW(alu_xor, A8, A9, AA, AB, AC, AD, AE, AF)
+SM83_ALU_ROW(alu_or, B0, B1, B2, B3, B4, B5, B6, B7)
+SM83_ALU_ROW(alu_cp, B8, B9, BA, BB, BC, BD, BE, BF)
+
+// 0xC0 - 0xFF
+SM83_ALU_N8(C6, alu_add) SM83_ALU_N8(CE, alu_adc) SM83_ALU_N8(D6, alu_sub) SM83_ALU_N8(DE, alu_sbc)
+SM83_ALU_N8(E6, alu_and) SM83_ALU_N8(EE, alu_xor) SM83_ALU_N8(F6, alu_or) SM83_ALU_N8(FE, alu_cp)
+
+SM83_RET_CC(C0, ZERO_FLAG, 0) SM83_RET_CC(C8, ZERO_FLAG, 1) SM83_RET_CC(D0, CARRY_FLAG, 0) SM83_RET_CC(D8, CARRY_FLAG, 1)
+SM83_JP_CC(C2, ZERO_FLAG, 0) SM83_JP_CC(CA, ZERO_FLAG, 1) SM83_JP_CC(D2, CARRY_FLAG, 0) SM83_JP_CC(DA, CARRY_FLAG, 1)
+SM83_CALL_CC(C4, ZERO_FLAG, 0) SM83_CALL_CC(CC, ZERO_FLAG, 1) SM83_CALL_CC(D4, CARRY_FLAG, 0) SM83_CALL_CC(DC, CARRY_FLAG, 1)
+SM83_RST(C7, 0x00) SM83_RST(CF, 0x08) SM83_RST(D7, 0x10) SM83_RST(DF, 0x18)
+SM83_RST(E7, 0x20) SM83_RST(EF, 0x28) SM83_RST(F7, 0x30) SM83_RST(FF, 0x38)
+
+SM83_OP(C1) { SM83_SET_R16_0(pop_u16(cpu, bus)); } // POP BC
+SM83_OP(D1) { SM83_SET_R16_1(pop_u16(cpu, bus)); } // POP DE
+SM83_OP(E1) { SM83_SET_R16_2(pop_u16(cpu, bus)); } // POP HL
+SM83_OP(F1) { // POP AF, low nibble of F is always 0
+	uint16_t af = pop_u16(cpu, bus);
+
+	cpu->rA = (af & 0xFF00) >> 8;
+	sm83_set_f(cpu, af & 0x00F0);
+}
+SM83_OP(C5) { push_u16(cpu, bus, SM83_GET_R16_0); } // PUSH BC
+SM83_OP(D5) { push_u16(cpu, bus, SM83_GET_R16_1); } // PUSH DE
+SM83_OP(E5) { push_u16(cpu, bus, SM83_HL); } // PUSH HL
+SM83_OP(F5) { push_u16(cpu, bus, bytes_to_u16(sm83_get_f(cpu), cpu->rA)); } // PUSH AF
+
+SM83_OP(C3) { cpu->pc = read_next_u16(cpu, bus); } // JP a16
+SM83_OP(E9) { cpu->pc = SM83_HL; } // JP HL
+SM83_OP(C9) { cpu->pc = pop_u16(cpu, bus); } // RET
+SM83_OP(D9) { cpu->pc = pop_u16(cpu, bus); cpu->ime = 1; cpu->deadline = 0; } // RETI
+SM83_OP(CD) { // CALL a16
+	uint16_t call_address = read_next_u16(cpu, bus);
+
+	push_u16(cpu, bus, cpu->pc);
+	cpu->pc = call_address;
+}
+
+
+SM83_OP(E0) { write_to_memory(bus, bytes_to_u16(read_next_byte(cpu, bus), 0xFF), cpu->rA); } // LDH [a8], A
+SM83_OP(F0) { cpu->rA = read_from_memory(bus, bytes_to_u16(read_next_byte(cpu, bus), 0xFF)); } // LDH A, [a8]
+SM83_OP(E2) { write_to_memory(bus, bytes_to_u16(cpu->rC, 0xFF), cpu->rA); } // LDH [C], A
+SM83_OP(F2) { cpu->rA = read_from_memory(bus, bytes_to_u16(cpu->rC, 0xFF)); } // LDH A, [C]
+SM83_OP(EA) { write_to_memory(bus, read_next_u16(cpu, bus), cpu->rA); } // LD [a16], A
+SM83_OP(FA) { cpu->rA = read_from_memory(bus, read_next_u16(cpu, bus)); } // LD A, [a16]
+
+SM83_OP(E8) { cpu->sp = alu_add_sp(cpu, (int8_t)read_next_byte(cpu, bus)); } // ADD SP, e8
+SM83_OP(F8) { SM83_SET_R16_2(alu_add_sp(cpu, (int8_t)read_next_byte(cpu, bus))); } // LD HL, SP + e8
+SM83_OP(F9) { cpu->sp = SM83_HL; } // LD SP, HL
+SM83_OP(F3) { cpu->ime = 0; cpu->ei_pending = false; } // DI
+SM83_OP(FB) { cpu->ei_pending = true; cpu->deadline = 0; } // EI
+
+SM83_ILLEGAL(D3) SM83_ILLEGAL(DB) SM83_ILLEGAL(DD) SM83_ILLEGAL(E3) SM83_ILLEGAL(E4) SM83_ILLEGAL(EB)
+SM83_ILLEGAL(EC) SM83_ILLEGAL(ED) SM83_ILLEGAL(F4) SM83_ILLEGAL(FC) SM83_ILLEGAL(FD)
+
+/*
+ * CB-prefixed opcodes
+ *
+ * The CB grid is fully regular: op >> 6 picks rotate/shift, BIT, RES or SET,
+ * (op >> 3) & 7 the shift kind or bit number and op & 7 the r8 operand. One
+ * always-inlined decoder is specialised into 256 handlers, sm83_cb_XX, with
+ * the opcode as a constant so every switch below folds away.
+ */
+
+SM83_ALWAYS_INLINE uint8_t sm83_get_r8 (sm83_ctx *cpu, bus_ctx *bus, uint8_t index) {
+	switch (index) {
+	case 0: return SM83_GET_R8_0;
+	case 1: return SM83_GET_R8_1;
+	case 2: return SM83_GET_R8_2;
+	case 3: return SM83_GET_R8_3;
+	case 4: return SM83_GET_R8_4;
+	case 5: return SM83_GET_R8_5;
+	case 6: return SM83_GET_R8_6;
+	default: return SM83_GET_R8_7;
+	}
+}
+
+SM83_ALWAYS_INLINE void sm83_set_r8 (sm83_ctx *cpu, bus_ctx *bus, uint8_t index, uint8_t value) {
+	switch (index) {
+	case 0: SM83_SET_R8_0(value); break;
+	case 1: SM83_SET_R8_1(value); break;
+	case 2: SM83_SET_R8_2(value); break;
+	case 3: SM83_SET_R8_3(value); break;
+	case 4: SM83_SET_R8_4(value); break;
+	case 5: SM83_SET_R8_5(value); break;
+	case 6: SM83_SET_R8_6(value); break;
+	default: SM83_SET_R8_7(value); break;
+	}
+}
+
+SM83_ALWAYS_INLINE void sm83_cb_decode (sm83_ctx *cpu, bus_ctx *bus, uint8_t op_code) {
+	uint8_t index = op_code & 7;
+	uint8_t bit = (op_code >> 3) & 7;
+	uint8_t value = sm83_get_r8(cpu, bus, index);
+
+	switch (op_code >> 6) {
+	case 0:
+		switch (bit) {
+		case 0: value = alu_rlc(cpu, value); break;
+		case 1: value = alu_rrc(cpu, value); break;
+		case 2: value = alu_rl(cpu, value); break;
+		case 3: value = alu_rr(cpu, value); break;
+		case 4: value = alu_sla(cpu, value); break;
+		case 5: value = alu_sra(cpu, value); break;
+		case 6: value = alu_swap(cpu, value); break;
+		default: value = alu_srl(cpu, value); break;
 		}
 		break;
-	case 0x20:
-		// JR NZ, e8
-		jr_cc(cpu, memory, ZERO_FLAG, 0);
-		break;
-	case 0x21:
-		// LD HL, n16
-		ld_next_u16(cpu, memory, &cpu->rL, &cpu->rH);
+	case 1:
+		// BIT only touches flags, C is left alone
+		set_flags(cpu, !get_bit_u8(&value, bit), false, true, sm83_flag(cpu, CARRY_FLAG));
+		return;
+	case 2:
+		set_bit_u8(&value, bit, false);
 		break;
-	case 0x22:
-		// LD [HL+], A
-		write_to_memory(memory, bytes_to_u16(cpu->rC, cpu->rB), cpu->rA);
-		mod_u16_reg(&cpu->rL, &cpu->rH, 1);
-		break;
-	case 0x23:
-		// INC HL
-		mod_u16_reg(&cpu->rL, &cpu->rH, 1);
-		break;
-	case 0x24:
-		// INC H
-		inc_reg(cpu, &cpu->rH);
-		break;
-	case 0x25:
-		// DEC H
-		dec_reg(cpu, &cpu->rH);
-		break;
-	case 0x26:
-		// LD H, n8
-		ld_next_byte(cpu, memory, &cpu->rH);
+	default:
+		set_bit_u8(&value, bit, true);
 		break;
-	case 0x27:
-		// DAA
-		uint8_t adjusted_val = cpu->rA;
-		if ((adjusted_val & 0xF) > 9) adjusted_val += 6;
-		if (((adjusted_val & 0xF0) >> 4) > 9) adjusted_val += 60;
+	}
 
-		cpu->rA = adjusted_val;
-		break;
-	case 0x28:
-		// JR Z, e8
-		jr_cc(cpu, memory, ZERO_FLAG, 1);
-		break;
-	case 0x31:
-		// LD SP, n16
-		cpu->sp = bytes_to_u16(read_next_byte(cpu, memory), read_next_byte(cpu, memory));
-		break;
-	case 0x32:
-		// LD [HL-], A
-		write_to_memory(memory, bytes_to_u16(cpu->rL, cpu->rH), cpu->rA);
-		mod_u16_reg(&cpu->rL, &cpu->rH, -1);
-		break;
-	case 0x33:
-		// INC SP
-		cpu->sp++;
-		break;
-	case 0x34:
-		// INC [HL]
-		mod_addr_in_hl(cpu, memory, 1);
-		break;
-	case 0x35:
-		// DEC [HL]
-		mod_addr_in_hl(cpu, memory, -1);
-		break;
-	case 0x36:
-		// LD [HL], n8
-		write_to_memory(memory, bytes_to_u16(cpu->rL, cpu->rH), read_next_byte(cpu, memory));
-		break;
-	case 0x37:
-		// SCF
-		set_bit_u8(&cpu->rF, SUBTRACTION_FLAG, false);
-		set_bit_u8(&cpu->rF, HALF_CARRY_FLAG, false);
-		set_bit_u8(&cpu->rF, CARRY_FLAG, true);
-		break;
-	case 0x38:
-		// JR C, e8
-		jr_cc(cpu, memory, CARRY_FLAG, 1);
-		break;
-	case 0x40:
-		// LD B, B
-		break;
-	case 0x41:
-		// LD B, C
-		cpu->rB = cpu->rC;
-		break;
-	case 0x42:
-		// LD B, D
-		cpu->rB = cpu->rD;
-		break;
-	case 0x43:
-		// LD B, E
-		cpu->rB = cpu->rE;
-		break;
-	case 0x44:
-		// LD B, H
-		cpu->rB = cpu->rH;
-		break;
-	case 0x45:
-		// LD B, L
-		cpu->rB = cpu->rL;
-		break;
-	case 0x46:
-		// LD B, [HL]
-		cpu->rB = read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH));
-	case 0x47:
-		// LD B, A
-		cpu->rB = cpu->rA;
-		break;
-	case 0x48:
-		// LD C, B
-		cpu->rC = cpu->rB;
-		break;
-	case 0x49:
-		// LD C, C
-		break;
-	case 0x4A:
-		// LD C, D
-		cpu->rC = cpu->rD;
-		break;
-	case 0x4B:
-		// LD C, E
-		cpu->rC = cpu->rE;
-		break;
-	case 0x4C:
-		// LD C, H
-		cpu->rC = cpu->rH;
-		break;
-	case 0x4D:
-		// LD C, L
-		cpu->rC = cpu->rL;
-		break;
-	case 0x4E:
-		// LD C, [HL]
-		cpu->rC = read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH));
-		break;
-	case 0x4F:
-		// LD C, A
-		cpu->rC = cpu->rA;
-		break;
-	case 0x50:
-		// LD D, B
-		cpu->rD = cpu->rB;
-		break;
-	case 0x51:
-		// LD D, C
-		cpu->rD = cpu->rC;
-		break;
-	case 0x52:
-		// LD D, D
-		break;
-	case 0x53:
-		// LD D, E
-		cpu->rD = cpu->rE;
-		break;
-	case 0x54:
-		// LD D, H
-		cpu->rD = cpu->rH;
-		break;
-	case 0x55:
-		// LD D, L
-		cpu->rD = cpu->rL;
-		break;
-	case 0x56:
-		// LD D, [HL]
-		cpu->rD = read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH));
-		break;
-	case 0x57:
-		// LD D, A
-		cpu->rD = cpu->rA;
-		break;
-	case 0x58:
-		// LD E, B
-		cpu->rE = cpu->rB;
-		break;
-	case 0x59:
-		// LD E, C
-		cpu->rE = cpu->rC;
-		break;
-	case 0x5A:
-		// LD E, D
-		cpu->rE = cpu->rD;
-		break;
-	case 0x5B:
-		// LD E, E
-		break;
-	case 0x5C:
-		// LD E, H
-		cpu->rE = cpu->rH;
-		break;
-	case 0x5D:
-		// LD E, L
-		cpu->rE = cpu->rL;
-		break;
-	case 0x5E:
-		// LD E, [HL]
-		cpu->rE = read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH));
-		break;
-	case 0x5F:
-		// LD E, A
-		cpu->rE = cpu->rA;
-		break;
-	case 0x60:
-		// LD H, B
-		cpu->rH = cpu->rB;
-		break;
-	case 0x61:
-		// LD H, C
-		cpu->rH = cpu->rC;
-		break;
-	case 0x62:
-		// LD H, D
-		cpu->rH = cpu->rD;
-		break;
-	case 0x63:
-		// LD H, E
-		cpu->rH = cpu->rE;
-		break;
-	case 0x64:
-		// LD H, H
-		break;
-	case 0x65:
-		// LD H, L
-		cpu->rH = cpu->rL;
-		break;
-	case 0x66:
-		// LD H, [HL]
-		cpu->rH = read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH));
-		break;
-	case 0x67:
-		// LD H, A
-		cpu->rH = cpu->rA;
-		break;
-	case 0x68:
-		// LD L, B
-		cpu->rL = cpu->rB;
-		break;
-	case 0x69:
-		// LD L, C
-		cpu->rL = cpu->rC;
-		break;
-	case 0x6A:
-		// LD L, D
-		cpu->rL = cpu->rD;
-		break;
-	case 0x6B:
-		// LD L, E
-		cpu->rL = cpu->rE;
-		break;
-	case 0x6C:
-		// LD L, H
-		cpu->rL = cpu->rH;
-		break;
-	case 0x6D:
-		// LD L, L
-		break;
-	case 0x6E:
-		// LD L, [HL]
-		cpu->rL = read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH));
-		break;
-	case 0x6F:
-		// LD L, A
-		cpu->rL = cpu->rA;
-		break;
-	case 0x70:
-		// LD [HL], B
-		write_to_memory(memory, bytes_to_u16(cpu->rL, cpu->rH), cpu->rB);
-		break;
-	case 0x71:
-		// LD [HL], C
-		write_to_memory(memory, bytes_to_u16(cpu->rL, cpu->rH), cpu->rC);
-		break;
-	case 0x72:
-		// LD [HL], D
-		write_to_memory(memory, bytes_to_u16(cpu->rL, cpu->rH), cpu->rD);
-		break;
-	case 0x73:
-		// LD [HL], E
-		write_to_memory(memory, bytes_to_u16(cpu->rL, cpu->rH), cpu->rE);
-		break;
-	case 0x74:
-		// LD [HL], H
-		write_to_memory(memory, bytes_to_u16(cpu->rL, cpu->rH), cpu->rH);
-		break;
-	case 0x75:
-		// LD [HL], L
-		write_to_memory(memory, bytes_to_u16(cpu->rL, cpu->rH), cpu->rL);
-		break;
-	case 0x76:
-		// HALT
-		cpu->is_halted = true;
-		break;
-	case 0x77:
-		// LD [HL], A
-		write_to_memory(memory, bytes_to_u16(cpu->rL, cpu->rH), cpu->rA);
-		break;
-	case 0x78:
-		// LD A, B
-		cpu->rA = cpu->rB;
-		break;
-	case 0x79:
-		// LD A, C
-		cpu->rA = cpu->rC;
-		break;
-	case 0x7A:
-		// LD A, D
-		cpu->rA = cpu->rD;
-		break;
-	case 0x7B:
-		// LD A, E
-		cpu->rA = cpu->rE;
-		break;
-	case 0x7C:
-		// LD A, H
-		cpu->rA = cpu->rH;
-		break;
-	case 0x7D:
-		// LD A, L
-		cpu->rA = cpu->rL;
-		break;
-	case 0x7E:
-		// LD A, [HL]
-		cpu->rA = read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH));
-		break;
-	case 0x7F:
-		// LD A, A
-		break;
-	case 0x80:
-		// ADD A, B
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rB);
-		break;
-	case 0x81:
-		// ADD A, C
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rC);
-		break;
-	case 0x82:
-		// ADD A, D
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rD);
-		break;
-	case 0x83:
-		// ADD A, E
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rE);
-		break;
-	case 0x84:
-		// ADD A, H
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rH);
-		break;
-	case 0x85:
-		// ADD A, L
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rL);
-		break;
-	case 0x86:
-		// ADD A, [HL]
-		cpu->rA = alu_add(cpu, cpu->rA, read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH)));
-		break;
-	case 0x87:
-		// ADD A, A
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rA);
-		break;
-	case 0x88:
-		// ADC A, B
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rB + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x89:
-		// ADC A, C
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rC + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x8A:
-		// ADC A, D
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rD + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x8B:
-		// ADC A, E
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rE + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x8C:
-		// ADC A, H
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rH + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x8D:
-		// ADC A, L
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rL + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x8E:
-		// ADC A, [HL]
-		cpu->rA = alu_add(cpu, cpu->rA,
-			read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH)) +
-			get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x8F:
-		// ADC A, A
-		cpu->rA = alu_add(cpu, cpu->rA, cpu->rA + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x90:
-		// SUB A, B
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rB);
-		break;
-	case 0x91:
-		// SUB A, C
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rC);
-		break;
-	case 0x92:
-		// SUB A, D
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rD);
-		break;
-	case 0x93:
-		// SUB A, E
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rE);
-		break;
-	case 0x94:
-		// SUB A, H
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rH);
-		break;
-	case 0x95:
-		// SUB A, L
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rL);
-		break;
-	case 0x96:
-		// SUB A, [HL]
-		cpu->rA = alu_sub(cpu, cpu->rA,
-			read_from_memory(memory, read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH))));
-		break;
-	case 0x97:
-		// SUB A, A
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rA);
-		break;
-	case 0x98:
-		// SBC A, B (a - b - c = a - (b + c); Thank you distributive property)
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rB + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x99:
-		// SBC A, C
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rC + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x9A:
-		// SBC A, D
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rD + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x9B:
-		// SBC A, E
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rE + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x9C:
-		// SBC A, H
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rH + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x9D:
-		// SBC A, L
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rL + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x9E:
-		// SBC A, [HL]
-		cpu->rA = alu_sub(cpu, cpu->rA,
-			read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH)) +
-			get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0x9F:
-		// SBC A, A
-		cpu->rA = alu_sub(cpu, cpu->rA, cpu->rA + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0xA0:
-		// AND A, B
-		cpu->rA = alu_and(cpu, cpu->rA, cpu->rB);
-		break;
-	case 0xA1:
-		// AND A, C
-		cpu->rA = alu_and(cpu, cpu->rA, cpu->rC);
-		break;
-	case 0xA2:
-		// AND A, D
-		cpu->rA = alu_and(cpu, cpu->rA, cpu->rD);
-		break;
-	case 0xA3:
-		// AND A, E
-		cpu->rA = alu_and(cpu, cpu->rA, cpu->rE);
-		break;
-	case 0xA4:
-		// AND A, H
-		cpu->rA = alu_and(cpu, cpu->rA, cpu->rH);
-		break;
-	case 0xA5:
-		// AND A, L
-		cpu->rA = alu_and(cpu, cpu->rA, cpu->rL);
-		break;
-	case 0xA6:
-		// AND A, [HL]
-		cpu->rA = alu_and(cpu, cpu->rA, read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH)));
-		break;
-	case 0xA7:
-		// AND A, A
-		cpu->rA = alu_and(cpu, cpu->rA, cpu->rB);
-		break;
-	case 0xA8:
-		// XOR A, B
-		cpu->rA = alu_xor(cpu, cpu->rA, cpu->rB);
-		break;
-	case 0xA9:
-		// XOR A, C
-		cpu->rA = alu_xor(cpu, cpu->rA, cpu->rC);
-		break;
-	case 0xAA:
-		// XOR A, D
-		cpu->rA = alu_xor(cpu, cpu->rA, cpu->rD);
-		break;
-	case 0xAB:
-		// XOR A, E
-		cpu->rA = alu_xor(cpu, cpu->rA, cpu->rE);
-		break;
-	case 0xAC:
-		// XOR A, H
-		cpu->rA = alu_xor(cpu, cpu->rA, cpu->rH);
-		break;
-	case 0xAD:
-		// XOR A, L
-		cpu->rA = alu_xor(cpu, cpu->rA, cpu->rL);
-		break;
-	case 0xAE:
-		// XOR A, [HL]
-		cpu->rA = alu_xor(cpu, cpu->rA, read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH)));
-		break;
-	case 0xAF:
-		// XOR A, A (Clear accumulator)
-		cpu->rA = alu_xor(cpu, cpu->rA, cpu->rA);
-		break;
-	case 0xB0:
-		// OR A, B
-		cpu->rA = alu_or(cpu, cpu->rA, cpu->rB);
-		break;
-	case 0xB1:
-		// OR A, C
-		cpu->rA = alu_or(cpu, cpu->rA, cpu->rC);
-		break;
-	case 0xB2:
-		// OR A, D
-		cpu->rA = alu_or(cpu, cpu->rA, cpu->rD);
-		break;
-	case 0xB3:
-		// OR A, E
-		cpu->rA = alu_or(cpu, cpu->rA, cpu->rE);
-		break;
-	case 0xB4:
-		// OR A, H
-		cpu->rA = alu_or(cpu, cpu->rA, cpu->rH);
-		break;
-	case 0xB5:
-		// OR A, L
-		cpu->rA = alu_or(cpu, cpu->rA, cpu->rL);
-		break;
-	case 0xB6:
-		// OR A, [HL]
-		cpu->rA = alu_or(cpu, cpu->rA, read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH)));
-		break;
-	case 0xB7:
-		// OR A, A
-		cpu->rA = alu_or(cpu, cpu->rA, cpu->rA);
-		break;
-	case 0xB8:
-		// CP A, B
-		alu_sub(cpu, cpu->rA, cpu->rB);
-		break;
-	case 0xB9:
-		// CP A, C
-		alu_sub(cpu, cpu->rA, cpu->rC);
-		break;
-	case 0xBA:
-		// CP A, D
-		alu_sub(cpu, cpu->rA, cpu->rD);
-		break;
-	case 0xBB:
-		// CP A, E
-		alu_sub(cpu, cpu->rA, cpu->rE);
-		break;
-	case 0xBC:
-		// CP A, H
-		alu_sub(cpu, cpu->rA, cpu->rH);
-		break;
-	case 0xBD:
-		// CP A, L
-		alu_sub(cpu, cpu->rA, cpu->rL);
-		break;
-	case 0xBE:
-		// CP A, [HL]
-		alu_sub(cpu, cpu->rA, read_from_memory(memory, bytes_to_u16(cpu->rL, cpu->rH)));
-		break;
-	case 0xBF:
-		// CP A, A
-		alu_sub(cpu, cpu->rA, cpu->rA);
-		break;
-	case 0xC0:
-		// RET NZ
-		ret_cc(cpu, memory, ZERO_FLAG, 0);
-		break;
-	case 0xC1:
-		// POP BC
-		pop_r16(cpu, memory, &cpu->rB, &cpu->rC);
-		break;
-	case 0xC2:
-		// JP NZ, a16
-		jp_cc(cpu, memory, ZERO_FLAG, 0);
-		break;
-	case 0xC3:
-		// JP a16
-		cpu->pc = bytes_to_u16(read_next_byte(cpu, memory), read_next_byte(cpu, memory));
-		break;
-	case 0xC4:
-		// CALL NZ, a16
-		call_cc(cpu, memory, ZERO_FLAG, 0);
-		break;
-	case 0xC5:
-		// PUSH BC
-		push_r16(cpu, memory, cpu->rB, cpu->rC);
-		break;
-	case 0xC6:
-		// ADD A, n8
-		cpu->rA = alu_add(cpu, cpu->rA, read_next_byte(cpu, memory));
-		break;
-	case 0xC7:
-		// RST $00
-		push_u16(cpu, memory, cpu->pc);
-		cpu->pc = 0x00;
-		break;
-	case 0xC8:
-		// RET Z
-		ret_cc(cpu, memory, ZERO_FLAG, 1);
-		break;
-	case 0xC9:
-		// RET
-		cpu->pc = bytes_to_u16(
-			read_from_memory(memory, cpu->sp++),
-			read_from_memory(memory, cpu->sp++));
-		break;
-	case 0xCA:
-		// JP Z, a16
-		jp_cc(cpu, memory, ZERO_FLAG, 1);
-		break;
-	case 0xCB:
-		// PREFIX (this is going to be another table of joy to work out later)
-		break;
-	case 0xCC:
-		// CALL Z, a16
-		call_cc(cpu, memory, ZERO_FLAG, 1);
-		break;
-	case 0xCD:
-		// CALL a16
-		uint8_t l_byte = read_next_byte(cpu, memory);
-		uint8_t h_byte = read_next_byte(cpu, memory);
+	sm83_set_r8(cpu, bus, index, value);
+}
 
-		cpu->sp--;
-		write_to_memory(memory, cpu->sp, l_byte);
+#define SM83_CB_OP(code) static inline void sm83_cb_##code (sm83_ctx *cpu, bus_ctx *bus) { sm83_cb_decode(cpu, bus, 0x##code); }
+
+/*
+ * Dispatch
+ *
+ * Three dispatchers are built from the handlers above. The build picks the one
+ * used by next_instruction/sm83_run with SM83_DISPATCH_TABLE or
+ * SM83_DISPATCH_THREADED (switch otherwise), the others stay available to the
+ * dispatch benchmark.
+ */
+
+// X is expanded for every opcode, P for the 0xCB prefix so each dispatcher can chain into its CB grid
+#define SM83_OPCODE_GRID(X, P) \
+	X(00) X(01) X(02) X(03) X(04) X(05) X(06) X(07) X(08) X(09) X(0A) X(0B) X(0C) X(0D) X(0E) X(0F) \
+	X(10) X(11) X(12) X(13) X(14) X(15) X(16) X(17) X(18) X(19) X(1A) X(1B) X(1C) X(1D) X(1E) X(1F) \
+	X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(2A) X(2B) X(2C) X(2D) X(2E) X(2F) \
+	X(30) X(31) X(32) X(33) X(34) X(35) X(36) X(37) X(38) X(39) X(3A) X(3B) X(3C) X(3D) X(3E) X(3F) \
+	X(40) X(41) X(42) X(43) X(44) X(45) X(46) X(47) X(48) X(49) X(4A) X(4B) X(4C) X(4D) X(4E) X(4F) \
+	X(50) X(51) X(52) X(53) X(54) X(55) X(56) X(57) X(58) X(59) X(5A) X(5B) X(5C) X(5D) X(5E) X(5F) \
+	X(60) X(61) X(62) X(63) X(64) X(65) X(66) X(67) X(68) X(69) X(6A) X(6B) X(6C) X(6D) X(6E) X(6F) \
+	X(70) X(71) X(72) X(73) X(74) X(75) X(76) X(77) X(78) X(79) X(7A) X(7B) X(7C) X(7D) X(7E) X(7F) \
+	X(80) X(81) X(82) X(83) X(84) X(85) X(86) X(87) X(88) X(89) X(8A) X(8B) X(8C) X(8D) X(8E) X(8F) \
+	X(90) X(91) X(92) X(93) X(94) X(95) X(96) X(97) X(98) X(99) X(9A) X(9B) X(9C) X(9D) X(9E) X(9F) \
+	X(A0) X(A1) X(A2) X(A3) X(A4) X(A5) X(A6) X(A7) X(A8) X(A9) X(AA) X(AB) X(AC) X(AD) X(AE) X(AF) \
+	X(B0) X(B1) X(B2) X(B3) X(B4) X(B5) X(B6) X(B7) X(B8) X(B9) X(BA) X(BB) X(BC) X(BD) X(BE) X(BF) \
+	X(C0) X(C1) X(C2) X(C3) X(C4) X(C5) X(C6) X(C7) X(C8) X(C9) X(CA) P(CB) X(CC) X(CD) X(CE) X(CF) \
+	X(D0) X(D1) X(D2) X(D3) X(D4) X(D5) X(D6) X(D7) X(D8) X(D9) X(DA) X(DB) X(DC) X(DD) X(DE) X(DF) \
+	X(E0) X(E1) X(E2) X(E3) X(E4) X(E5) X(E6) X(E7) X(E8) X(E9) X(EA) X(EB) X(EC) X(ED) X(EE) X(EF) \
+	X(F0) X(F1) X(F2) X(F3) X(F4) X(F5) X(F6) X(F7) X(F8) X(F9) X(FA) X(FB) X(FC) X(FD) X(FE) X(FF)
+
+SM83_OPCODE_GRID(SM83_CB_OP, SM83_CB_OP)
+
+typedef void (*sm83_handler) (sm83_ctx *cpu, bus_ctx *bus);
+
+#define SM83_TABLE_ENTRY(code) sm83_op_##code,
+#define SM83_TABLE_CB_ENTRY(code) sm83_cb_##code,
+
+static const sm83_handler sm83_cb_table[256] = { SM83_OPCODE_GRID(SM83_TABLE_CB_ENTRY, SM83_TABLE_CB_ENTRY) };
+
+SM83_OP(CB) { // PREFIX
+	uint8_t op_code = read_next_byte(cpu, bus);
+
+	sm83_cb_table[op_code](cpu, bus);
+	cpu->cycles += sm83_cb_cycles[op_code];
+}
 
-		cpu->sp--;
-		write_to_memory(memory, cpu->sp, h_byte);
+static const sm83_handler sm83_op_table[256] = { SM83_OPCODE_GRID(SM83_TABLE_ENTRY, SM83_TABLE_ENTRY) };
 
-		cpu->pc = bytes_to_u16(l_byte, h_byte);
-		break;
-	case 0xCE:
-		// ADC A, n8
-		cpu->rA = alu_add(cpu, cpu->rA,
-			read_next_byte(cpu, memory) + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0xCF:
-		// RST $08
-		push_u16(cpu, memory, cpu->pc);
-		cpu->pc = 0x08;
-		break;
-	case 0xD0:
-		// RET NC
-		ret_cc(cpu, memory, CARRY_FLAG, 0);
-		break;
-	case 0xD1:
-		// POP DE
-		pop_r16(cpu, memory, &cpu->rD, &cpu->rE);
-		break;
-	case 0xD2:
-		// JP NC, a16
-		jp_cc(cpu, memory, CARRY_FLAG, 0);
-		break;
-	case 0xD4:
-		// CALL NC, a16
-		call_cc(cpu, memory, CARRY_FLAG, 0);
-		break;
-	case 0xD5:
-		// PUSH DE
-		push_r16(cpu, memory, cpu->rD, cpu->rE);
-		break;
-	case 0xD6:
-		// SUB A, n8
-		cpu->rA = alu_sub(cpu, cpu->rA, read_next_byte(cpu, memory));
-		break;
-	case 0xD7:
-		// RST $10
-		push_u16(cpu, memory, cpu->pc);
-		cpu->pc = 0x10;
-		break;
-	case 0xD8:
-		// RET C
-		ret_cc(cpu, memory, CARRY_FLAG, 1);
-		break;
-	case 0xD9:
-		// RETI
-		cpu->pc = bytes_to_u16(
-			read_from_memory(memory, cpu->sp++),
-			read_from_memory(memory, cpu->sp++));
-		
-		cpu->ime = 1;
-		break;
-	case 0xDA:
-		// JP C, a16
-		jp_cc(cpu, memory, CARRY_FLAG, 1);
-		break;
-	case 0xDC:
-		// CALL C, a16
-		call_cc(cpu, memory, CARRY_FLAG, 1);
-		break;
-	case 0xDE:
-		// SBC A, n8
-		cpu->rA = alu_sub(cpu, 
-			cpu->rA, read_next_byte(cpu, memory) + get_bit_u8(&cpu->rF, CARRY_FLAG));
-		break;
-	case 0xDF:
-		// RST $18
-		push_u16(cpu, memory, cpu->pc);
-		cpu->pc = 0x18;
-		break;
-	case 0xE0:
-		// LDH [a8], A
-		write_to_memory(memory, bytes_to_u16(read_next_byte(cpu, memory), 0xFF), cpu->rA);
-		break;
-	case 0xE1:
-		// POP HL
-		pop_r16(cpu, memory, &cpu->rH, &cpu->rL);
-		break;
-	case 0xE2:
-		// LDH [C], A
-		write_to_memory(memory, bytes_to_u16(cpu->rC, 0xFF), cpu->rA);
-		break;
-	case 0xE5:
-		// PUSH HL
-		push_r16(cpu, memory, cpu->rH, cpu->rL);
-		break;
-	case 0xE6:
-		// AND A, n8
-		cpu->rA = alu_add(cpu, cpu->rA, read_next_byte(cpu, memory));
-		break;
-	case 0xE7:
-		// RST $20
-		push_u16(cpu, memory, cpu->pc);
-		cpu->pc = 0x20;
-		break;
-	// Can't wait to get to the chaos that is 0xE8
-	case 0xE9:
-		// JP HL
-		cpu->pc = bytes_to_u16(cpu->rL, cpu->rH);
-		break;
-	case 0xEA:
-		// LD [a16], A
-		write_to_memory(memory,
-			bytes_to_u16(read_next_byte(cpu, memory), read_next_byte(cpu, memory)), cpu->rA);
-		break;
-	case 0xEE:
-		// XOR A, n8
-		cpu->rA = alu_xor(cpu, cpu->rA, read_next_byte(cpu, memory));
-		break;
-	case 0xEF:
-		// RST $28
-		push_u16(cpu, memory, cpu->pc);
-		cpu->pc = 0x28;
-		break;
-	case 0xF0:
-		// LDH A, [a8]
-		cpu->rA = read_from_memory(memory, bytes_to_u16(read_next_byte(cpu, memory), 0xFF));
-		break;
-	case 0xF1:
-		// POP AF
-		pop_r16(cpu, memory, &cpu->rA, &cpu->rF);
-		break;
-	case 0xF2:
-		// LDH A, [C]
-		cpu->rA = read_from_memory(memory, bytes_to_u16(cpu->rC, 0xFF));
-		break;
-	case 0xF3:
-		// DI
-		cpu->ime = 0;
-		break;
-	case 0xF5:
-		// PUSH AF
-		push_r16(cpu, memory, cpu->rA, cpu->rF);
-		break;
-	case 0xF6:
-		// OR A, n8
-		cpu->rA = alu_or(cpu, cpu->rA, read_next_byte(cpu, memory));
-		break;
-	case 0xF7:
-		// RST $30
-		push_u16(cpu, memory, cpu->pc);
-		cpu->pc = 0x30;
-		break;
-	case 0xF9:
-		// LD SP, HL
-		cpu->sp = bytes_to_u16(cpu->rL, cpu->rH);
-		break;
-	case 0xFA:
-		// LD A, [a16]
-		cpu->rA = read_from_memory(memory,
-			bytes_to_u16(read_next_byte(cpu, memory), read_next_byte(cpu, memory)));
-		break;
-	case 0xFB:
-		// EI
+#define SM83_SWITCH_CASE(code) case 0x##code: sm83_op_##code(cpu, bus); break;
+#define SM83_SWITCH_CB_CASE(code) case 0x##code: sm83_cb_##code(cpu, bus); break;
+
+#define SM83_SWITCH_PREFIX(code) case 0x##code: sm83_prefix_switch(cpu, bus); break;
+
+// The switch dispatcher gets a nested switch for the CB grid instead of going through the CB table
+SM83_ALWAYS_INLINE void sm83_prefix_switch (sm83_ctx *cpu, bus_ctx *bus) {
+	uint8_t op_code = read_next_byte(cpu, bus);
+
+	switch (op_code) {
+	SM83_OPCODE_GRID(SM83_SWITCH_CB_CASE, SM83_SWITCH_CB_CASE)
+	}
+
+	cpu->cycles += sm83_cb_cycles[op_code];
+}
+
+static inline uint8_t sm83_step_switch (sm83_ctx *cpu, bus_ctx *bus) {
+	uint8_t op_code = read_next_byte(cpu, bus);
+
+	switch (op_code) {
+	SM83_OPCODE_GRID(SM83_SWITCH_CASE, SM83_SWITCH_PREFIX)
+	}
+
+	cpu->cycles += sm83_op_cycles[op_code];
+
+	return op_code;
+}
+
+static inline uint8_t sm83_step_table (sm83_ctx *cpu, bus_ctx *bus) {
+	uint8_t op_code = read_next_byte(cpu, bus);
+
+	sm83_op_table[op_code](cpu, bus);
+	cpu->cycles += sm83_op_cycles[op_code];
+
+	return op_code;
+}
+
+static inline void sm83_run_switch (sm83_ctx *cpu, bus_ctx *bus) {
+	while (cpu->is_running && cpu->cycles < cpu->deadline) {
+		sm83_step_switch(cpu, bus);
+	}
+}
+
+static inline void sm83_run_table (sm83_ctx *cpu, bus_ctx *bus) {
+	while (cpu->is_running && cpu->cycles < cpu->deadline) {
+		sm83_step_table(cpu, bus);
+	}
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SM83_HAS_THREADED 1
+
+#define SM83_LABEL_ADDR(code) &&op_##code,
+#define SM83_CB_LABEL_ADDR(code) &&cb_##code,
+
+// Every handler ends in its own indirect jump so each opcode gets its own branch history
+#define SM83_THREADED_DISPATCH() \
+	if (!cpu->is_running || cpu->cycles >= cpu->deadline) return; \
+	goto *labels[read_next_byte(cpu, bus)];
+
+#define SM83_THREADED_LABEL(code) \
+	op_##code: \
+	sm83_op_##code(cpu, bus); \
+	cpu->cycles += sm83_op_cycles[0x##code]; \
+	SM83_THREADED_DISPATCH()
+
+#define SM83_THREADED_PREFIX(code) \
+	op_##code: \
+	goto *cb_labels[read_next_byte(cpu, bus)];
+
+#define SM83_THREADED_CB_LABEL(code) \
+	cb_##code: \
+	sm83_cb_##code(cpu, bus); \
+	cpu->cycles += sm83_op_cycles[0xCB] + sm83_cb_cycles[0x##code]; \
+	SM83_THREADED_DISPATCH()
+
+static inline void sm83_run_threaded (sm83_ctx *cpu, bus_ctx *bus) {
+	static void *const labels[256] = { SM83_OPCODE_GRID(SM83_LABEL_ADDR, SM83_LABEL_ADDR) };
+	static void *const cb_labels[256] = { SM83_OPCODE_GRID(SM83_CB_LABEL_ADDR, SM83_CB_LABEL_ADDR) };
+
+	SM83_THREADED_DISPATCH()
+	SM83_OPCODE_GRID(SM83_THREADED_LABEL, SM83_THREADED_PREFIX)
+	SM83_OPCODE_GRID(SM83_THREADED_CB_LABEL, SM83_THREADED_CB_LABEL)
+}
+#endif
+
+#if defined(SM83_DISPATCH_THREADED) && defined(SM83_HAS_THREADED)
+#define SM83_DISPATCH_NAME "threaded"
+#elif defined(SM83_DISPATCH_TABLE)
+#define SM83_DISPATCH_NAME "table"
+#else
+#define SM83_DISPATCH_NAME "switch"
+#endif
+
+static inline uint8_t next_instruction (sm83_ctx *cpu, bus_ctx *bus) {
+#if defined(SM83_DISPATCH_TABLE)
+	return sm83_step_table(cpu, bus);
+#else
+	return sm83_step_switch(cpu, bus);
+#endif
+}
+
+// Executes instructions until the cycle counter reaches until or the CPU stops
+static inline void sm83_run (sm83_ctx *cpu, bus_ctx *bus, uint64_t until) {
+	cpu->deadline = until;
+
+#if defined(SM83_DISPATCH_THREADED) && defined(SM83_HAS_THREADED)
+	sm83_run_threaded(cpu, bus);
+#elif defined(SM83_DISPATCH_TABLE)
+	sm83_run_table(cpu, bus);
+#else
+	sm83_run_switch(cpu, bus);
+#endif
+}
+
+// A pending interrupt always ends HALT, it is only dispatched when IME is set
+static inline bool sm83_service_interrupts (sm83_ctx *cpu, bus_ctx *bus) {
+	uint8_t pending = bus->ie & bus->io[IF_ADDR - IO_ADDR] & INTERRUPT_MASK;
+
+	if (pending == 0)
+		return false;
+
+	cpu->is_halted = false;
+
+	if (!cpu->ime)
+		return false;
+
+	for (uint8_t bit = 0; bit < 5; bit++) {
+		if (pending & (1 << bit)) {
+			bus->io[IF_ADDR - IO_ADDR] &= ~(1 << bit);
+			cpu->ime = 0;
+			push_u16(cpu, bus, cpu->pc);
+			cpu->pc = 0x0040 + bit * 8;
+			cpu->cycles += SM83_INTERRUPT_CYCLES;
+			break;
+		}
+	}
+
+	return true;
+}
+
+// A single instruction, completing an EI from the previous one unless this one was DI
+static inline uint8_t sm83_step (sm83_ctx *cpu, bus_ctx *bus) {
+	bool enable = cpu->ei_pending;
+	uint8_t op_code = next_instruction(cpu, bus);
+
+	if (enable && cpu->ei_pending) {
 		cpu->ime = 1;
-		break;
-	case 0xFE:
-		// CP A, n8
-		alu_sub(cpu, cpu->rA, read_next_byte(cpu, memory));
-		break;
-	case 0xFF:
-		// RST $38
-		push_u16(cpu, memory, cpu->pc);
-		cpu->pc = 0x38;
-		break;
-	default:
-		cpu->is_running = false;
-		printf("Was unable to process instruction 0x%02X\n", op_code);
-		break;
+		cpu->ei_pending = false;
 	}
 
 	return op_code;
+}
+
+// One instruction for the debugger and headless stop checks, any events it made due fire afterwards
+static inline uint8_t sm83_step_scheduled (sm83_ctx *cpu, bus_ctx *bus, scheduler_ctx *sched) {
+	uint8_t op_code = 0;
+
+	if (sm83_service_interrupts(cpu, bus)) {
+		op_code = read_from_memory(bus, cpu->pc);
+	} else if (cpu->is_halted) {
+		uint64_t next = scheduler_next(sched);
+
+		// Halted, the next event is the first thing that can wake the CPU
+		cpu->cycles = next != SCHED_NEVER && next > cpu->cycles ? next : cpu->cycles + SM83_HALT_STEP_CYCLES;
+	} else {
+		op_code = sm83_step(cpu, bus);
+	}
+
+	if (cpu->cycles >= scheduler_next(sched))
+		scheduler_run_due(sched, cpu->cycles);
+
+	return op_code;
+}
+
+// Runs uninterrupted up to the next event deadline, fires what is due, and repeats until until.
+// Interrupts are checked between runs, anything that can raise one ends the run early
+static inline void sm83_run_scheduled (sm83_ctx *cpu, bus_ctx *bus, scheduler_ctx *sched, uint64_t until) {
+	sched->horizon = &cpu->deadline;
+	bus->interrupt_horizon = &cpu->deadline;
+
+	while (cpu->is_running && cpu->cycles < until) {
+		uint64_t next = scheduler_next(sched);
+		uint64_t stop = next < until ? next : until;
+
+		if (sm83_service_interrupts(cpu, bus)) {
+			// Dispatched, the handler starts on the next pass
+		} else if (cpu->is_halted) {
+			// Nothing but an event can raise an interrupt while halted, skip straight to it
+			if (stop > cpu->cycles)
+				cpu->cycles = stop;
+		} else if (cpu->ei_pending) {
+			sm83_step(cpu, bus);
+		} else {
+			sm83_run(cpu, bus, stop);
+		}
+
+		scheduler_run_due(sched, cpu->cycles);
+	}
+
+	sched->horizon = NULL;
+	bus->interrupt_horizon = NULL;
 }
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include "test.h"
+
+#define FLAG_Z 0x80
+#define FLAG_C 0x10
+
+typedef struct {
+    const char *name;
+    uint8_t code[3];
+    uint8_t f;
+    uint8_t cycles;
+} cycle_case;
+
+// T-cycles from the Pan Docs opcode tables, conditional ones both taken and not
+static const cycle_case cycle_cases[] = {
+    { "NOP", { 0x00 }, 0, 4 },
+    { "LD BC,d16", { 0x01, 0x34, 0x12 }, 0, 12 },
+    { "LD (a16),SP", { 0x08, 0x00, 0xC0 }, 0, 20 },
+    { "LD A,(HL)", { 0x7E }, 0, 8 },
+    { "LD (HL),d8", { 0x36, 0x55 }, 0, 12 },
+    { "INC (HL)", { 0x34 }, 0, 12 },
+    { "LDH (a8),A", { 0xE0, 0x80 }, 0, 12 },
+    { "LD (a16),A", { 0xEA, 0x00, 0xC0 }, 0, 16 },
+    { "ADD SP,e", { 0xE8, 0x01 }, 0, 16 },
+    { "LD HL,SP+e", { 0xF8, 0x01 }, 0, 12 },
+    { "PUSH BC", { 0xC5 }, 0, 16 },
+    { "POP BC", { 0xC1 }, 0, 12 },
+    { "JR e", { 0x18, 0x00 }, 0, 12 },
+    { "JR NZ taken", { 0x20, 0x00 }, 0, 12 },
+    { "JR NZ not taken", { 0x20, 0x00 }, FLAG_Z, 8 },
+    { "JP a16", { 0xC3, 0x50, 0x01 }, 0, 16 },
+    { "JP C taken", { 0xDA, 0x50, 0x01 }, FLAG_C, 16 },
+    { "JP C not taken", { 0xDA, 0x50, 0x01 }, 0, 12 },
+    { "JP (HL)", { 0xE9 }, 0, 4 },
+    { "CALL a16", { 0xCD, 0x00, 0x02 }, 0, 24 },
+    { "CALL Z taken", { 0xCC, 0x00, 0x02 }, FLAG_Z, 24 },
+    { "CALL Z not taken", { 0xCC, 0x00, 0x02 }, 0, 12 },
+    { "RET", { 0xC9 }, 0, 16 },
+    { "RET Z taken", { 0xC8 }, FLAG_Z, 20 },
+    { "RET Z not taken", { 0xC8 }, 0, 8 },
+    { "RETI", { 0xD9 }, 0, 16 },
+    { "RST 38", { 0xFF }, 0, 16 },
+    { "DI", { 0xF3 }, 0, 4 },
+    { "RL C", { 0xCB, 0x11 }, 0, 8 },
+    { "BIT 0,(HL)", { 0xCB, 0x46 }, 0, 12 },
+    { "RLC (HL)", { 0xCB, 0x06 }, 0, 16 },
+    { "SET 0,(HL)", { 0xCB, 0xC6 }, 0, 16 },
+};
+
+static uint8_t rom[TEST_ROM_SIZE];
+
+// One instruction at a time, each from a fresh machine with HL and SP pointing into WRAM
+static void test_opcode_cycles (void) {
+    for (size_t i = 0; i < sizeof(cycle_cases) / sizeof(cycle_cases[0]); i++) {
+        const cycle_case *c = &cycle_cases[i];
+        gb_machine *gb;
+        uint64_t start;
+
+        test_rom(rom, c->code, sizeof(c->code));
+        gb = machine_create(rom, sizeof(rom));
+
+        gb->cpu.pc = TEST_CODE_ADDR;
+        gb->cpu.rH = 0xC0;
+        gb->cpu.rL = 0x00;
+        gb->cpu.sp = 0xC100;
+        sm83_set_f(&gb->cpu, c->f);
+
+        start = gb->cpu.cycles;
+        machine_step(gb);
+
+        if (gb->cpu.cycles - start != c->cycles) {
+            fprintf(stderr, "%s took %llu cycles, expected %d\n", c->name, (unsigned long long)(gb->cpu.cycles - start), c->cycles);
+            test_failures++;
+        }
+
+        machine_destroy(gb);
+    }
+}
+
+// A loop mixing ALU, memory, branches and CB ops
+static const uint8_t mix[] = {
+    0x21, 0x00, 0xC0, // 0150: LD HL, 0xC000
+    0x31, 0x00, 0xD0, // 0153: LD SP, 0xD000
+    0x06, 0x10,       // 0156: LD B, 16
+    0x22,             // 0158: LD [HL+], A
+    0x86,             // 0159: ADD A, [HL]
+    0xCB, 0x1F,       // 015A: RR A
+    0xCB, 0x46,       // 015C: BIT 0, [HL]
+    0xC5,             // 015E: PUSH BC
+    0xCD, 0x70, 0x01, // 015F: CALL 0x0170
+    0xC1,             // 0162: POP BC
+    0x05,             // 0163: DEC B
+    0x20, 0xF2,       // 0164: JR NZ, 0x0158
+    0x18, 0xE8,       // 0166: JR 0x0150
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0x3C,             // 0170: INC A
+    0xC8,             // 0171: RET Z
+    0xD8,             // 0172: RET C
+    0xC9              // 0173: RET
+};
+
+// The configured dispatcher and single stepping have to land on the same cycle in the same state
+static void test_dispatch_matches_step (void) {
+    gb_machine *run;
+    gb_machine *step;
+
+    test_rom(rom, mix, sizeof(mix));
+    run = machine_create(rom, sizeof(rom));
+    step = machine_create(rom, sizeof(rom));
+
+    machine_run(run, 100000);
+
+    while (step->cpu.cycles < run->cpu.cycles)
+        machine_step(step);
+
+    CHECK_EQ(step->cpu.cycles, run->cpu.cycles);
+    CHECK_EQ(step->cpu.pc, run->cpu.pc);
+    CHECK_EQ(step->cpu.rA, run->cpu.rA);
+    CHECK_EQ(step->cpu.rB, run->cpu.rB);
+    CHECK_EQ(sm83_get_f(&step->cpu), sm83_get_f(&run->cpu));
+    CHECK(memcmp(step->bus.wram, run->bus.wram, WRAM_SIZE) == 0);
+
+    machine_destroy(run);
+    machine_destroy(step);
+}
+
+int main (void) {
+    test_opcode_cycles();
+    test_dispatch_matches_step();
+
+    return test_result("cycles");
+}
\ No newline at end of file
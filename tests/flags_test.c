@@ -0,0 +1,180 @@
+#include "test.h"
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+typedef enum {
+    ALU_ADD,
+    ALU_ADC,
+    ALU_SUB,
+    ALU_SBC,
+    ALU_AND,
+    ALU_XOR,
+    ALU_OR,
+    ALU_CP
+} alu_op;
+
+static uint8_t rom[TEST_ROM_SIZE];
+
+// Eager reference for the A,r block, F computed straight from the operands the way the hardware does
+static uint8_t alu_reference (alu_op op, uint8_t a, uint8_t b, bool carry, uint8_t *f) {
+    int cin = (op == ALU_ADC || op == ALU_SBC) && carry;
+    int r;
+
+    switch (op) {
+    case ALU_ADD:
+    case ALU_ADC:
+        r = a + b + cin;
+        *f = ((r & 0xFF) == 0 ? FLAG_Z : 0) | ((a & 0xF) + (b & 0xF) + cin > 0xF ? FLAG_H : 0) | (r > 0xFF ? FLAG_C : 0);
+        return (uint8_t)r;
+    case ALU_SUB:
+    case ALU_SBC:
+    case ALU_CP:
+        r = a - b - cin;
+        *f = ((r & 0xFF) == 0 ? FLAG_Z : 0) | FLAG_N | ((a & 0xF) - (b & 0xF) - cin < 0 ? FLAG_H : 0) | (r < 0 ? FLAG_C : 0);
+        return op == ALU_CP ? a : (uint8_t)r;
+    case ALU_AND:
+        r = a & b;
+        *f = (r == 0 ? FLAG_Z : 0) | FLAG_H;
+        return (uint8_t)r;
+    case ALU_XOR:
+        r = a ^ b;
+        *f = r == 0 ? FLAG_Z : 0;
+        return (uint8_t)r;
+    default:
+        r = a | b;
+        *f = r == 0 ? FLAG_Z : 0;
+        return (uint8_t)r;
+    }
+}
+
+static gb_machine *flags_machine (const uint8_t *code, size_t size) {
+    test_rom(rom, code, size);
+    return machine_create(rom, sizeof(rom));
+}
+
+static void flags_exec (gb_machine *gb, uint8_t a, uint8_t b, uint8_t f) {
+    gb->cpu.pc = TEST_CODE_ADDR;
+    gb->cpu.rA = a;
+    gb->cpu.rB = b;
+    sm83_set_f(&gb->cpu, f);
+    machine_step(gb);
+}
+
+// Every operand pair and carry in, for all eight ops of the A,B row
+static void test_alu (void) {
+    for (alu_op op = ALU_ADD; op <= ALU_CP; op++) {
+        uint8_t code[] = { (uint8_t)(0x80 + op * 8) };
+        gb_machine *gb = flags_machine(code, sizeof(code));
+        int mismatches = 0;
+
+        for (int a = 0; a < 256; a++) {
+            for (int b = 0; b < 256; b++) {
+                for (int carry = 0; carry < 2; carry++) {
+                    uint8_t f;
+                    uint8_t r = alu_reference(op, a, b, carry, &f);
+
+                    flags_exec(gb, a, b, carry ? FLAG_C : 0);
+
+                    if ((gb->cpu.rA != r || sm83_get_f(&gb->cpu) != f) && mismatches++ == 0)
+                        fprintf(stderr, "op 0x%02X a=%02X b=%02X c=%d: got A=%02X F=%02X, expected A=%02X F=%02X\n",
+                            code[0], a, b, carry, gb->cpu.rA, sm83_get_f(&gb->cpu), r, f);
+                }
+            }
+        }
+
+        test_failures += mismatches;
+        machine_destroy(gb);
+    }
+}
+
+// INC and DEC leave C alone, whatever the last operation left there
+static void test_inc_dec (void) {
+    for (int dec = 0; dec < 2; dec++) {
+        const uint8_t code[] = { (uint8_t)(0x04 + dec) }; // INC B, DEC B
+        gb_machine *gb = flags_machine(code, sizeof(code));
+
+        for (int b = 0; b < 256; b++) {
+            for (int carry = 0; carry < 2; carry++) {
+                uint8_t c = carry ? FLAG_C : 0;
+                uint8_t r = (uint8_t)(dec ? b - 1 : b + 1);
+                bool half = dec ? (b & 0xF) == 0 : (b & 0xF) == 0xF;
+
+                flags_exec(gb, 0, b, c);
+                CHECK_EQ(gb->cpu.rB, r);
+                CHECK_EQ(sm83_get_f(&gb->cpu), (r == 0 ? FLAG_Z : 0) | (dec ? FLAG_N : 0) | (half ? FLAG_H : 0) | c);
+            }
+        }
+
+        machine_destroy(gb);
+    }
+}
+
+// DAA reads N, H and C back out of the lazy state, every A with every combination of the three
+static void test_daa (void) {
+    const uint8_t code[] = { 0x27 };
+    gb_machine *gb = flags_machine(code, sizeof(code));
+
+    for (int a = 0; a < 256; a++) {
+        for (int flags = 0; flags < 8; flags++) {
+            uint8_t f = (flags & 4 ? FLAG_N : 0) | (flags & 2 ? FLAG_H : 0) | (flags & 1 ? FLAG_C : 0);
+            uint8_t r = a;
+            bool carry = f & FLAG_C;
+
+            if (!(f & FLAG_N)) {
+                if (carry || a > 0x99) {
+                    r += 0x60;
+                    carry = true;
+                }
+
+                if ((f & FLAG_H) || (a & 0x0F) > 0x09)
+                    r += 0x06;
+            } else {
+                if (carry)
+                    r -= 0x60;
+
+                if (f & FLAG_H)
+                    r -= 0x06;
+            }
+
+            flags_exec(gb, a, 0, f);
+            CHECK_EQ(gb->cpu.rA, r);
+            CHECK_EQ(sm83_get_f(&gb->cpu), (r == 0 ? FLAG_Z : 0) | (f & FLAG_N) | (carry ? FLAG_C : 0));
+        }
+    }
+
+    machine_destroy(gb);
+}
+
+// Any F set from outside, POP AF or a loaded state, reads back as written with the low nibble clear
+static void test_set_get (void) {
+    const uint8_t code[] = { 0xF1 }; // POP AF
+    gb_machine *gb = flags_machine(code, sizeof(code));
+
+    for (int f = 0; f < 256; f++) {
+        sm83_set_f(&gb->cpu, f);
+        CHECK_EQ(sm83_get_f(&gb->cpu), f & 0xF0);
+    }
+
+    gb->bus.wram[0x0FFE] = 0xFF;
+    gb->bus.wram[0x0FFF] = 0x12;
+    gb->cpu.sp = 0xCFFE;
+    gb->cpu.pc = TEST_CODE_ADDR;
+    machine_step(gb);
+
+    CHECK_EQ(gb->cpu.rA, 0x12);
+    CHECK_EQ(sm83_get_f(&gb->cpu), 0xF0);
+
+    machine_destroy(gb);
+}
+
+int main (void) {
+    test_alu();
+    test_inc_dec();
+    test_daa();
+    test_set_get();
+
+    return test_result("flags");
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "test.h"
+
+#define HDMA_SOURCE 0x4000
+
+static uint8_t rom[TEST_ROM_SIZE];
+
+static const uint8_t idle[] = {
+    0x18, 0xFE // 0150: JR 0x0150
+};
+
+static gb_machine *hdma_machine (uint8_t cgb_flag) {
+    test_rom(rom, idle, sizeof(idle));
+    rom[CGB_FLAG_ADDR] = cgb_flag;
+
+    for (int i = 0; i < 0x100; i++)
+        rom[HDMA_SOURCE + i] = (uint8_t)(i * 7 + 3);
+
+    return machine_create(rom, sizeof(rom));
+}
+
+static void hdma_start (gb_machine *gb, uint16_t src, uint16_t dst, uint8_t hdma5) {
+    write_to_memory(&gb->bus, HDMA1_ADDR, src >> 8);
+    write_to_memory(&gb->bus, HDMA2_ADDR, src & 0xFF);
+    write_to_memory(&gb->bus, HDMA3_ADDR, dst >> 8);
+    write_to_memory(&gb->bus, HDMA4_ADDR, dst & 0xFF);
+    write_to_memory(&gb->bus, HDMA5_ADDR, hdma5);
+}
+
+// Without the CGB flag there is no VBK and no HDMA, the registers do nothing
+static void test_dmg (void) {
+    gb_machine *gb = hdma_machine(0x00);
+
+    CHECK(!gb->bus.cgb);
+    CHECK_EQ(read_from_memory(&gb->bus, VBK_ADDR), 0xFF);
+
+    hdma_start(gb, HDMA_SOURCE, 0x8010, 0x01);
+    CHECK_EQ(gb->bus.vram[0x10], 0x00);
+    CHECK_EQ(gb->dma.hdma_blocks, 0);
+
+    machine_destroy(gb);
+}
+
+// General purpose: every block lands at once and the CPU is held for 32 cycles a block
+static void test_gdma (void) {
+    gb_machine *gb = hdma_machine(0x80);
+    uint64_t start;
+
+    CHECK(gb->bus.cgb);
+
+    start = gb->cpu.cycles;
+    hdma_start(gb, HDMA_SOURCE, 0x8010, 0x01);
+
+    CHECK(memcmp(gb->bus.vram + 0x10, rom + HDMA_SOURCE, 2 * HDMA_BLOCK_SIZE) == 0);
+    CHECK_EQ(gb->cpu.cycles - start, 2 * HDMA_BLOCK_CYCLES);
+    CHECK_EQ(read_from_memory(&gb->bus, HDMA5_ADDR), 0xFF);
+
+    machine_destroy(gb);
+}
+
+// VBK picks the bank both the CPU and HDMA see at 0x8000
+static void test_vram_bank (void) {
+    gb_machine *gb = hdma_machine(0xC0);
+
+    write_to_memory(&gb->bus, VBK_ADDR, 0x01);
+    CHECK_EQ(read_from_memory(&gb->bus, VBK_ADDR), 0xFF);
+
+    hdma_start(gb, HDMA_SOURCE, 0x8000, 0x00);
+    CHECK(memcmp(gb->bus.vram + VRAM_SIZE, rom + HDMA_SOURCE, HDMA_BLOCK_SIZE) == 0);
+    CHECK_EQ(gb->bus.vram[0], 0x00);
+    CHECK_EQ(read_from_memory(&gb->bus, 0x8001), rom[HDMA_SOURCE + 1]);
+
+    write_to_memory(&gb->bus, VBK_ADDR, 0x00);
+    CHECK_EQ(read_from_memory(&gb->bus, VBK_ADDR), 0xFE);
+    CHECK_EQ(read_from_memory(&gb->bus, 0x8001), 0x00);
+
+    machine_destroy(gb);
+}
+
+// HBlank: one block per line, HDMA5 counts down with bit 7 clear while it runs
+static void test_hblank (void) {
+    gb_machine *gb = hdma_machine(0x80);
+
+    hdma_start(gb, HDMA_SOURCE, 0x9000, HDMA_HBLANK | 0x02);
+    CHECK_EQ(read_from_memory(&gb->bus, HDMA5_ADDR), 0x02);
+    CHECK_EQ(gb->bus.vram[0x1000], 0x00);
+
+    machine_run(gb, 456);
+    CHECK_EQ(read_from_memory(&gb->bus, HDMA5_ADDR), 0x01);
+    CHECK(memcmp(gb->bus.vram + 0x1000, rom + HDMA_SOURCE, HDMA_BLOCK_SIZE) == 0);
+
+    machine_run(gb, 4 * 456);
+    CHECK_EQ(read_from_memory(&gb->bus, HDMA5_ADDR), 0xFF);
+    CHECK(memcmp(gb->bus.vram + 0x1000, rom + HDMA_SOURCE, 3 * HDMA_BLOCK_SIZE) == 0);
+
+    machine_destroy(gb);
+}
+
+// Writing HDMA5 with bit 7 clear stops an HBlank transfer, the remaining count reads back with bit 7 set
+static void test_hblank_cancel (void) {
+    gb_machine *gb = hdma_machine(0x80);
+
+    hdma_start(gb, HDMA_SOURCE, 0x9000, HDMA_HBLANK | 0x07);
+    machine_run(gb, 456);
+    write_to_memory(&gb->bus, HDMA5_ADDR, 0x00);
+
+    CHECK_EQ(read_from_memory(&gb->bus, HDMA5_ADDR), HDMA_HBLANK | 0x06);
+
+    machine_run(gb, 4 * 456);
+    CHECK_EQ(read_from_memory(&gb->bus, HDMA5_ADDR), HDMA_HBLANK | 0x06);
+    CHECK_EQ(gb->bus.vram[0x1000 + HDMA_BLOCK_SIZE], 0x00);
+
+    machine_destroy(gb);
+}
+
+int main (void) {
+    test_dmg();
+    test_gdma();
+    test_vram_bank();
+    test_hblank();
+    test_hblank_cancel();
+
+    return test_result("hdma");
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "test.h"
+
+#define VBLANK_CYCLE (LCD_HEIGHT * PPU_LINE_CYCLES)
+
+static uint8_t rom[TEST_ROM_SIZE];
+
+static const uint8_t program[] = {
+    0xFB,       // 0150: EI
+    0x00,       // 0151: NOP
+    0x00,       // 0152: NOP
+    0x76,       // 0153: HALT
+    0x00,       // 0154: NOP
+    0x18, 0xFE  // 0155: JR 0x0155
+};
+
+static gb_machine *interrupt_machine (uint8_t ie, uint8_t iflag) {
+    gb_machine *gb = machine_create(rom, sizeof(rom));
+
+    gb->cpu.pc = TEST_CODE_ADDR;
+    write_to_memory(&gb->bus, IE_ADDR, ie);
+    write_to_memory(&gb->bus, IF_ADDR, iflag);
+
+    return gb;
+}
+
+// EI takes effect after the next instruction, then the lowest pending bit wins and costs 20 cycles
+static void test_dispatch (void) {
+    gb_machine *gb = interrupt_machine(INTERRUPT_MASK, INTERRUPT_TIMER | INTERRUPT_JOYPAD);
+    uint64_t start;
+
+    machine_step(gb);
+    CHECK_EQ(gb->cpu.pc, 0x0151);
+    machine_step(gb);
+    CHECK_EQ(gb->cpu.pc, 0x0152);
+    CHECK_EQ(gb->cpu.ime, 1);
+
+    start = gb->cpu.cycles;
+    machine_step(gb);
+    CHECK_EQ(gb->cpu.pc, 0x0050);
+    CHECK_EQ(gb->cpu.cycles - start, SM83_INTERRUPT_CYCLES);
+    CHECK_EQ(gb->cpu.ime, 0);
+    CHECK_EQ(read_from_memory(&gb->bus, IF_ADDR), 0xE0 | INTERRUPT_JOYPAD);
+    CHECK_EQ(read_from_memory(&gb->bus, gb->cpu.sp), 0x52);
+    CHECK_EQ(read_from_memory(&gb->bus, gb->cpu.sp + 1), 0x01);
+
+    machine_destroy(gb);
+}
+
+// Bits not enabled in IE never dispatch
+static void test_masked (void) {
+    gb_machine *gb = interrupt_machine(INTERRUPT_VBLANK, INTERRUPT_TIMER);
+
+    for (int i = 0; i < 4; i++)
+        machine_step(gb);
+
+    CHECK_EQ(gb->cpu.pc, 0x0154);
+    CHECK_EQ(read_from_memory(&gb->bus, IF_ADDR), 0xE0 | INTERRUPT_TIMER);
+
+    machine_destroy(gb);
+}
+
+// HALT skips from one PPU event to the next rather than idling 4 cycles at a time, and wakes right at VBlank
+static void test_halt_fast_forward (void) {
+    gb_machine *gb = interrupt_machine(INTERRUPT_VBLANK, 0);
+    int steps = 0;
+
+    while (gb->cpu.pc != 0x0040 && steps < 10000) {
+        machine_step(gb);
+        steps++;
+    }
+
+    CHECK_EQ(gb->cpu.pc, 0x0040);
+    CHECK(!gb->cpu.is_halted);
+    CHECK(steps < 4 * LCD_HEIGHT);
+    CHECK(gb->cpu.cycles >= VBLANK_CYCLE && gb->cpu.cycles <= VBLANK_CYCLE + SM83_INTERRUPT_CYCLES + 4);
+
+    machine_destroy(gb);
+}
+
+// With IME clear a pending interrupt still ends HALT, execution just carries on after it
+static void test_halt_without_ime (void) {
+    gb_machine *gb = interrupt_machine(INTERRUPT_VBLANK, 0);
+
+    gb->cpu.pc = 0x0153;
+    machine_run(gb, CYCLES_PER_FRAME);
+
+    CHECK(!gb->cpu.is_halted);
+    CHECK_EQ(gb->cpu.pc, 0x0155);
+    CHECK(read_from_memory(&gb->bus, IF_ADDR) & INTERRUPT_VBLANK);
+
+    machine_destroy(gb);
+}
+
+int main (void) {
+    test_rom(rom, program, sizeof(program));
+
+    test_dispatch();
+    test_masked();
+    test_halt_fast_forward();
+    test_halt_without_ime();
+
+    return test_result("interrupt");
+}
\ No newline at end of file
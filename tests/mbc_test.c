@@ -0,0 +1,176 @@
+#include "test.h"
+
+#define MBC_TAG_OFFSET 0x1000 // Where each bank stores its own number, clear of the header in bank 0
+
+// Every ROM bank tagged with its number so a read shows which bank is mapped
+static uint8_t *mbc_rom (size_t banks, uint8_t type, uint8_t ram_size) {
+    uint8_t *rom = calloc(banks, ROM_BANK_SIZE);
+
+    for (size_t bank = 0; bank < banks; bank++) {
+        rom[bank * ROM_BANK_SIZE + MBC_TAG_OFFSET] = bank & 0xFF;
+        rom[bank * ROM_BANK_SIZE + MBC_TAG_OFFSET + 1] = bank >> 8;
+    }
+
+    rom[CARTRIDGE_TYPE_ADDR] = type;
+    rom[RAM_SIZE_ADDR] = ram_size;
+
+    return rom;
+}
+
+static uint16_t mbc_bank_at (gb_machine *gb, uint16_t base) {
+    return bytes_to_u16(read_from_memory(&gb->bus, base + MBC_TAG_OFFSET), read_from_memory(&gb->bus, base + MBC_TAG_OFFSET + 1));
+}
+
+static void mbc_write (gb_machine *gb, uint16_t addr, uint8_t data) {
+    write_to_memory(&gb->bus, addr, data);
+}
+
+// 2 MB, 32 KB RAM: five low bank bits, two shared upper bits and the mode that moves them onto bank 0 and RAM
+static void test_mbc1 (void) {
+    uint8_t *rom = mbc_rom(128, 0x03, 0x03);
+    gb_machine *gb = machine_create(rom, 128 * ROM_BANK_SIZE);
+
+    CHECK_EQ(mbc_bank_at(gb, 0x0000), 0);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 1);
+
+    mbc_write(gb, 0x2000, 0x05);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 5);
+
+    // Zero in the low five bits always means 1, even when the write has higher bits set
+    mbc_write(gb, 0x2000, 0x00);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 1);
+    mbc_write(gb, 0x2000, 0x20);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 1);
+
+    mbc_write(gb, 0x4000, 0x01);
+    mbc_write(gb, 0x2000, 0x02);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 0x22);
+    mbc_write(gb, 0x2000, 0x00);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 0x21);
+    CHECK_EQ(mbc_bank_at(gb, 0x0000), 0);
+
+    mbc_write(gb, 0x6000, 0x01);
+    CHECK_EQ(mbc_bank_at(gb, 0x0000), 0x20);
+    mbc_write(gb, 0x6000, 0x00);
+    CHECK_EQ(mbc_bank_at(gb, 0x0000), 0);
+
+    // RAM reads open bus until enabled, mode 0 pins it to bank 0 whatever the upper bits say
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0xFF);
+    mbc_write(gb, 0x0000, 0x0A);
+    mbc_write(gb, 0x4000, 0x00);
+    mbc_write(gb, 0xA000, 0x11);
+
+    mbc_write(gb, 0x4000, 0x02);
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0x11);
+
+    mbc_write(gb, 0x6000, 0x01);
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0x00);
+    mbc_write(gb, 0xA000, 0x22);
+    CHECK_EQ(gb->mapper.ram[2 * EXT_RAM_SIZE], 0x22);
+
+    mbc_write(gb, 0x4000, 0x00);
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0x11);
+
+    mbc_write(gb, 0x0000, 0x00);
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0xFF);
+    mbc_write(gb, 0xA000, 0x33);
+    CHECK_EQ(gb->mapper.ram[0], 0x11);
+
+    machine_destroy(gb);
+    free(rom);
+}
+
+// 2 MB, 32 KB RAM and a clock: seven bank bits, RAM banks 0-3 and RTC registers at 0x08-0x0C
+static void test_mbc3 (void) {
+    uint8_t *rom = mbc_rom(128, 0x10, 0x03);
+    gb_machine *gb = machine_create(rom, 128 * ROM_BANK_SIZE);
+
+    mbc_write(gb, 0x2000, 0x7F);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 0x7F);
+    mbc_write(gb, 0x2000, 0x00);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 1);
+
+    mbc_write(gb, 0x0000, 0x0A);
+    mbc_write(gb, 0x4000, 0x03);
+    mbc_write(gb, 0xA000, 0x44);
+    CHECK_EQ(gb->mapper.ram[3 * EXT_RAM_SIZE], 0x44);
+
+    // Seconds register, writes show straight away and a 0 then 1 latch copies the live clock
+    mbc_write(gb, 0x4000, RTC_SELECT_FIRST);
+    mbc_write(gb, 0xA000, 0x2A);
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0x2A);
+
+    gb->mapper.rtc[0] = 0x2B;
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0x2A);
+    mbc_write(gb, 0x6000, 0x00);
+    mbc_write(gb, 0x6000, 0x01);
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0x2B);
+
+    mbc_write(gb, 0x4000, 0x03);
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0x44);
+
+    machine_destroy(gb);
+    free(rom);
+}
+
+// 8 MB, 128 KB RAM: nine bank bits split over two registers, and bank 0 really is bank 0
+static void test_mbc5 (void) {
+    uint8_t *rom = mbc_rom(512, 0x1B, 0x04);
+    gb_machine *gb = machine_create(rom, 512 * ROM_BANK_SIZE);
+
+    mbc_write(gb, 0x2000, 0x00);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 0);
+
+    mbc_write(gb, 0x2000, 0x05);
+    mbc_write(gb, 0x3000, 0x01);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 0x105);
+
+    mbc_write(gb, 0x2000, 0xFF);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 0x1FF);
+
+    mbc_write(gb, 0x3000, 0x00);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 0xFF);
+
+    mbc_write(gb, 0x0000, 0x0A);
+    mbc_write(gb, 0x4000, 0x0F);
+    mbc_write(gb, 0xBFFF, 0x55);
+    CHECK_EQ(gb->mapper.ram[16 * EXT_RAM_SIZE - 1], 0x55);
+
+    machine_destroy(gb);
+    free(rom);
+}
+
+// Out of range banks wrap to the ROM's size instead of reading past it
+static void test_wrap (void) {
+    uint8_t *rom = mbc_rom(8, 0x19, 0x00);
+    gb_machine *gb = machine_create(rom, 8 * ROM_BANK_SIZE);
+
+    mbc_write(gb, 0x2000, 0x0B);
+    CHECK_EQ(mbc_bank_at(gb, 0x4000), 3);
+    CHECK_EQ(read_from_memory(&gb->bus, 0xA000), 0xFF);
+
+    machine_destroy(gb);
+    free(rom);
+}
+
+// A ROM cut off before the end of its header or with a mapper this build lacks never becomes a machine
+static void test_rejects (void) {
+    uint8_t *rom = mbc_rom(2, 0x00, 0x00);
+
+    CHECK(machine_create(rom, CARTRIDGE_HEADER_END - 1) == NULL);
+
+    rom[CARTRIDGE_TYPE_ADDR] = 0x22;
+    CHECK(machine_create(rom, 2 * ROM_BANK_SIZE) == NULL);
+
+    free(rom);
+}
+
+int main (void) {
+    test_mbc1();
+    test_mbc3();
+    test_mbc5();
+    test_wrap();
+    test_rejects();
+
+    return test_result("mbc");
+}
\ No newline at end of file
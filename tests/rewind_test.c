@@ -0,0 +1,179 @@
+#include "test.h"
+#include "rewind.h"
+
+#define REWIND_TEST_FRAMES 40
+
+static uint8_t rom[TEST_ROM_SIZE];
+static uint64_t frame_cycles[REWIND_TEST_FRAMES];
+
+// Walks WRAM bumping one byte per pass, so every frame changes a different stretch of memory
+static const uint8_t busy[] = {
+    0x21, 0x00, 0xC0, // 0150: LD HL, 0xC000
+    0x7E,             // 0153: LD A, [HL]
+    0x3C,             // 0154: INC A
+    0x22,             // 0155: LD [HL+], A
+    0x7C,             // 0156: LD A, H
+    0xFE, 0xE0,       // 0157: CP A, 0xE0
+    0x20, 0xF8,       // 0159: JR NZ, 0x0153
+    0x18, 0xF3        // 015B: JR 0x0150
+};
+
+// XOR deltas apply both ways and an unchanged pair costs nothing
+static void test_delta (void) {
+    uint8_t a[4096];
+    uint8_t b[4096];
+    uint8_t state[4096];
+    uint8_t delta[2 * 4096 + 16];
+    uint32_t seed = 0x2468ACE1;
+    size_t len;
+
+    for (size_t i = 0; i < sizeof(a); i++) {
+        seed = seed * 1664525 + 1013904223;
+        a[i] = b[i] = seed >> 24;
+
+        // Changes in runs of varied length, some separated by less than REWIND_MIN_SKIP
+        if ((seed >> 8) % 7 == 0)
+            b[i] ^= 0x5A;
+    }
+
+    CHECK_EQ(rewind_encode(a, a, sizeof(a), delta), 0);
+
+    len = rewind_encode(a, b, sizeof(a), delta);
+    CHECK(len > 0 && len <= sizeof(delta));
+
+    memcpy(state, b, sizeof(b));
+    rewind_apply(state, delta, len);
+    CHECK(memcmp(state, a, sizeof(a)) == 0);
+
+    rewind_apply(state, delta, len);
+    CHECK(memcmp(state, b, sizeof(b)) == 0);
+}
+
+// Captures frames, keeping a full copy of each to check the history against
+static uint8_t **rewind_record (rewind_ctx *rw, gb_machine *gb, int frames) {
+    uint8_t **saves = malloc(frames * sizeof(uint8_t *));
+
+    for (int i = 0; i < frames; i++) {
+        machine_run(gb, CYCLES_PER_FRAME);
+        rewind_push(rw, gb);
+
+        saves[i] = malloc(rw->state_size);
+        savestate_save(gb, saves[i], rw->state_size);
+        frame_cycles[i] = gb->cpu.cycles;
+    }
+
+    return saves;
+}
+
+static void rewind_free_saves (uint8_t **saves, int frames) {
+    for (int i = 0; i < frames; i++)
+        free(saves[i]);
+
+    free(saves);
+}
+
+// Stepping back lands on exactly the state captured that many frames earlier
+static void test_step_back (void) {
+    gb_machine *gb = machine_create(rom, sizeof(rom));
+    rewind_ctx rw;
+    uint8_t **saves;
+    int frame = REWIND_TEST_FRAMES - 1;
+
+    CHECK(rewind_init(&rw, gb, 1 << 20, 1000));
+    CHECK(!rewind_step_back(&rw, gb, 1));
+
+    saves = rewind_record(&rw, gb, REWIND_TEST_FRAMES);
+    CHECK_EQ(rw.count, REWIND_TEST_FRAMES - 1);
+    CHECK(rewind_used(&rw) < (size_t)REWIND_TEST_FRAMES * rw.state_size / 4);
+
+    for (uint32_t step = 1; frame - (int)step >= 0; step++) {
+        frame -= step;
+        CHECK(rewind_step_back(&rw, gb, step));
+        CHECK(memcmp(rw.current, saves[frame], rw.state_size) == 0);
+        CHECK_EQ(gb->cpu.cycles, frame_cycles[frame]);
+    }
+
+    // Asking for more than is left stops at the oldest frame
+    CHECK(rewind_step_back(&rw, gb, 1000));
+    CHECK(memcmp(rw.current, saves[0], rw.state_size) == 0);
+    CHECK_EQ(rw.count, 0);
+    CHECK(!rewind_step_back(&rw, gb, 1));
+
+    rewind_free_saves(saves, REWIND_TEST_FRAMES);
+    rewind_free(&rw);
+    machine_destroy(gb);
+}
+
+// Pushing after stepping back continues from there, the undone frames are gone
+static void test_branch (void) {
+    gb_machine *gb = machine_create(rom, sizeof(rom));
+    rewind_ctx rw;
+    uint8_t **saves;
+    uint8_t **more;
+
+    CHECK(rewind_init(&rw, gb, 1 << 20, 1000));
+    saves = rewind_record(&rw, gb, 10);
+
+    CHECK(rewind_step_back(&rw, gb, 5));
+    more = rewind_record(&rw, gb, 3);
+    CHECK_EQ(rw.count, 4 + 3);
+
+    CHECK(rewind_step_back(&rw, gb, 3));
+    CHECK(memcmp(rw.current, saves[4], rw.state_size) == 0);
+
+    CHECK(rewind_step_back(&rw, gb, 4));
+    CHECK(memcmp(rw.current, saves[0], rw.state_size) == 0);
+
+    rewind_free_saves(saves, 10);
+    rewind_free_saves(more, 3);
+    rewind_free(&rw);
+    machine_destroy(gb);
+}
+
+// Both the byte budget and the frame cap drop the oldest deltas first, and what is kept stays exact
+static void test_limits (void) {
+    gb_machine *gb = machine_create(rom, sizeof(rom));
+    rewind_ctx rw;
+    uint8_t **saves;
+    size_t capacity;
+    uint32_t kept;
+
+    CHECK(rewind_init(&rw, gb, 1 << 20, 8));
+    saves = rewind_record(&rw, gb, REWIND_TEST_FRAMES);
+    CHECK_EQ(rw.count, 8);
+    CHECK(rewind_step_back(&rw, gb, 8));
+    CHECK(memcmp(rw.current, saves[REWIND_TEST_FRAMES - 9], rw.state_size) == 0);
+    rewind_free_saves(saves, REWIND_TEST_FRAMES);
+    rewind_free(&rw);
+
+    // Room for roughly five deltas
+    CHECK(rewind_init(&rw, gb, 1 << 20, 1000));
+    saves = rewind_record(&rw, gb, 2);
+    capacity = rw.length[0] * 5 + rw.length[0] / 2;
+    rewind_free_saves(saves, 2);
+    rewind_free(&rw);
+
+    CHECK(rewind_init(&rw, gb, capacity, 1000));
+    saves = rewind_record(&rw, gb, REWIND_TEST_FRAMES);
+    CHECK(rw.count > 0 && rw.count < 10);
+    CHECK(rewind_used(&rw) <= capacity);
+
+    kept = rw.count;
+    CHECK(rewind_step_back(&rw, gb, kept));
+    CHECK(memcmp(rw.current, saves[REWIND_TEST_FRAMES - 1 - kept], rw.state_size) == 0);
+    rewind_free_saves(saves, REWIND_TEST_FRAMES);
+    rewind_free(&rw);
+
+    machine_destroy(gb);
+}
+
+int main (void) {
+    test_rom(rom, busy, sizeof(busy));
+
+    test_delta();
+    test_step_back();
+    test_branch();
+    test_limits();
+
+    return test_result("rewind");
+}
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "test.h"
+#include "savestate.h"
+
+static uint8_t rom[TEST_ROM_SIZE];
+
+// Keeps the CPU, WRAM, cartridge RAM, the timer and its interrupt all busy
+static const uint8_t busy[] = {
+    0x3E, 0x0A,       // 0150: LD A, 0x0A
+    0xEA, 0x00, 0x00, // 0152: LD [0x0000], A
+    0x3E, 0x05,       // 0155: LD A, 0x05
+    0xE0, 0x07,       // 0157: LDH [TAC], A
+    0x3E, 0x04,       // 0159: LD A, 0x04
+    0xE0, 0xFF,       // 015B: LDH [IE], A
+    0xFB,             // 015D: EI
+    0x21, 0x00, 0xC0, // 015E: LD HL, 0xC000
+    0x7E,             // 0161: LD A, [HL]
+    0x3C,             // 0162: INC A
+    0x22,             // 0163: LD [HL+], A
+    0xEA, 0x00, 0xA0, // 0164: LD [0xA000], A
+    0x7C,             // 0167: LD A, H
+    0xFE, 0xD0,       // 0168: CP A, 0xD0
+    0x20, 0xF5,       // 016A: JR NZ, 0x0161
+    0x18, 0xF0        // 016C: JR 0x015E
+};
+
+static const uint8_t timer_handler[] = {
+    0x0C, // 0050: INC C
+    0xD9  // 0051: RETI
+};
+
+static gb_machine *state_machine (void) {
+    return machine_create(rom, sizeof(rom));
+}
+
+static uint8_t *state_save (gb_machine *gb) {
+    size_t size = savestate_size(gb);
+    uint8_t *state = malloc(size);
+
+    CHECK_EQ(savestate_save(gb, state, size), size);
+    return state;
+}
+
+// Running on from a loaded state has to end up byte for byte where the original run did
+static void test_round_trip (void) {
+    gb_machine *gb = state_machine();
+    gb_machine *other = state_machine();
+    size_t size = savestate_size(gb);
+    uint8_t *mid;
+    uint8_t *end;
+    uint8_t *replay;
+
+    machine_run(gb, 3 * CYCLES_PER_FRAME + 123);
+    mid = state_save(gb);
+
+    machine_run(gb, 2 * CYCLES_PER_FRAME);
+    end = state_save(gb);
+
+    CHECK(gb->cpu.rC > 0);
+    CHECK(gb->mapper.ram[0] != 0);
+
+    // Same machine, wound back
+    CHECK(savestate_load(gb, mid, size));
+    machine_run(gb, 2 * CYCLES_PER_FRAME);
+    replay = state_save(gb);
+    CHECK(memcmp(end, replay, size) == 0);
+    free(replay);
+
+    // A different machine picks up the same timeline
+    CHECK(savestate_load(other, mid, size));
+    machine_run(other, 2 * CYCLES_PER_FRAME);
+    replay = state_save(other);
+    CHECK(memcmp(end, replay, size) == 0);
+    free(replay);
+
+    free(mid);
+    free(end);
+    machine_destroy(gb);
+    machine_destroy(other);
+}
+
+// Bad states are turned away before the machine is touched
+static void test_rejects (void) {
+    gb_machine *gb = state_machine();
+    size_t size = savestate_size(gb);
+    uint8_t *good;
+    uint8_t *bad = malloc(size);
+    uint8_t *after;
+    uint32_t chunk_size;
+    uint16_t count = 0;
+    size_t skip;
+
+    machine_run(gb, CYCLES_PER_FRAME);
+    good = state_save(gb);
+
+    CHECK_EQ(savestate_save(gb, bad, size - 1), 0);
+
+    memcpy(bad, good, size);
+    bad[0] = 'X';
+    CHECK(!savestate_load(gb, bad, size));
+
+    memcpy(bad, good, size);
+    bad[4]++;
+    CHECK(!savestate_load(gb, bad, size));
+
+    CHECK(!savestate_load(gb, good, size - 1));
+    CHECK(!savestate_load(gb, good, SAVESTATE_HEADER_SIZE - 1));
+
+    // First chunk claiming a size its tag doesn't have
+    memcpy(bad, good, size);
+    memcpy(&chunk_size, bad + SAVESTATE_HEADER_SIZE + 4, sizeof(chunk_size));
+    chunk_size--;
+    memcpy(bad + SAVESTATE_HEADER_SIZE + 4, &chunk_size, sizeof(chunk_size));
+    CHECK(!savestate_load(gb, bad, size));
+
+    // No chunks at all, then everything but the first (CPU) chunk
+    memcpy(bad, good, SAVESTATE_HEADER_SIZE);
+    memset(bad + 6, 0, sizeof(count));
+    CHECK(!savestate_load(gb, bad, SAVESTATE_HEADER_SIZE));
+
+    memcpy(&count, good + 6, sizeof(count));
+    memcpy(&chunk_size, good + SAVESTATE_HEADER_SIZE + 4, sizeof(chunk_size));
+    skip = SAVESTATE_CHUNK_HEADER_SIZE + chunk_size;
+    count--;
+    memcpy(bad + 6, &count, sizeof(count));
+    memcpy(bad + SAVESTATE_HEADER_SIZE, good + SAVESTATE_HEADER_SIZE + skip, size - SAVESTATE_HEADER_SIZE - skip);
+    CHECK(!savestate_load(gb, bad, size - skip));
+
+    after = state_save(gb);
+    CHECK(memcmp(good, after, size) == 0);
+
+    free(after);
+    free(good);
+    free(bad);
+    machine_destroy(gb);
+}
+
+// Chunks with tags this build doesn't know are skipped
+static void test_unknown_chunk (void) {
+    gb_machine *gb = state_machine();
+    size_t size = savestate_size(gb);
+    uint8_t *good;
+    uint8_t *extended = malloc(size + SAVESTATE_CHUNK_HEADER_SIZE + 4);
+    uint32_t extra_size = 4;
+    uint16_t count;
+    uint8_t *after;
+
+    machine_run(gb, CYCLES_PER_FRAME);
+    good = state_save(gb);
+
+    memcpy(extended, good, size);
+    memcpy(&count, extended + 6, sizeof(count));
+    count++;
+    memcpy(extended + 6, &count, sizeof(count));
+    memcpy(extended + size, "XTRA", 4);
+    memcpy(extended + size + 4, &extra_size, sizeof(extra_size));
+    memset(extended + size + SAVESTATE_CHUNK_HEADER_SIZE, 0xAA, extra_size);
+
+    // Loading clears the CPU's run deadline, so compare against a plain load rather than the save itself
+    CHECK(savestate_load(gb, good, size));
+    free(good);
+    good = state_save(gb);
+
+    machine_run(gb, CYCLES_PER_FRAME);
+    CHECK(savestate_load(gb, extended, size + SAVESTATE_CHUNK_HEADER_SIZE + extra_size));
+
+    after = state_save(gb);
+    CHECK(memcmp(good, after, size) == 0);
+
+    free(after);
+    free(good);
+    free(extended);
+    machine_destroy(gb);
+}
+
+int main (void) {
+    test_rom(rom, busy, sizeof(busy));
+    memcpy(rom + 0x0050, timer_handler, sizeof(timer_handler));
+    rom[CARTRIDGE_TYPE_ADDR] = 0x03;
+    rom[RAM_SIZE_ADDR] = 0x02;
+
+    test_round_trip();
+    test_rejects();
+    test_unknown_chunk();
+
+    return test_result("savestate");
+}
\ No newline at end of file
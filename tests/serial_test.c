@@ -0,0 +1,114 @@
+#include "test.h"
+
+static uint8_t rom[TEST_ROM_SIZE];
+
+static const uint8_t idle[] = {
+    0x18, 0xFE // 0150: JR 0x0150
+};
+
+static bool serial_irq (gb_machine *gb) {
+    return gb->bus.io[IF_ADDR - IO_ADDR] & INTERRUPT_SERIAL;
+}
+
+static void serial_start (gb_machine *gb, uint8_t data, uint8_t sc) {
+    gb->bus.io[IF_ADDR - IO_ADDR] = 0;
+    write_to_memory(&gb->bus, SB_ADDR, data);
+    write_to_memory(&gb->bus, SC_ADDR, sc);
+}
+
+// With no cable the byte goes nowhere and 0xFF comes back, 4096 cycles after the start
+static void test_unplugged (void) {
+    gb_machine *gb = machine_create(rom, sizeof(rom));
+
+    serial_start(gb, 0x5A, SC_START | SC_INTERNAL_CLOCK);
+    CHECK_EQ(read_from_memory(&gb->bus, SC_ADDR), 0xFF);
+
+    machine_run(gb, SERIAL_BYTE_CYCLES - 64);
+    CHECK(!serial_irq(gb));
+    CHECK_EQ(read_from_memory(&gb->bus, SB_ADDR), 0x5A);
+
+    machine_run(gb, 128);
+    CHECK(serial_irq(gb));
+    CHECK_EQ(read_from_memory(&gb->bus, SB_ADDR), 0xFF);
+    CHECK_EQ(read_from_memory(&gb->bus, SC_ADDR), 0x7F);
+
+    machine_destroy(gb);
+}
+
+// The buffer sink keeps every byte, in order
+static void test_buffer (void) {
+    gb_machine *gb = machine_create(rom, sizeof(rom));
+    serial_buffer buffer = { .len = 0 };
+    const char *text = "ok";
+
+    serial_set_sink(&gb->serial, serial_sink_buffer, &buffer);
+
+    for (const char *c = text; *c; c++) {
+        serial_start(gb, *c, SC_START | SC_INTERNAL_CLOCK);
+        machine_run(gb, SERIAL_BYTE_CYCLES);
+    }
+
+    CHECK_EQ(buffer.len, 2);
+    CHECK(strcmp(buffer.data, text) == 0);
+
+    machine_destroy(gb);
+}
+
+// An external clock transfer never finishes without someone on the other end
+static void test_external_clock (void) {
+    gb_machine *gb = machine_create(rom, sizeof(rom));
+
+    serial_start(gb, 0x12, SC_START);
+    machine_run(gb, 4 * SERIAL_BYTE_CYCLES);
+
+    CHECK(!serial_irq(gb));
+    CHECK_EQ(read_from_memory(&gb->bus, SC_ADDR), 0xFE);
+    CHECK_EQ(read_from_memory(&gb->bus, SB_ADDR), 0x12);
+
+    machine_destroy(gb);
+}
+
+// Two machines on one cable: the internally clocked side drives, both SB registers swap and both sides interrupt
+static void test_link (void) {
+    gb_machine *master = machine_create(rom, sizeof(rom));
+    gb_machine *slave = machine_create(rom, sizeof(rom));
+
+    serial_connect(&master->serial, &slave->serial);
+
+    serial_start(slave, 0x99, SC_START);
+    serial_start(master, 0x42, SC_START | SC_INTERNAL_CLOCK);
+
+    for (int i = 0; i < 8; i++) {
+        machine_run(master, SERIAL_BYTE_CYCLES / 4);
+        machine_run(slave, SERIAL_BYTE_CYCLES / 4);
+    }
+
+    CHECK_EQ(read_from_memory(&master->bus, SB_ADDR), 0x99);
+    CHECK_EQ(read_from_memory(&slave->bus, SB_ADDR), 0x42);
+    CHECK(serial_irq(master));
+    CHECK(serial_irq(slave));
+    CHECK_EQ(read_from_memory(&slave->bus, SC_ADDR), 0x7E);
+
+    // A slave that hasn't set its start bit still has its SB swapped but no transfer to finish
+    serial_start(slave, 0x07, 0x00);
+    serial_start(master, 0x24, SC_START | SC_INTERNAL_CLOCK);
+    machine_run(master, 2 * SERIAL_BYTE_CYCLES);
+
+    CHECK_EQ(read_from_memory(&master->bus, SB_ADDR), 0x07);
+    CHECK_EQ(read_from_memory(&slave->bus, SB_ADDR), 0x24);
+    CHECK(!serial_irq(slave));
+
+    machine_destroy(master);
+    machine_destroy(slave);
+}
+
+int main (void) {
+    test_rom(rom, idle, sizeof(idle));
+
+    test_unplugged();
+    test_buffer();
+    test_external_clock();
+    test_link();
+
+    return test_result("serial");
+}
\ No newline at end of file
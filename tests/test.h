@@ -0,0 +1,61 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+
+#define TEST_ROM_SIZE (2 * ROM_BANK_SIZE)
+#define TEST_CODE_ADDR 0x0150
+
+// Each test program is its own translation unit, so one counter per program
+static int test_failures = 0;
+
+#define CHECK(cond) test_check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(actual, expected) test_check_eq((uint64_t)(actual), (uint64_t)(expected), #actual, __FILE__, __LINE__)
+
+static inline void test_check (bool ok, const char *expr, const char *file, int line) {
+    if (!ok) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+        test_failures++;
+    }
+}
+
+static inline void test_check_eq (uint64_t actual, uint64_t expected, const char *expr, const char *file, int line) {
+    if (actual != expected) {
+        fprintf(stderr, "%s:%d: %s is 0x%llX, expected 0x%llX\n", file, line, expr,
+            (unsigned long long)actual, (unsigned long long)expected);
+        test_failures++;
+    }
+}
+
+// A ROM only cartridge whose entry point jumps to code at 0x0150, past the header
+static inline void test_rom (uint8_t *rom, const uint8_t *code, size_t code_size) {
+    const uint8_t entry[] = { 0x00, 0xC3, TEST_CODE_ADDR & 0xFF, TEST_CODE_ADDR >> 8 };
+
+    memset(rom, 0, TEST_ROM_SIZE);
+    memcpy(rom + 0x0100, entry, sizeof(entry));
+    memcpy(rom + TEST_CODE_ADDR, code, code_size);
+}
+
+// Steps until pc reaches stop, false if the CPU halts for good or max_cycles pass first
+static inline bool test_run_to (gb_machine *gb, uint16_t stop, uint64_t max_cycles) {
+    uint64_t until = gb->cpu.cycles + max_cycles;
+
+    while (gb->cpu.pc != stop) {
+        if (!gb->cpu.is_running || gb->cpu.cycles >= until)
+            return false;
+
+        machine_step(gb);
+    }
+
+    return true;
+}
+
+static inline int test_result (const char *name) {
+    if (test_failures) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: ok\n", name);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
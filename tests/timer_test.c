@@ -0,0 +1,159 @@
+#include "test.h"
+
+static uint8_t rom[TEST_ROM_SIZE];
+
+static const uint8_t idle[] = {
+    0x18, 0xFE // 0150: JR 0x0150
+};
+
+// Moves the clock forward exactly, firing whatever events come due, without running any instructions
+static void timer_advance (gb_machine *gb, uint64_t cycles) {
+    gb->cpu.cycles += cycles;
+    scheduler_run_due(&gb->sched, gb->cpu.cycles);
+}
+
+static uint8_t timer_read (gb_machine *gb, uint16_t addr) {
+    return read_from_memory(&gb->bus, addr);
+}
+
+static void timer_write (gb_machine *gb, uint16_t addr, uint8_t data) {
+    write_to_memory(&gb->bus, addr, data);
+}
+
+static bool timer_irq (gb_machine *gb) {
+    return gb->bus.io[IF_ADDR - IO_ADDR] & INTERRUPT_TIMER;
+}
+
+// Starts from a fresh machine with the internal counter at 0
+static gb_machine *timer_machine (void) {
+    gb_machine *gb = machine_create(rom, sizeof(rom));
+
+    timer_write(gb, DIV_ADDR, 0);
+    gb->bus.io[IF_ADDR - IO_ADDR] = 0;
+
+    return gb;
+}
+
+static void test_div (void) {
+    gb_machine *gb = machine_create(rom, sizeof(rom));
+
+    CHECK_EQ(timer_read(gb, DIV_ADDR), TIMER_BOOT_COUNTER >> 8);
+
+    timer_write(gb, DIV_ADDR, 0x5A);
+    CHECK_EQ(timer_read(gb, DIV_ADDR), 0);
+
+    timer_advance(gb, 255);
+    CHECK_EQ(timer_read(gb, DIV_ADDR), 0);
+    timer_advance(gb, 1);
+    CHECK_EQ(timer_read(gb, DIV_ADDR), 1);
+    timer_advance(gb, 256 * 10);
+    CHECK_EQ(timer_read(gb, DIV_ADDR), 11);
+
+    machine_destroy(gb);
+}
+
+// One TIMA increment per period for every clock select, and none while stopped
+static void test_rates (void) {
+    const uint16_t periods[4] = { 1024, 16, 64, 256 };
+
+    for (uint8_t select = 0; select < 4; select++) {
+        gb_machine *gb = timer_machine();
+
+        timer_write(gb, TIMA_ADDR, 0);
+        timer_write(gb, TAC_ADDR, TAC_ENABLE | select);
+
+        timer_advance(gb, periods[select] * 5 - 1);
+        CHECK_EQ(timer_read(gb, TIMA_ADDR), 4);
+        timer_advance(gb, 1);
+        CHECK_EQ(timer_read(gb, TIMA_ADDR), 5);
+
+        timer_write(gb, TAC_ADDR, select);
+        timer_advance(gb, periods[select] * 4);
+        CHECK_EQ(timer_read(gb, TIMA_ADDR), 5);
+        CHECK_EQ(timer_read(gb, TAC_ADDR), 0xF8 | select);
+
+        machine_destroy(gb);
+    }
+}
+
+// Overflow reloads TMA and raises the interrupt from the scheduled event, with nothing reading TIMA
+static void test_overflow (void) {
+    gb_machine *gb = timer_machine();
+
+    timer_write(gb, TMA_ADDR, 0x40);
+    timer_write(gb, TIMA_ADDR, 0xFE);
+    timer_write(gb, TAC_ADDR, TAC_ENABLE | 1);
+
+    timer_advance(gb, 31);
+    CHECK(!timer_irq(gb));
+    timer_advance(gb, 1);
+    CHECK(timer_irq(gb));
+    CHECK_EQ(gb->bus.io[TIMA_ADDR - IO_ADDR], 0x40);
+
+    // Every later overflow counts up from TMA
+    gb->bus.io[IF_ADDR - IO_ADDR] = 0;
+    timer_advance(gb, 16 * (0x100 - 0x40) - 1);
+    CHECK(!timer_irq(gb));
+    timer_advance(gb, 1);
+    CHECK(timer_irq(gb));
+
+    machine_destroy(gb);
+}
+
+// DIV writes and TAC changes that drop the selected bit from 1 to 0 clock TIMA once
+static void test_falling_edges (void) {
+    gb_machine *gb = timer_machine();
+
+    timer_write(gb, TIMA_ADDR, 0);
+    timer_write(gb, TAC_ADDR, TAC_ENABLE | 1);
+
+    // Bit 3 is set from counter 8 to 15
+    timer_advance(gb, 8);
+    timer_write(gb, DIV_ADDR, 0);
+    CHECK_EQ(timer_read(gb, TIMA_ADDR), 1);
+
+    // Bit 3 clear, no edge
+    timer_advance(gb, 4);
+    timer_write(gb, DIV_ADDR, 0);
+    CHECK_EQ(timer_read(gb, TIMA_ADDR), 1);
+
+    timer_advance(gb, 8);
+    timer_write(gb, TAC_ADDR, 1);
+    CHECK_EQ(timer_read(gb, TIMA_ADDR), 2);
+
+    // Moving from bit 3 (set) to bit 9 (clear) is an edge too
+    timer_write(gb, DIV_ADDR, 0);
+    timer_write(gb, TAC_ADDR, TAC_ENABLE | 1);
+    timer_advance(gb, 8);
+    timer_write(gb, TAC_ADDR, TAC_ENABLE | 0);
+    CHECK_EQ(timer_read(gb, TIMA_ADDR), 3);
+
+    machine_destroy(gb);
+}
+
+// Running real instructions lands on the same count the period predicts
+static void test_running (void) {
+    gb_machine *gb = timer_machine();
+    uint64_t start = gb->cpu.cycles;
+
+    timer_write(gb, TIMA_ADDR, 0);
+    timer_write(gb, TAC_ADDR, TAC_ENABLE | 2);
+    machine_run(gb, 64 * 200);
+
+    CHECK_EQ(timer_read(gb, TIMA_ADDR), (gb->cpu.cycles - start) / 64);
+    CHECK_EQ(timer_read(gb, DIV_ADDR), ((gb->cpu.cycles - start) >> 8) & 0xFF);
+
+    machine_destroy(gb);
+}
+
+int main (void) {
+    test_rom(rom, idle, sizeof(idle));
+
+    test_div();
+    test_rates();
+    test_overflow();
+    test_falling_edges();
+    test_running();
+
+    return test_result("timer");
+}
\ No newline at end of file
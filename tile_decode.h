@@ -0,0 +1,254 @@
+#pragma once
+
+#include "common.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TILE_DECODE_HAS_SSE2
+#define TILE_DECODE_HAS_AVX2
+#define TILE_DECODE_NAME "avx2"
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TILE_DECODE_HAS_SSE2
+#define TILE_DECODE_NAME "sse2"
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TILE_DECODE_HAS_NEON
+#define TILE_DECODE_NAME "neon"
+#else
+#define TILE_DECODE_NAME "swar"
+#endif
+
+/*
+ * 2bpp tile rows
+ *
+ * A tile row is two bit planes, pixel i takes bit 7 - i of the low plane as
+ * bit 0 of its colour index and the same bit of the high plane as bit 1.
+ * The vector paths never build the index: with l and h as all-ones lane
+ * masks the palette lookup is
+ *
+ *   c0 ^ (l & (c0 ^ c1)) ^ (h & (c0 ^ c2)) ^ (l & h & (c0 ^ c1 ^ c2 ^ c3))
+ *
+ * which is a handful of AND/XOR ops for a whole row of 32-bit pixels.
+ */
+
+// Byte i of the result is bit 7 - i of the input, so byte 0 is the leftmost pixel
+static inline uint64_t tile_spread_bits (uint8_t bits) {
+	uint64_t x = (bits * 0x0101010101010101ULL) & 0x0102040810204080ULL;
+
+	return ((x + 0x7F7F7F7F7F7F7F7FULL) >> 7) & 0x0101010101010101ULL;
+}
+
+static inline void tile_store_u64 (uint8_t *out, uint64_t bytes) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	for (int i = 0; i < 8; i++)
+		out[i] = bytes >> (i * 8);
+#else
+	memcpy(out, &bytes, sizeof(bytes));
+#endif
+}
+
+static inline void tile_decode_row_scalar (uint8_t low, uint8_t high, const uint32_t *palette, uint32_t *out) {
+	for (int i = 0; i < 8; i++)
+		out[i] = palette[get_bit_u8(&low, 7 - i) | (get_bit_u8(&high, 7 - i) << 1)];
+}
+
+// All eight colour indices come out of two multiplies and a few masks
+static inline void tile_decode_indices (uint8_t low, uint8_t high, uint8_t *out) {
+	tile_store_u64(out, tile_spread_bits(low) | (tile_spread_bits(high) << 1));
+}
+
+static inline void tile_decode_row_swar (uint8_t low, uint8_t high, const uint32_t *palette, uint32_t *out) {
+	uint64_t indices = tile_spread_bits(low) | (tile_spread_bits(high) << 1);
+
+	for (int i = 0; i < 8; i++)
+		out[i] = palette[(indices >> (i * 8)) & 3];
+}
+
+#ifdef TILE_DECODE_HAS_SSE2
+static inline void tile_decode_row_sse2 (uint8_t low, uint8_t high, const uint32_t *palette, uint32_t *out) {
+	const __m128i left_low = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+	const __m128i left_high = _mm_slli_epi32(left_low, 8);
+	__m128i planes = _mm_set1_epi32(low | (high << 8));
+	__m128i c0 = _mm_set1_epi32(palette[0]);
+	__m128i d1 = _mm_set1_epi32(palette[0] ^ palette[1]);
+	__m128i d2 = _mm_set1_epi32(palette[0] ^ palette[2]);
+	__m128i d3 = _mm_set1_epi32(palette[0] ^ palette[1] ^ palette[2] ^ palette[3]);
+
+	// Both planes share one broadcast, the right half reuses the left masks on the planes shifted by four
+	for (int half = 0; half < 2; half++) {
+		__m128i l = _mm_cmpeq_epi32(_mm_and_si128(planes, left_low), left_low);
+		__m128i h = _mm_cmpeq_epi32(_mm_and_si128(planes, left_high), left_high);
+		__m128i color = _mm_xor_si128(c0, _mm_and_si128(l, d1));
+
+		color = _mm_xor_si128(color, _mm_and_si128(h, d2));
+		color = _mm_xor_si128(color, _mm_and_si128(_mm_and_si128(l, h), d3));
+
+		_mm_storeu_si128((__m128i *)(out + half * 4), color);
+		planes = _mm_slli_epi32(planes, 4);
+	}
+}
+#endif
+
+#ifdef TILE_DECODE_HAS_AVX2
+static inline void tile_decode_row_avx2 (uint8_t low, uint8_t high, const uint32_t *palette, uint32_t *out) {
+	const __m256i bits = _mm256_set_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+	__m256i l = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(low), bits), bits);
+	__m256i h = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(high), bits), bits);
+	__m256i color = _mm256_set1_epi32(palette[0]);
+
+	color = _mm256_xor_si256(color, _mm256_and_si256(l, _mm256_set1_epi32(palette[0] ^ palette[1])));
+	color = _mm256_xor_si256(color, _mm256_and_si256(h, _mm256_set1_epi32(palette[0] ^ palette[2])));
+	color = _mm256_xor_si256(color, _mm256_and_si256(_mm256_and_si256(l, h),
+		_mm256_set1_epi32(palette[0] ^ palette[1] ^ palette[2] ^ palette[3])));
+
+	_mm256_storeu_si256((__m256i *)out, color);
+}
+#endif
+
+#ifdef TILE_DECODE_HAS_NEON
+static inline void tile_decode_row_neon (uint8_t low, uint8_t high, const uint32_t *palette, uint32_t *out) {
+	static const uint32_t masks[8] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+	uint32x4_t lo = vdupq_n_u32(low);
+	uint32x4_t hi = vdupq_n_u32(high);
+	uint32x4_t c0 = vdupq_n_u32(palette[0]);
+	uint32x4_t d1 = vdupq_n_u32(palette[0] ^ palette[1]);
+	uint32x4_t d2 = vdupq_n_u32(palette[0] ^ palette[2]);
+	uint32x4_t d3 = vdupq_n_u32(palette[0] ^ palette[1] ^ palette[2] ^ palette[3]);
+
+	for (int half = 0; half < 2; half++) {
+		uint32x4_t bits = vld1q_u32(masks + half * 4);
+		uint32x4_t l = vtstq_u32(lo, bits);
+		uint32x4_t h = vtstq_u32(hi, bits);
+		uint32x4_t color = veorq_u32(c0, vandq_u32(l, d1));
+
+		color = veorq_u32(color, vandq_u32(h, d2));
+		color = veorq_u32(color, vandq_u32(vandq_u32(l, h), d3));
+
+		vst1q_u32(out + half * 4, color);
+	}
+}
+#endif
+
+// Widest path the build targets, palette holds the four resolved colours for indices 0 - 3
+static inline void tile_decode_row (uint8_t low, uint8_t high, const uint32_t *palette, uint32_t *out) {
+#if defined(TILE_DECODE_HAS_AVX2)
+	tile_decode_row_avx2(low, high, palette, out);
+#elif defined(TILE_DECODE_HAS_SSE2)
+	tile_decode_row_sse2(low, high, palette, out);
+#elif defined(TILE_DECODE_HAS_NEON)
+	tile_decode_row_neon(low, high, palette, out);
+#else
+	tile_decode_row_swar(low, high, palette, out);
+#endif
+}
+
+/*
+ * Cached rows
+ *
+ * The tile cache keeps rows as colour indices, one byte per pixel. Drawing
+ * a line is then a copy of cached rows plus one palette pass. The scalar
+ * pass is a plain lookup, the SIMD ones use the same mask expression with
+ * l and h taken from bits 0 and 1 of each index. Counts are a multiple of 8.
+ */
+
+static inline void tile_resolve_scalar (const uint8_t *indices, int count, const uint32_t *palette, uint32_t *out) {
+	for (int i = 0; i < count; i++)
+		out[i] = palette[indices[i] & 3];
+}
+
+#ifdef TILE_DECODE_HAS_SSE2
+static inline void tile_resolve_sse2 (const uint8_t *indices, int count, const uint32_t *palette, uint32_t *out) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i two = _mm_set1_epi32(2);
+	__m128i c0 = _mm_set1_epi32(palette[0]);
+	__m128i d1 = _mm_set1_epi32(palette[0] ^ palette[1]);
+	__m128i d2 = _mm_set1_epi32(palette[0] ^ palette[2]);
+	__m128i d3 = _mm_set1_epi32(palette[0] ^ palette[1] ^ palette[2] ^ palette[3]);
+
+	for (int i = 0; i < count; i += 8) {
+		__m128i words = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(indices + i)), zero);
+
+		for (int half = 0; half < 2; half++) {
+			__m128i v = half ? _mm_unpackhi_epi16(words, zero) : _mm_unpacklo_epi16(words, zero);
+			__m128i l = _mm_cmpeq_epi32(_mm_and_si128(v, one), one);
+			__m128i h = _mm_cmpeq_epi32(_mm_and_si128(v, two), two);
+			__m128i color = _mm_xor_si128(c0, _mm_and_si128(l, d1));
+
+			color = _mm_xor_si128(color, _mm_and_si128(h, d2));
+			color = _mm_xor_si128(color, _mm_and_si128(_mm_and_si128(l, h), d3));
+
+			_mm_storeu_si128((__m128i *)(out + i + half * 4), color);
+		}
+	}
+}
+#endif
+
+#ifdef TILE_DECODE_HAS_AVX2
+static inline void tile_resolve_avx2 (const uint8_t *indices, int count, const uint32_t *palette, uint32_t *out) {
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i two = _mm256_set1_epi32(2);
+	__m256i c0 = _mm256_set1_epi32(palette[0]);
+	__m256i d1 = _mm256_set1_epi32(palette[0] ^ palette[1]);
+	__m256i d2 = _mm256_set1_epi32(palette[0] ^ palette[2]);
+	__m256i d3 = _mm256_set1_epi32(palette[0] ^ palette[1] ^ palette[2] ^ palette[3]);
+
+	for (int i = 0; i < count; i += 8) {
+		__m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(indices + i)));
+		__m256i l = _mm256_cmpeq_epi32(_mm256_and_si256(v, one), one);
+		__m256i h = _mm256_cmpeq_epi32(_mm256_and_si256(v, two), two);
+		__m256i color = _mm256_xor_si256(c0, _mm256_and_si256(l, d1));
+
+		color = _mm256_xor_si256(color, _mm256_and_si256(h, d2));
+		color = _mm256_xor_si256(color, _mm256_and_si256(_mm256_and_si256(l, h), d3));
+
+		_mm256_storeu_si256((__m256i *)(out + i), color);
+	}
+}
+#endif
+
+#ifdef TILE_DECODE_HAS_NEON
+static inline void tile_resolve_neon (const uint8_t *indices, int count, const uint32_t *palette, uint32_t *out) {
+	uint32x4_t one = vdupq_n_u32(1);
+	uint32x4_t two = vdupq_n_u32(2);
+	uint32x4_t c0 = vdupq_n_u32(palette[0]);
+	uint32x4_t d1 = vdupq_n_u32(palette[0] ^ palette[1]);
+	uint32x4_t d2 = vdupq_n_u32(palette[0] ^ palette[2]);
+	uint32x4_t d3 = vdupq_n_u32(palette[0] ^ palette[1] ^ palette[2] ^ palette[3]);
+
+	for (int i = 0; i < count; i += 8) {
+		uint16x8_t words = vmovl_u8(vld1_u8(indices + i));
+
+		for (int half = 0; half < 2; half++) {
+			uint32x4_t v = vmovl_u16(half ? vget_high_u16(words) : vget_low_u16(words));
+			uint32x4_t l = vtstq_u32(v, one);
+			uint32x4_t h = vtstq_u32(v, two);
+			uint32x4_t color = veorq_u32(c0, vandq_u32(l, d1));
+
+			color = veorq_u32(color, vandq_u32(h, d2));
+			color = veorq_u32(color, vandq_u32(vandq_u32(l, h), d3));
+
+			vst1q_u32(out + i + half * 4, color);
+		}
+	}
+}
+#endif
+
+// Maps a run of colour indices through a palette with the widest path the build targets
+static inline void tile_resolve_line (const uint8_t *indices, int count, const uint32_t *palette, uint32_t *out) {
+	uint32_t colors[4];
+
+	// A local copy can't alias out, so the palette terms are built once per call
+	memcpy(colors, palette, sizeof(colors));
+
+#if defined(TILE_DECODE_HAS_AVX2)
+	tile_resolve_avx2(indices, count, colors, out);
+#elif defined(TILE_DECODE_HAS_SSE2)
+	tile_resolve_sse2(indices, count, colors, out);
+#elif defined(TILE_DECODE_HAS_NEON)
+	tile_resolve_neon(indices, count, colors, out);
+#else
+	tile_resolve_scalar(indices, count, colors, out);
+#endif
+}
\ No newline at end of file
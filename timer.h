@@ -0,0 +1,177 @@
+#pragma once
+
+#include "common.h"
+#include "bus.h"
+#include "scheduler.h"
+
+#define DIV_ADDR 0xFF04
+#define TIMA_ADDR 0xFF05
+#define TMA_ADDR 0xFF06
+#define TAC_ADDR 0xFF07
+
+#define TAC_ENABLE 0x04
+#define TAC_CLOCK 0x03
+
+// Internal counter value the DMG boot ROM leaves behind, DIV reads 0xAB
+#define TIMER_BOOT_COUNTER 0xABCC
+
+// Bit of the internal counter whose falling edge clocks TIMA, for each TAC clock select
+static const uint8_t timer_tac_bit[4] = { 9, 3, 5, 7 };
+
+typedef struct {
+	bus_ctx *bus;
+	scheduler_ctx *sched;
+	const uint64_t *clock;
+
+	// The 16 bit internal counter is never stored, it is always clock - div_base, DIV is its top byte.
+	// TIMA in io[] is only correct as of the counter value in synced
+	uint64_t div_base;
+	uint64_t synced;
+} timer_ctx;
+
+static inline uint64_t timer_counter (timer_ctx *timer) {
+	return *timer->clock - timer->div_base;
+}
+
+// Period of the TIMA clock in cycles, 0 while TAC has the timer stopped
+static inline uint64_t timer_period (timer_ctx *timer) {
+	uint8_t tac = timer->bus->io[TAC_ADDR - IO_ADDR];
+
+	if (!(tac & TAC_ENABLE))
+		return 0;
+
+	return 2ULL << timer_tac_bit[tac & TAC_CLOCK];
+}
+
+// Clocks TIMA edges times, reloading from TMA and raising the interrupt on each overflow
+static inline void timer_tick (timer_ctx *timer, uint64_t edges) {
+	uint8_t *tima = &timer->bus->io[TIMA_ADDR - IO_ADDR];
+
+	while (edges) {
+		uint64_t room = 0x100 - *tima;
+
+		if (edges < room) {
+			*tima += edges;
+			break;
+		}
+
+		edges -= room;
+		*tima = timer->bus->io[TMA_ADDR - IO_ADDR];
+		bus_request_interrupt(timer->bus, INTERRUPT_TIMER);
+	}
+}
+
+// Catch-up: applies every falling edge of the selected counter bit since the last sync
+static inline void timer_sync (timer_ctx *timer) {
+	uint64_t now = timer_counter(timer);
+	uint64_t period = timer_period(timer);
+
+	if (period)
+		timer_tick(timer, now / period - timer->synced / period);
+
+	timer->synced = now;
+}
+
+// Queues the next TIMA overflow as a single event, there is nothing to do on the edges in between
+static inline void timer_schedule (timer_ctx *timer) {
+	uint64_t period = timer_period(timer);
+	uint64_t edges = 0x100 - timer->bus->io[TIMA_ADDR - IO_ADDR];
+
+	if (period == 0) {
+		scheduler_cancel(timer->sched, SCHED_TIMER);
+		return;
+	}
+
+	scheduler_schedule(timer->sched, SCHED_TIMER, timer->div_base + (timer->synced / period + edges) * period);
+}
+
+static inline void timer_event (void *ctx, uint64_t when) {
+	timer_ctx *timer = ctx;
+
+	timer_sync(timer);
+	timer_schedule(timer);
+}
+
+// The AND of the enable bit and the selected counter bit, TIMA counts its falling edges
+static inline bool timer_signal (timer_ctx *timer, uint8_t tac) {
+	return (tac & TAC_ENABLE) && (timer_counter(timer) >> timer_tac_bit[tac & TAC_CLOCK]) & 1;
+}
+
+static inline uint8_t timer_read_div (void *ctx, uint16_t addr) {
+	timer_ctx *timer = ctx;
+
+	return timer_counter(timer) >> 8;
+}
+
+static inline uint8_t timer_read_tima (void *ctx, uint16_t addr) {
+	timer_ctx *timer = ctx;
+
+	timer_sync(timer);
+	return timer->bus->io[TIMA_ADDR - IO_ADDR];
+}
+
+static inline uint8_t timer_read_tac (void *ctx, uint16_t addr) {
+	timer_ctx *timer = ctx;
+
+	return 0xF8 | timer->bus->io[TAC_ADDR - IO_ADDR];
+}
+
+// Resetting the counter drops the selected bit to 0, which clocks TIMA if it was 1
+static inline void timer_write_div (void *ctx, uint16_t addr, uint8_t data) {
+	timer_ctx *timer = ctx;
+
+	timer_sync(timer);
+
+	if (timer_signal(timer, timer->bus->io[TAC_ADDR - IO_ADDR]))
+		timer_tick(timer, 1);
+
+	timer->div_base = *timer->clock;
+	timer->synced = 0;
+	timer_schedule(timer);
+}
+
+static inline void timer_write_tima (void *ctx, uint16_t addr, uint8_t data) {
+	timer_ctx *timer = ctx;
+
+	timer_sync(timer);
+	timer->bus->io[TIMA_ADDR - IO_ADDR] = data;
+	timer_schedule(timer);
+}
+
+static inline void timer_write_tma (void *ctx, uint16_t addr, uint8_t data) {
+	timer_ctx *timer = ctx;
+
+	timer_sync(timer);
+	timer->bus->io[TMA_ADDR - IO_ADDR] = data;
+}
+
+// Disabling the timer or moving the clock select to a low bit is also a falling edge on DMG
+static inline void timer_write_tac (void *ctx, uint16_t addr, uint8_t data) {
+	timer_ctx *timer = ctx;
+	uint8_t old = timer->bus->io[TAC_ADDR - IO_ADDR];
+
+	timer_sync(timer);
+
+	if (timer_signal(timer, old) && !timer_signal(timer, data))
+		timer_tick(timer, 1);
+
+	timer->bus->io[TAC_ADDR - IO_ADDR] = data & (TAC_ENABLE | TAC_CLOCK);
+	timer_schedule(timer);
+}
+
+static inline void timer_init (timer_ctx *timer, bus_ctx *bus, scheduler_ctx *sched, const uint64_t *clock) {
+	memset(timer, 0, sizeof(*timer));
+
+	timer->bus = bus;
+	timer->sched = sched;
+	timer->clock = clock;
+	timer->div_base = *clock - TIMER_BOOT_COUNTER;
+	timer->synced = TIMER_BOOT_COUNTER;
+
+	bus_map_io(bus, DIV_ADDR, timer_read_div, timer_write_div, timer);
+	bus_map_io(bus, TIMA_ADDR, timer_read_tima, timer_write_tima, timer);
+	bus_map_io(bus, TMA_ADDR, NULL, timer_write_tma, timer);
+	bus_map_io(bus, TAC_ADDR, timer_read_tac, timer_write_tac, timer);
+
+	scheduler_register(sched, SCHED_TIMER, timer_event, timer);
+}
\ No newline at end of file
@@ -0,0 +1,562 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "machine.h"
+#include "rom_image.h"
+
+#define RUNNER_DEFAULT_FRAMES 7200 // Two emulated minutes
+#define RUNNER_DEFAULT_SERIAL "Passed"
+#define RUNNER_FAIL_SERIAL "Failed"
+#define RUNNER_MAX_WORKERS 256
+#define RUNNER_MAX_INPUTS 256
+#define RUNNER_REGISTERS 8
+
+// Register signature order, "B=03,C=05" style signatures name them by these letters
+static const char runner_register_names[] = "AFBCDEHL";
+
+// Every check that is set has to hold at the same frame boundary for a pass
+typedef struct {
+    const char *serial; // Text the ROM must print over the link port, NULL when unchecked
+    int registers[RUNNER_REGISTERS]; // -1 for registers the signature leaves out
+    bool check_registers;
+    uint64_t frame_hash;
+    bool check_frame_hash;
+    uint64_t max_frames;
+} test_criteria;
+
+typedef struct {
+    char *path;
+    test_criteria criteria;
+
+    bool passed;
+    const char *reason;
+    serial_buffer serial;
+    uint64_t frames;
+    uint64_t frame_hash;
+    double seconds;
+} test_case;
+
+// One contiguous range of tests per worker, claimed from the front with a single atomic add. Not a deque, any
+// worker may claim from any range, so one that runs out of its own helps drain the others
+typedef struct {
+    atomic_size_t next;
+    size_t end;
+} test_range;
+
+typedef struct {
+    test_case *tests;
+    size_t count;
+    test_range ranges[RUNNER_MAX_WORKERS];
+    int workers;
+    atomic_size_t done;
+    pthread_mutex_t print_lock;
+} test_runner;
+
+typedef struct {
+    test_runner *runner;
+    int id;
+} test_worker;
+
+static double now_seconds (void) {
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void print_usage (const char *program_name) {
+    printf("Usage: %s [options] (rom.gb | directory) ...\n", program_name);
+    printf("  --manifest PATH   One ROM per line followed by any of serial=TEXT regs=SIG fbhash=HEX frames=N\n");
+    printf("  --serial TEXT     Pass once the serial output contains TEXT (default \"%s\" when nothing else is checked)\n", RUNNER_DEFAULT_SERIAL);
+    printf("  --regs SIG        Pass once the registers match SIG, e.g. B=03,C=05,D=08,E=0D,H=15,L=22\n");
+    printf("  --fbhash HEX      Pass once the last drawn frame hashes to HEX\n");
+    printf("  --frames N        Fail after N frames without a pass (default %d)\n", RUNNER_DEFAULT_FRAMES);
+    printf("  --jobs N          Worker threads (default: one per core)\n");
+    printf("  --junit PATH      Write JUnit XML, '-' for stdout\n");
+    printf("  --json PATH       Write JSON, '-' for stdout\n");
+    printf("Serial output containing \"%s\" fails a test with a serial check straight away.\n", RUNNER_FAIL_SERIAL);
+    exit(EXIT_SUCCESS);
+}
+
+static bool parse_registers (const char *sig, test_criteria *criteria) {
+    for (int i = 0; i < RUNNER_REGISTERS; i++)
+        criteria->registers[i] = -1;
+
+    while (*sig) {
+        const char *name = strchr(runner_register_names, *sig);
+        char *end;
+
+        if (name == NULL || sig[1] != '=')
+            return false;
+
+        criteria->registers[name - runner_register_names] = (int)(strtoul(sig + 2, &end, 16) & 0xFF);
+
+        if (end == sig + 2 || (*end != ',' && *end != '\0'))
+            return false;
+
+        sig = *end ? end + 1 : end;
+    }
+
+    criteria->check_registers = true;
+    return true;
+}
+
+// key=value, false for unknown keys or malformed values
+static bool parse_criterion (const char *arg, test_criteria *criteria) {
+    if (strncmp(arg, "serial=", 7) == 0) {
+        criteria->serial = arg + 7;
+    } else if (strncmp(arg, "regs=", 5) == 0) {
+        return parse_registers(arg + 5, criteria);
+    } else if (strncmp(arg, "fbhash=", 7) == 0) {
+        criteria->frame_hash = strtoull(arg + 7, NULL, 16);
+        criteria->check_frame_hash = true;
+    } else if (strncmp(arg, "frames=", 7) == 0) {
+        criteria->max_frames = strtoull(arg + 7, NULL, 0);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// The test keeps its own copies of the path and serial text, both are freed with the test list
+static void add_test (test_case **tests, size_t *count, size_t *capacity, const char *path, test_criteria *criteria) {
+    test_case *test;
+
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+
+        if ((*tests = realloc(*tests, *capacity * sizeof(test_case))) == NULL) {
+            perror("Unable to allocate the test list");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    test = &(*tests)[(*count)++];
+    memset(test, 0, sizeof(*test));
+    test->path = strdup(path);
+    test->criteria = *criteria;
+
+    if (criteria->serial)
+        test->criteria.serial = strdup(criteria->serial);
+}
+
+static bool is_rom_path (const char *path) {
+    const char *ext = strrchr(path, '.');
+
+    return ext && (strcmp(ext, ".gb") == 0 || strcmp(ext, ".gbc") == 0);
+}
+
+// Every ROM below dir, suites like mooneye keep their tests in subdirectories
+static void add_directory (test_case **tests, size_t *count, size_t *capacity, const char *dir, test_criteria *criteria) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+
+    if (d == NULL) {
+        fprintf(stderr, "%s: unable to open directory\n", dir);
+        return;
+    }
+
+    while ((entry = readdir(d)) != NULL) {
+        char path[FILENAME_MAX];
+        struct stat st;
+
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+        if (stat(path, &st) != 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            add_directory(tests, count, capacity, path, criteria);
+        else if (is_rom_path(path))
+            add_test(tests, count, capacity, path, criteria);
+    }
+
+    closedir(d);
+}
+
+// Paths in a manifest are relative to the manifest itself
+static bool add_manifest (test_case **tests, size_t *count, size_t *capacity, const char *manifest, test_criteria *defaults) {
+    FILE *file = fopen(manifest, "r");
+    const char *slash = strrchr(manifest, '/');
+    int base_len = slash ? (int)(slash - manifest) + 1 : 0;
+    char line[1024];
+    int line_num = 0;
+
+    if (file == NULL) {
+        fprintf(stderr, "%s: unable to open manifest\n", manifest);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        test_criteria criteria = { NULL, { -1, -1, -1, -1, -1, -1, -1, -1 }, false, 0, false, defaults->max_frames };
+        char path[FILENAME_MAX];
+        char *token = strtok(line, " \t\r\n");
+
+        line_num++;
+
+        if (token == NULL || token[0] == '#')
+            continue;
+
+        if (token[0] == '/')
+            snprintf(path, sizeof(path), "%s", token);
+        else
+            snprintf(path, sizeof(path), "%.*s%s", base_len, manifest, token);
+
+        while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+            if (!parse_criterion(token, &criteria)) {
+                fprintf(stderr, "%s:%d: bad criterion '%s'\n", manifest, line_num, token);
+                fclose(file);
+                return false;
+            }
+        }
+
+        // Checks on the line replace the command line ones rather than adding to them
+        if (!criteria.serial && !criteria.check_registers && !criteria.check_frame_hash) {
+            criteria.serial = defaults->serial;
+            memcpy(criteria.registers, defaults->registers, sizeof(criteria.registers));
+            criteria.check_registers = defaults->check_registers;
+            criteria.frame_hash = defaults->frame_hash;
+            criteria.check_frame_hash = defaults->check_frame_hash;
+        }
+
+        add_test(tests, count, capacity, path, &criteria);
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Cycles until the PPU next enters line 144, a whole frame's worth while the LCD is off and nothing is drawn
+static uint64_t cycles_to_vblank (gb_machine *gb) {
+    ppu_ctx *ppu = &gb->ppu;
+    uint64_t lines;
+
+    ppu_sync(ppu);
+
+    if (!(gb->bus.io[LCDC_ADDR - IO_ADDR] & LCDC_ENABLE))
+        return CYCLES_PER_FRAME;
+
+    lines = ppu->ly < LCD_HEIGHT ? LCD_HEIGHT - ppu->ly : LCD_HEIGHT + PPU_LINES - ppu->ly;
+    return lines * PPU_LINE_CYCLES - ppu->dot;
+}
+
+// Hash of the last drawn frame, built from the PPU's per-line hashes rather than the pixels. Only taken at
+// the start of VBlank, when every line belongs to the frame that just finished
+static uint64_t frame_hash (gb_machine *gb) {
+    return hash_fnv1a_64(FNV1A_64_INIT, (const uint8_t *)gb->ppu.line_hash, sizeof(gb->ppu.line_hash));
+}
+
+static bool criteria_met (test_case *test, gb_machine *gb) {
+    test_criteria *c = &test->criteria;
+    uint8_t registers[RUNNER_REGISTERS] = {
+        gb->cpu.rA, sm83_get_f(&gb->cpu), gb->cpu.rB, gb->cpu.rC, gb->cpu.rD, gb->cpu.rE, gb->cpu.rH, gb->cpu.rL
+    };
+
+    if (c->serial && strstr(test->serial.data, c->serial) == NULL)
+        return false;
+
+    for (int i = 0; c->check_registers && i < RUNNER_REGISTERS; i++) {
+        if (c->registers[i] >= 0 && c->registers[i] != registers[i])
+            return false;
+    }
+
+    return !c->check_frame_hash || test->frame_hash == c->frame_hash;
+}
+
+static void run_test (test_case *test) {
+    rom_image rom = {0};
+    gb_machine *gb = NULL;
+    double start = now_seconds();
+
+    if (!rom_image_open(&rom, test->path)) {
+        test->reason = "unable to load ROM";
+    } else if ((gb = machine_create(rom.data, rom.size)) == NULL) {
+        test->reason = "truncated ROM or unsupported cartridge type";
+    } else {
+        serial_set_sink(&gb->serial, serial_sink_buffer, &test->serial);
+
+        // Checks happen at VBlank, so a frame hash never mixes lines from two frames
+        while (test->frames < test->criteria.max_frames) {
+            machine_run(gb, cycles_to_vblank(gb));
+            ppu_sync(&gb->ppu);
+            test->frames++;
+
+            test->frame_hash = frame_hash(gb);
+
+            // Audio is never read, the APU drops what piles up on its own
+            if (!gb->cpu.is_running) {
+                test->reason = "CPU stopped";
+                break;
+            }
+
+            // Only for tests judged on serial output, others may print the word as part of what they show
+            if (test->criteria.serial && strstr(test->serial.data, RUNNER_FAIL_SERIAL)) {
+                test->reason = "serial output reported failure";
+                break;
+            }
+
+            if (criteria_met(test, gb)) {
+                test->passed = true;
+                test->reason = "passed";
+                break;
+            }
+        }
+
+        if (test->reason == NULL)
+            test->reason = "timed out";
+    }
+
+    test->seconds = now_seconds() - start;
+
+    machine_destroy(gb);
+    rom_image_close(&rom);
+}
+
+static bool range_claim (test_range *range, size_t *index) {
+    size_t i = atomic_fetch_add(&range->next, 1);
+
+    *index = i;
+    return i < range->end;
+}
+
+static void *worker_main (void *arg) {
+    test_worker *worker = arg;
+    test_runner *runner = worker->runner;
+    size_t index;
+
+    for (;;) {
+        bool found = range_claim(&runner->ranges[worker->id], &index);
+
+        // Own range done, claim from the other workers' ranges starting with the next worker along
+        for (int i = 1; !found && i < runner->workers; i++)
+            found = range_claim(&runner->ranges[(worker->id + i) % runner->workers], &index);
+
+        if (!found)
+            break;
+
+        run_test(&runner->tests[index]);
+
+        pthread_mutex_lock(&runner->print_lock);
+        printf("[%zu/%zu] %s %7.2fs %6llu frames  %s%s%s\n", atomic_fetch_add(&runner->done, 1) + 1, runner->count,
+            runner->tests[index].passed ? "PASS" : "FAIL", runner->tests[index].seconds,
+            (unsigned long long)runner->tests[index].frames, runner->tests[index].path,
+            runner->tests[index].passed ? "" : " - ", runner->tests[index].passed ? "" : runner->tests[index].reason);
+        fflush(stdout);
+        pthread_mutex_unlock(&runner->print_lock);
+    }
+
+    return NULL;
+}
+
+// Paths and serial text are raw bytes, bytes from 0x80 up are written as the Latin-1 characters of the same
+// value so the reports stay valid UTF-8. XML 1.0 has no way to write the other C0 controls, they become '?'
+static void print_escaped (FILE *out, const char *str, bool xml) {
+    for (const char *c = str; *c; c++) {
+        unsigned char ch = *c;
+
+        if (xml && ch == '<') fputs("&lt;", out);
+        else if (xml && ch == '>') fputs("&gt;", out);
+        else if (xml && ch == '&') fputs("&amp;", out);
+        else if (xml && ch == '"') fputs("&quot;", out);
+        else if (xml && ch >= 0x80) fprintf(out, "&#x%X;", ch);
+        else if (xml && ch < 0x20 && ch != '\t' && ch != '\n' && ch != '\r') fputc('?', out);
+        else if (!xml && (ch == '"' || ch == '\\')) fprintf(out, "\\%c", ch);
+        else if (!xml && ch == '\n') fputs("\\n", out);
+        else if (!xml && ch == '\t') fputs("\\t", out);
+        else if (!xml && (ch < 0x20 || ch >= 0x80)) fprintf(out, "\\u%04X", ch);
+        else fputc(ch, out);
+    }
+}
+
+static void print_junit (FILE *out, test_case *tests, size_t count, size_t failures, double seconds) {
+    fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(out, "<testsuite name=\"emu_testrunner\" tests=\"%zu\" failures=\"%zu\" time=\"%.3f\">\n", count, failures, seconds);
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(out, "  <testcase classname=\"emu_testrunner\" name=\"");
+        print_escaped(out, tests[i].path, true);
+        fprintf(out, "\" time=\"%.3f\">\n", tests[i].seconds);
+
+        if (!tests[i].passed) {
+            fprintf(out, "    <failure message=\"");
+            print_escaped(out, tests[i].reason, true);
+            fprintf(out, "\"/>\n");
+        }
+
+        if (tests[i].serial.len) {
+            fprintf(out, "    <system-out>");
+            print_escaped(out, tests[i].serial.data, true);
+            fprintf(out, "</system-out>\n");
+        }
+
+        fprintf(out, "  </testcase>\n");
+    }
+
+    fprintf(out, "</testsuite>\n");
+}
+
+static void print_json (FILE *out, test_case *tests, size_t count, size_t failures, double seconds, int workers) {
+    fprintf(out, "{\n  \"tests\": %zu,\n  \"failures\": %zu,\n  \"seconds\": %.3f,\n  \"workers\": %d,\n  \"results\": [",
+        count, failures, seconds, workers);
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(out, "%s\n    { \"path\": \"", i ? "," : "");
+        print_escaped(out, tests[i].path, false);
+        fprintf(out, "\", \"passed\": %s, \"reason\": \"", tests[i].passed ? "true" : "false");
+        print_escaped(out, tests[i].reason, false);
+        fprintf(out, "\", \"seconds\": %.3f, \"frames\": %llu, \"frame_hash\": \"0x%016llX\", \"serial\": \"",
+            tests[i].seconds, (unsigned long long)tests[i].frames, (unsigned long long)tests[i].frame_hash);
+        print_escaped(out, tests[i].serial.data, false);
+        fprintf(out, "\" }");
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+}
+
+static bool write_report (const char *path, test_case *tests, size_t count, size_t failures, double seconds, int workers, bool junit) {
+    FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+
+    if (out == NULL) {
+        fprintf(stderr, "%s: unable to open report\n", path);
+        return false;
+    }
+
+    if (junit)
+        print_junit(out, tests, count, failures, seconds);
+    else
+        print_json(out, tests, count, failures, seconds, workers);
+
+    if (out != stdout)
+        fclose(out);
+
+    return true;
+}
+
+int main (int argc, char *argv[]) {
+    test_criteria defaults = { NULL, { -1, -1, -1, -1, -1, -1, -1, -1 }, false, 0, false, RUNNER_DEFAULT_FRAMES };
+    test_case *tests = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t failures = 0;
+    const char *manifests[RUNNER_MAX_INPUTS];
+    const char *paths[RUNNER_MAX_INPUTS];
+    int manifest_count = 0;
+    int path_count = 0;
+    const char *junit_path = NULL;
+    const char *json_path = NULL;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    test_runner *runner = NULL;
+    test_worker worker_args[RUNNER_MAX_WORKERS];
+    pthread_t threads[RUNNER_MAX_WORKERS];
+    double start;
+    bool ok = true;
+
+    // Criteria flags set the defaults for every ROM, so they are read before any ROM is added
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "--manifest") == 0 && has_value && manifest_count < RUNNER_MAX_INPUTS) {
+            manifests[manifest_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--serial") == 0 && has_value) {
+            defaults.serial = argv[++i];
+        } else if (strcmp(argv[i], "--regs") == 0 && has_value) {
+            if (!parse_registers(argv[++i], &defaults))
+                print_usage(argv[0]);
+        } else if (strcmp(argv[i], "--fbhash") == 0 && has_value) {
+            defaults.frame_hash = strtoull(argv[++i], NULL, 16);
+            defaults.check_frame_hash = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            defaults.max_frames = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--jobs") == 0 && has_value) {
+            workers = strtol(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--junit") == 0 && has_value) {
+            junit_path = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && has_value) {
+            json_path = argv[++i];
+        } else if (argv[i][0] == '-' || path_count == RUNNER_MAX_INPUTS) {
+            print_usage(argv[0]);
+        } else {
+            paths[path_count++] = argv[i];
+        }
+    }
+
+    if (!defaults.serial && !defaults.check_registers && !defaults.check_frame_hash)
+        defaults.serial = RUNNER_DEFAULT_SERIAL;
+
+    for (int i = 0; i < manifest_count; i++)
+        ok &= add_manifest(&tests, &count, &capacity, manifests[i], &defaults);
+
+    for (int i = 0; i < path_count; i++) {
+        struct stat st;
+
+        if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode))
+            add_directory(&tests, &count, &capacity, paths[i], &defaults);
+        else
+            add_test(&tests, &count, &capacity, paths[i], &defaults);
+    }
+
+    if (count == 0) {
+        fprintf(stderr, "No ROMs to run\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((runner = calloc(1, sizeof(*runner))) == NULL) {
+        perror("Unable to allocate the runner");
+        return EXIT_FAILURE;
+    }
+
+    workers = workers < 1 ? 1 : workers > RUNNER_MAX_WORKERS ? RUNNER_MAX_WORKERS : workers;
+    workers = (size_t)workers > count ? (long)count : workers;
+
+    runner->tests = tests;
+    runner->count = count;
+    runner->workers = (int)workers;
+    pthread_mutex_init(&runner->print_lock, NULL);
+
+    for (int i = 0; i < runner->workers; i++) {
+        atomic_init(&runner->ranges[i].next, count * i / runner->workers);
+        runner->ranges[i].end = count * (i + 1) / runner->workers;
+    }
+
+    start = now_seconds();
+
+    for (int i = 0; i < runner->workers; i++) {
+        worker_args[i] = (test_worker){ runner, i };
+        pthread_create(&threads[i], NULL, worker_main, &worker_args[i]);
+    }
+
+    for (int i = 0; i < runner->workers; i++)
+        pthread_join(threads[i], NULL);
+
+    for (size_t i = 0; i < count; i++)
+        failures += !tests[i].passed;
+
+    printf("%zu passed, %zu failed in %.2fs on %d workers\n", count - failures, failures, now_seconds() - start, runner->workers);
+
+    if (junit_path)
+        ok &= write_report(junit_path, tests, count, failures, now_seconds() - start, runner->workers, true);
+
+    if (json_path)
+        ok &= write_report(json_path, tests, count, failures, now_seconds() - start, runner->workers, false);
+
+    pthread_mutex_destroy(&runner->print_lock);
+    free(runner);
+
+    for (size_t i = 0; i < count; i++) {
+        free(tests[i].path);
+        free((char *)tests[i].criteria.serial);
+    }
+
+    free(tests);
+
+    return ok && failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file